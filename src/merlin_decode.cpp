@@ -0,0 +1,611 @@
+// file : "merlin_decode.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the frame data decode kernels.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_decode.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MERLIN_DECODE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MERLIN_TARGET(isa)
+#else
+#define MERLIN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+
+// -----------------------------------------------------------------------------
+//
+// scalar kernels
+//
+// -----------------------------------------------------------------------------
+
+static void decode_u8_scalar(double * buf, const unsigned char * inbuf, size_t i0, size_t n)
+{
+	size_t i = 0;
+	for (i = i0; i < n; i++) {
+		buf[i] = (double)inbuf[i];
+	}
+}
+
+static void decode_u16_scalar(double * buf, const unsigned char * inbuf, size_t i0, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	unsigned __int16 u = 0;
+	if (swapbytes) { // assemble from big endian bytes
+		for (i = i0; i < n; i++) {
+			buf[i] = (double)(((unsigned int)inbuf[2 * i] << 8) | (unsigned int)inbuf[2 * i + 1]);
+		}
+	}
+	else { // native byte order
+		for (i = i0; i < n; i++) {
+			memcpy(&u, inbuf + 2 * i, 2);
+			buf[i] = (double)u;
+		}
+	}
+}
+
+static void decode_u32_scalar(double * buf, const unsigned char * inbuf, size_t i0, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	unsigned __int32 u = 0;
+	const unsigned char * p = NULL;
+	if (swapbytes) { // assemble from big endian bytes
+		for (i = i0; i < n; i++) {
+			p = inbuf + 4 * i;
+			u = ((unsigned __int32)p[0] << 24) | ((unsigned __int32)p[1] << 16) | ((unsigned __int32)p[2] << 8) | (unsigned __int32)p[3];
+			buf[i] = (double)u;
+		}
+	}
+	else { // native byte order
+		for (i = i0; i < n; i++) {
+			memcpy(&u, inbuf + 4 * i, 4);
+			buf[i] = (double)u;
+		}
+	}
+}
+
+
+static void accumulate_u8_scalar(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t i0, size_t n)
+{
+	size_t i = 0;
+	unsigned __int64 u = 0;
+	for (i = i0; i < n; i++) {
+		u = inbuf[i];
+		sum[i] += u;
+		sqr[i] += u * u;
+	}
+}
+
+static void accumulate_u16_scalar(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t i0, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	unsigned __int16 v = 0;
+	unsigned __int64 u = 0;
+	for (i = i0; i < n; i++) {
+		if (swapbytes) { // assemble from big endian bytes
+			u = ((unsigned __int64)inbuf[2 * i] << 8) | (unsigned __int64)inbuf[2 * i + 1];
+		}
+		else { // native byte order
+			memcpy(&v, inbuf + 2 * i, 2);
+			u = v;
+		}
+		sum[i] += u;
+		sqr[i] += u * u;
+	}
+}
+
+// -----------------------------------------------------------------------------
+//
+// span reduction kernels
+//
+// Products are accumulated in four lanes over groups of four pixels from
+// the start of each span, the remaining pixels of a span are summed
+// separately. The lanes are added up pairwise at the end. All kernel
+// levels use this order and give identical results.
+//
+// -----------------------------------------------------------------------------
+
+static double dot_spans_scalar(const double * a, const double * b, const size_t * span, size_t nspan)
+{
+	size_t k = 0, i = 0, i1 = 0, l = 0;
+	double acc[4] = { 0., 0., 0., 0. };
+	double t = 0.;
+	for (k = 0; k < nspan; k++) {
+		i1 = span[2 * k + 1];
+		for (i = span[2 * k]; i + 4 <= i1; i += 4) {
+			for (l = 0; l < 4; l++) {
+				acc[l] += a[i + l] * b[i + l];
+			}
+		}
+		for (; i < i1; i++) {
+			t += a[i] * b[i];
+		}
+	}
+	return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + t;
+}
+
+static void dot3_spans_scalar(const double * a, const double * b0, const double * b1, const double * b2, const size_t * span, size_t nspan, double * s)
+{
+	size_t k = 0, i = 0, i1 = 0, l = 0;
+	double acc0[4] = { 0., 0., 0., 0. }, acc1[4] = { 0., 0., 0., 0. }, acc2[4] = { 0., 0., 0., 0. };
+	double t0 = 0., t1 = 0., t2 = 0.;
+	for (k = 0; k < nspan; k++) {
+		i1 = span[2 * k + 1];
+		for (i = span[2 * k]; i + 4 <= i1; i += 4) {
+			for (l = 0; l < 4; l++) {
+				acc0[l] += a[i + l] * b0[i + l];
+				acc1[l] += a[i + l] * b1[i + l];
+				acc2[l] += a[i + l] * b2[i + l];
+			}
+		}
+		for (; i < i1; i++) {
+			t0 += a[i] * b0[i];
+			t1 += a[i] * b1[i];
+			t2 += a[i] * b2[i];
+		}
+	}
+	s[0] = ((acc0[0] + acc0[1]) + (acc0[2] + acc0[3])) + t0;
+	s[1] = ((acc1[0] + acc1[1]) + (acc1[2] + acc1[3])) + t1;
+	s[2] = ((acc2[0] + acc2[1]) + (acc2[2] + acc2[3])) + t2;
+}
+
+#ifdef MERLIN_DECODE_X86
+// -----------------------------------------------------------------------------
+//
+// SSSE3 kernels
+//
+// Bytes are reordered with pshufb and zero-extended to 32-bit integers,
+// which are converted pairwise to double. Unsigned 32-bit values are
+// offset by 2^31 to fit the signed conversion and shifted back exactly.
+//
+// -----------------------------------------------------------------------------
+
+MERLIN_TARGET("ssse3")
+static void decode_u8_ssse3(double * buf, const unsigned char * inbuf, size_t n)
+{
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	__m128i v, w, d;
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const __m128i*)(inbuf + i));
+		w = _mm_unpacklo_epi8(v, z); // values 0 - 7
+		d = _mm_unpacklo_epi16(w, z);
+		_mm_storeu_pd(buf + i, _mm_cvtepi32_pd(d));
+		_mm_storeu_pd(buf + i + 2, _mm_cvtepi32_pd(_mm_srli_si128(d, 8)));
+		d = _mm_unpackhi_epi16(w, z);
+		_mm_storeu_pd(buf + i + 4, _mm_cvtepi32_pd(d));
+		_mm_storeu_pd(buf + i + 6, _mm_cvtepi32_pd(_mm_srli_si128(d, 8)));
+		w = _mm_unpackhi_epi8(v, z); // values 8 - 15
+		d = _mm_unpacklo_epi16(w, z);
+		_mm_storeu_pd(buf + i + 8, _mm_cvtepi32_pd(d));
+		_mm_storeu_pd(buf + i + 10, _mm_cvtepi32_pd(_mm_srli_si128(d, 8)));
+		d = _mm_unpackhi_epi16(w, z);
+		_mm_storeu_pd(buf + i + 12, _mm_cvtepi32_pd(d));
+		_mm_storeu_pd(buf + i + 14, _mm_cvtepi32_pd(_mm_srli_si128(d, 8)));
+	}
+	decode_u8_scalar(buf, inbuf, i, n);
+}
+
+MERLIN_TARGET("ssse3")
+static void decode_u16_ssse3(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	const __m128i m = swapbytes ?
+		_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+		_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i v, d;
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(inbuf + 2 * i)), m);
+		d = _mm_unpacklo_epi16(v, z); // values 0 - 3
+		_mm_storeu_pd(buf + i, _mm_cvtepi32_pd(d));
+		_mm_storeu_pd(buf + i + 2, _mm_cvtepi32_pd(_mm_srli_si128(d, 8)));
+		d = _mm_unpackhi_epi16(v, z); // values 4 - 7
+		_mm_storeu_pd(buf + i + 4, _mm_cvtepi32_pd(d));
+		_mm_storeu_pd(buf + i + 6, _mm_cvtepi32_pd(_mm_srli_si128(d, 8)));
+	}
+	decode_u16_scalar(buf, inbuf, i, n, swapbytes);
+}
+
+MERLIN_TARGET("ssse3")
+static void decode_u32_ssse3(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	const __m128i s = _mm_set1_epi32((int)0x80000000);
+	const __m128d o = _mm_set1_pd(2147483648.0);
+	const __m128i m = swapbytes ?
+		_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12) :
+		_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i v;
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(inbuf + 4 * i)), m);
+		v = _mm_xor_si128(v, s); // to signed range
+		_mm_storeu_pd(buf + i, _mm_add_pd(_mm_cvtepi32_pd(v), o));
+		_mm_storeu_pd(buf + i + 2, _mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), o));
+	}
+	decode_u32_scalar(buf, inbuf, i, n, swapbytes);
+}
+
+MERLIN_TARGET("ssse3")
+static double dot_spans_ssse3(const double * a, const double * b, const size_t * span, size_t nspan)
+{
+	size_t k = 0, i = 0, i1 = 0;
+	__m128d acc01 = _mm_setzero_pd(), acc23 = _mm_setzero_pd(); // lanes 0,1 and 2,3
+	double acc[4];
+	double t = 0.;
+	for (k = 0; k < nspan; k++) {
+		i1 = span[2 * k + 1];
+		for (i = span[2 * k]; i + 4 <= i1; i += 4) {
+			acc01 = _mm_add_pd(acc01, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+			acc23 = _mm_add_pd(acc23, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+		}
+		for (; i < i1; i++) {
+			t += a[i] * b[i];
+		}
+	}
+	_mm_storeu_pd(acc, acc01);
+	_mm_storeu_pd(acc + 2, acc23);
+	return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + t;
+}
+
+MERLIN_TARGET("ssse3")
+static void dot3_spans_ssse3(const double * a, const double * b0, const double * b1, const double * b2, const size_t * span, size_t nspan, double * s)
+{
+	size_t k = 0, i = 0, i1 = 0;
+	__m128d acc001 = _mm_setzero_pd(), acc023 = _mm_setzero_pd();
+	__m128d acc101 = _mm_setzero_pd(), acc123 = _mm_setzero_pd();
+	__m128d acc201 = _mm_setzero_pd(), acc223 = _mm_setzero_pd();
+	__m128d va, vb;
+	double acc[12];
+	double t0 = 0., t1 = 0., t2 = 0.;
+	for (k = 0; k < nspan; k++) {
+		i1 = span[2 * k + 1];
+		for (i = span[2 * k]; i + 4 <= i1; i += 4) {
+			va = _mm_loadu_pd(a + i);
+			vb = _mm_loadu_pd(a + i + 2);
+			acc001 = _mm_add_pd(acc001, _mm_mul_pd(va, _mm_loadu_pd(b0 + i)));
+			acc023 = _mm_add_pd(acc023, _mm_mul_pd(vb, _mm_loadu_pd(b0 + i + 2)));
+			acc101 = _mm_add_pd(acc101, _mm_mul_pd(va, _mm_loadu_pd(b1 + i)));
+			acc123 = _mm_add_pd(acc123, _mm_mul_pd(vb, _mm_loadu_pd(b1 + i + 2)));
+			acc201 = _mm_add_pd(acc201, _mm_mul_pd(va, _mm_loadu_pd(b2 + i)));
+			acc223 = _mm_add_pd(acc223, _mm_mul_pd(vb, _mm_loadu_pd(b2 + i + 2)));
+		}
+		for (; i < i1; i++) {
+			t0 += a[i] * b0[i];
+			t1 += a[i] * b1[i];
+			t2 += a[i] * b2[i];
+		}
+	}
+	_mm_storeu_pd(acc, acc001);
+	_mm_storeu_pd(acc + 2, acc023);
+	_mm_storeu_pd(acc + 4, acc101);
+	_mm_storeu_pd(acc + 6, acc123);
+	_mm_storeu_pd(acc + 8, acc201);
+	_mm_storeu_pd(acc + 10, acc223);
+	s[0] = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + t0;
+	s[1] = ((acc[4] + acc[5]) + (acc[6] + acc[7])) + t1;
+	s[2] = ((acc[8] + acc[9]) + (acc[10] + acc[11])) + t2;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// AVX2 kernels
+//
+// Same scheme as the SSSE3 kernels with 256-bit registers. vpshufb works
+// within 128-bit lanes, which never splits a 16-bit or 32-bit value.
+//
+// -----------------------------------------------------------------------------
+
+MERLIN_TARGET("avx2")
+static void decode_u8_avx2(double * buf, const unsigned char * inbuf, size_t n)
+{
+	size_t i = 0;
+	__m128i v;
+	__m256i d;
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const __m128i*)(inbuf + i));
+		d = _mm256_cvtepu8_epi32(v); // values 0 - 7
+		_mm256_storeu_pd(buf + i, _mm256_cvtepi32_pd(_mm256_castsi256_si128(d)));
+		_mm256_storeu_pd(buf + i + 4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(d, 1)));
+		d = _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)); // values 8 - 15
+		_mm256_storeu_pd(buf + i + 8, _mm256_cvtepi32_pd(_mm256_castsi256_si128(d)));
+		_mm256_storeu_pd(buf + i + 12, _mm256_cvtepi32_pd(_mm256_extracti128_si256(d, 1)));
+	}
+	decode_u8_scalar(buf, inbuf, i, n);
+}
+
+MERLIN_TARGET("avx2")
+static void decode_u16_avx2(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	const __m256i m = swapbytes ?
+		_mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+		_mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m256i v, d;
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(inbuf + 2 * i)), m);
+		d = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)); // values 0 - 7
+		_mm256_storeu_pd(buf + i, _mm256_cvtepi32_pd(_mm256_castsi256_si128(d)));
+		_mm256_storeu_pd(buf + i + 4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(d, 1)));
+		d = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)); // values 8 - 15
+		_mm256_storeu_pd(buf + i + 8, _mm256_cvtepi32_pd(_mm256_castsi256_si128(d)));
+		_mm256_storeu_pd(buf + i + 12, _mm256_cvtepi32_pd(_mm256_extracti128_si256(d, 1)));
+	}
+	decode_u16_scalar(buf, inbuf, i, n, swapbytes);
+}
+
+MERLIN_TARGET("avx2")
+static void decode_u32_avx2(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	const __m256i s = _mm256_set1_epi32((int)0x80000000);
+	const __m256d o = _mm256_set1_pd(2147483648.0);
+	const __m256i m = swapbytes ?
+		_mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12) :
+		_mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m256i v;
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(inbuf + 4 * i)), m);
+		v = _mm256_xor_si256(v, s); // to signed range
+		_mm256_storeu_pd(buf + i, _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), o));
+		_mm256_storeu_pd(buf + i + 4, _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), o));
+	}
+	decode_u32_scalar(buf, inbuf, i, n, swapbytes);
+}
+
+MERLIN_TARGET("avx2")
+static double dot_spans_avx2(const double * a, const double * b, const size_t * span, size_t nspan)
+{
+	size_t k = 0, i = 0, i1 = 0;
+	__m256d vacc = _mm256_setzero_pd();
+	double acc[4];
+	double t = 0.;
+	for (k = 0; k < nspan; k++) {
+		i1 = span[2 * k + 1];
+		for (i = span[2 * k]; i + 4 <= i1; i += 4) {
+			vacc = _mm256_add_pd(vacc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		}
+		for (; i < i1; i++) {
+			t += a[i] * b[i];
+		}
+	}
+	_mm256_storeu_pd(acc, vacc);
+	return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + t;
+}
+
+MERLIN_TARGET("avx2")
+static void dot3_spans_avx2(const double * a, const double * b0, const double * b1, const double * b2, const size_t * span, size_t nspan, double * s)
+{
+	size_t k = 0, i = 0, i1 = 0;
+	__m256d vacc0 = _mm256_setzero_pd(), vacc1 = _mm256_setzero_pd(), vacc2 = _mm256_setzero_pd();
+	__m256d va;
+	double acc[12];
+	double t0 = 0., t1 = 0., t2 = 0.;
+	for (k = 0; k < nspan; k++) {
+		i1 = span[2 * k + 1];
+		for (i = span[2 * k]; i + 4 <= i1; i += 4) {
+			va = _mm256_loadu_pd(a + i);
+			vacc0 = _mm256_add_pd(vacc0, _mm256_mul_pd(va, _mm256_loadu_pd(b0 + i)));
+			vacc1 = _mm256_add_pd(vacc1, _mm256_mul_pd(va, _mm256_loadu_pd(b1 + i)));
+			vacc2 = _mm256_add_pd(vacc2, _mm256_mul_pd(va, _mm256_loadu_pd(b2 + i)));
+		}
+		for (; i < i1; i++) {
+			t0 += a[i] * b0[i];
+			t1 += a[i] * b1[i];
+			t2 += a[i] * b2[i];
+		}
+	}
+	_mm256_storeu_pd(acc, vacc0);
+	_mm256_storeu_pd(acc + 4, vacc1);
+	_mm256_storeu_pd(acc + 8, vacc2);
+	s[0] = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + t0;
+	s[1] = ((acc[4] + acc[5]) + (acc[6] + acc[7])) + t1;
+	s[2] = ((acc[8] + acc[9]) + (acc[10] + acc[11])) + t2;
+}
+
+MERLIN_TARGET("avx2")
+static void accumulate_u8_avx2(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t n)
+{
+	size_t i = 0;
+	__m128i v;
+	__m256i d;
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_loadl_epi64((const __m128i*)(inbuf + i));
+		d = _mm256_cvtepu8_epi64(v); // values 0 - 3
+		_mm256_storeu_si256((__m256i*)(sum + i), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sum + i)), d));
+		_mm256_storeu_si256((__m256i*)(sqr + i), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sqr + i)), _mm256_mul_epu32(d, d)));
+		d = _mm256_cvtepu8_epi64(_mm_srli_si128(v, 4)); // values 4 - 7
+		_mm256_storeu_si256((__m256i*)(sum + i + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sum + i + 4)), d));
+		_mm256_storeu_si256((__m256i*)(sqr + i + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sqr + i + 4)), _mm256_mul_epu32(d, d)));
+	}
+	accumulate_u8_scalar(sum, sqr, inbuf, i, n);
+}
+
+MERLIN_TARGET("avx2")
+static void accumulate_u16_avx2(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+	size_t i = 0;
+	const __m128i m = swapbytes ?
+		_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+		_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i v;
+	__m256i d;
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(inbuf + 2 * i)), m);
+		d = _mm256_cvtepu16_epi64(v); // values 0 - 3
+		_mm256_storeu_si256((__m256i*)(sum + i), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sum + i)), d));
+		_mm256_storeu_si256((__m256i*)(sqr + i), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sqr + i)), _mm256_mul_epu32(d, d)));
+		d = _mm256_cvtepu16_epi64(_mm_srli_si128(v, 8)); // values 4 - 7
+		_mm256_storeu_si256((__m256i*)(sum + i + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sum + i + 4)), d));
+		_mm256_storeu_si256((__m256i*)(sqr + i + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(sqr + i + 4)), _mm256_mul_epu32(d, d)));
+	}
+	accumulate_u16_scalar(sum, sqr, inbuf, i, n, swapbytes);
+}
+#endif // MERLIN_DECODE_X86
+
+
+// -----------------------------------------------------------------------------
+//
+// runtime dispatch
+//
+// -----------------------------------------------------------------------------
+
+int merlin_decode_get_cpu_level(void)
+{
+	int level = MERLIN_DECODE_SCALAR;
+#ifdef MERLIN_DECODE_X86
+#if defined(_MSC_VER)
+	int info[4] = { 0, 0, 0, 0 };
+	__cpuid(info, 0);
+	int nids = info[0];
+	if (nids >= 1) {
+		__cpuid(info, 1);
+		if (info[2] & (1 << 9)) level = MERLIN_DECODE_SSSE3;
+		// avx2 requires os support of the ymm registers (osxsave + xcr0)
+		if (nids >= 7 && (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5)) level = MERLIN_DECODE_AVX2;
+		}
+	}
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) level = MERLIN_DECODE_SSSE3;
+	if (__builtin_cpu_supports("avx2")) level = MERLIN_DECODE_AVX2;
+#endif
+#endif
+	return level;
+}
+
+static int & decode_level(void)
+{
+	static int level = merlin_decode_get_cpu_level(); // detected once
+	return level;
+}
+
+int merlin_decode_get_level(void)
+{
+	return decode_level();
+}
+
+int merlin_decode_set_level(int level)
+{
+	int level_cpu = merlin_decode_get_cpu_level();
+	if (level < MERLIN_DECODE_SCALAR) level = MERLIN_DECODE_SCALAR;
+	if (level > level_cpu) level = level_cpu;
+	decode_level() = level;
+	return level;
+}
+
+const char * merlin_decode_level_name(int level)
+{
+	switch (level) {
+	case MERLIN_DECODE_SSSE3: return "ssse3";
+	case MERLIN_DECODE_AVX2: return "avx2";
+	}
+	return "scalar";
+}
+
+void merlin_decode_u8(double * buf, const unsigned char * inbuf, size_t n)
+{
+#ifdef MERLIN_DECODE_X86
+	switch (decode_level()) {
+	case MERLIN_DECODE_AVX2: decode_u8_avx2(buf, inbuf, n); return;
+	case MERLIN_DECODE_SSSE3: decode_u8_ssse3(buf, inbuf, n); return;
+	}
+#endif
+	decode_u8_scalar(buf, inbuf, 0, n);
+}
+
+void merlin_decode_u16(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+#ifdef MERLIN_DECODE_X86
+	switch (decode_level()) {
+	case MERLIN_DECODE_AVX2: decode_u16_avx2(buf, inbuf, n, swapbytes); return;
+	case MERLIN_DECODE_SSSE3: decode_u16_ssse3(buf, inbuf, n, swapbytes); return;
+	}
+#endif
+	decode_u16_scalar(buf, inbuf, 0, n, swapbytes);
+}
+
+void merlin_decode_u32(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+#ifdef MERLIN_DECODE_X86
+	switch (decode_level()) {
+	case MERLIN_DECODE_AVX2: decode_u32_avx2(buf, inbuf, n, swapbytes); return;
+	case MERLIN_DECODE_SSSE3: decode_u32_ssse3(buf, inbuf, n, swapbytes); return;
+	}
+#endif
+	decode_u32_scalar(buf, inbuf, 0, n, swapbytes);
+}
+
+double merlin_dot_spans(const double * a, const double * b, const size_t * span, size_t nspan)
+{
+#ifdef MERLIN_DECODE_X86
+	switch (decode_level()) {
+	case MERLIN_DECODE_AVX2: return dot_spans_avx2(a, b, span, nspan);
+	case MERLIN_DECODE_SSSE3: return dot_spans_ssse3(a, b, span, nspan);
+	}
+#endif
+	return dot_spans_scalar(a, b, span, nspan);
+}
+
+void merlin_dot3_spans(const double * a, const double * b0, const double * b1, const double * b2, const size_t * span, size_t nspan, double * s)
+{
+#ifdef MERLIN_DECODE_X86
+	switch (decode_level()) {
+	case MERLIN_DECODE_AVX2: dot3_spans_avx2(a, b0, b1, b2, span, nspan, s); return;
+	case MERLIN_DECODE_SSSE3: dot3_spans_ssse3(a, b0, b1, b2, span, nspan, s); return;
+	}
+#endif
+	dot3_spans_scalar(a, b0, b1, b2, span, nspan, s);
+}
+
+void merlin_accumulate_u8(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t n)
+{
+#ifdef MERLIN_DECODE_X86
+	if (decode_level() == MERLIN_DECODE_AVX2) { // no SSSE3 kernel, 64-bit lanes need 256-bit registers to pay off
+		accumulate_u8_avx2(sum, sqr, inbuf, n);
+		return;
+	}
+#endif
+	accumulate_u8_scalar(sum, sqr, inbuf, 0, n);
+}
+
+void merlin_accumulate_u16(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t n, bool swapbytes)
+{
+#ifdef MERLIN_DECODE_X86
+	if (decode_level() == MERLIN_DECODE_AVX2) {
+		accumulate_u16_avx2(sum, sqr, inbuf, n, swapbytes);
+		return;
+	}
+#endif
+	accumulate_u16_scalar(sum, sqr, inbuf, 0, n, swapbytes);
+}
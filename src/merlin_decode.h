@@ -0,0 +1,73 @@
+// file : "merlin_decode.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the frame data decode and reduction kernels used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include <cstddef>
+
+// decode kernel levels
+constexpr int MERLIN_DECODE_SCALAR = 0; // portable scalar code
+constexpr int MERLIN_DECODE_SSSE3 = 1; // 128-bit byte shuffle and conversion
+constexpr int MERLIN_DECODE_AVX2 = 2; // 256-bit byte shuffle and conversion
+
+// returns the highest decode kernel level supported by the cpu
+int merlin_decode_get_cpu_level(void);
+
+// returns the decode kernel level currently in use
+int merlin_decode_get_level(void);
+
+// sets the decode kernel level, limited to what the cpu supports
+// - return value = level in use after the call
+int merlin_decode_set_level(int level);
+
+// returns a name string for a decode kernel level
+const char * merlin_decode_level_name(int level);
+
+// converts n unsigned 8-bit values from inbuf to double in buf
+void merlin_decode_u8(double * buf, const unsigned char * inbuf, size_t n);
+
+// converts n unsigned 16-bit values from inbuf to double in buf,
+// swapping the byte order of each value if swapbytes is true
+void merlin_decode_u16(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes);
+
+// converts n unsigned 32-bit values from inbuf to double in buf,
+// swapping the byte order of each value if swapbytes is true
+void merlin_decode_u32(double * buf, const unsigned char * inbuf, size_t n, bool swapbytes);
+
+// adds n unsigned 8-bit values from inbuf to the integer sums sum and
+// their squares to sqr
+void merlin_accumulate_u8(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t n);
+
+// adds n unsigned 16-bit values from inbuf to the integer sums sum and
+// their squares to sqr, swapping the byte order of each value if
+// swapbytes is true
+void merlin_accumulate_u16(unsigned __int64 * sum, unsigned __int64 * sqr, const unsigned char * inbuf, size_t n, bool swapbytes);
+
+// sums the products of a and b over the nspan pixel ranges
+// [span[2*k], span[2*k+1]), k = 0 ... nspan-1
+double merlin_dot_spans(const double * a, const double * b, const size_t * span, size_t nspan);
+
+// sums the products of a with b0, b1, and b2 over the nspan pixel ranges
+// [span[2*k], span[2*k+1]) to s[0], s[1], and s[2]
+void merlin_dot3_spans(const double * a, const double * b0, const double * b1, const double * b2, const size_t * span, size_t nspan, double * s);
@@ -0,0 +1,256 @@
+// file : "merlin_detectors.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the sparse virtual detector matrix.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_detectors.h"
+#include <sstream>
+
+
+merlin_detector_matrix::merlin_detector_matrix()
+{
+	clear(0);
+}
+
+merlin_detector_matrix::~merlin_detector_matrix()
+{
+}
+
+void merlin_detector_matrix::clear(size_t npix_in)
+{
+	npix = npix_in;
+	v_row.clear();
+	v_row.push_back(0);
+	v_col.clear();
+	v_val.clear();
+	v_name.clear();
+}
+
+int merlin_detector_matrix::get_num_detectors(void) const
+{
+	return (int)v_name.size();
+}
+
+size_t merlin_detector_matrix::get_num_pixels(void) const
+{
+	return npix;
+}
+
+size_t merlin_detector_matrix::get_num_weights(void) const
+{
+	return v_val.size();
+}
+
+std::string merlin_detector_matrix::get_name(int idet) const
+{
+	if (idet < 0 || idet >= (int)v_name.size()) {
+		return "";
+	}
+	return v_name[idet];
+}
+
+int merlin_detector_matrix::add_dense(const double * w, std::string str_name)
+{
+	size_t i = 0;
+	if (NULL == w) {
+		return 1; // missing weights
+	}
+	if (npix == 0) {
+		return 2; // invalid number of pixels
+	}
+	for (i = 0; i < npix; i++) {
+		if (w[i] != 0.) {
+			v_col.push_back((int)i);
+			v_val.push_back(w[i]);
+		}
+	}
+	v_row.push_back(v_val.size());
+	v_name.push_back(str_name);
+	return 0;
+}
+
+int merlin_detector_matrix::add_annular(merlin_params * pprm, double rmin, double rmax)
+{
+	int nerr = 0;
+	size_t i = 0;
+	double qm = 0., qx = 0., qy = 0.;
+	double * w = NULL;
+	merlin_pix p;
+	merlin_pos q;
+	std::ostringstream sname;
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	if (rmax <= rmin) {
+		std::cerr << "Error: invalid annular range (" << rmin << "," << rmax << ").\n";
+		return 3;
+	}
+	w = (double*)calloc(npix, sizeof(double));
+	if (NULL == w) {
+		return 101;
+	}
+	for (i = 0; i < npix; i++) { // same pixel selection as the annular detector
+		if (0 != pprm->get_frame_pixel((__int64)i, p.x, p.y) || 0 != pprm->get_calib_pos(p, &q)) {
+			nerr = 10;
+			goto _exit_point;
+		}
+		qx = q.x - pprm->offset_annular.x;
+		qy = q.y - pprm->offset_annular.y;
+		qm = sqrt(qx*qx + qy*qy);
+		w[i] = (qm >= rmin && qm < rmax ? 1. : 0.);
+	}
+	sname << "annular " << rmin << "," << rmax;
+	nerr = add_dense(w, sname.str());
+_exit_point:
+	if (w) free(w);
+	return nerr;
+}
+
+int merlin_detector_matrix::add_mask(merlin_params * pprm, std::string str_file)
+{
+	int nerr = 0;
+	size_t i = 0;
+	float * inbuf = NULL;
+	double * w = NULL;
+	std::ifstream fin;
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	if (npix == 0) {
+		return 2; // invalid number of pixels
+	}
+	fin.open(str_file, std::ios::binary);
+	if (!fin.is_open()) {
+		std::cerr << "Error: failed to open detector mask file [" << str_file << "].\n";
+		return 4;
+	}
+	inbuf = (float*)calloc(npix, sizeof(float)); // read 32-bit float data
+	w = (double*)calloc(npix, sizeof(double));
+	if (NULL == inbuf || NULL == w) {
+		nerr = 101;
+		goto _exit_point;
+	}
+	fin.read((char*)inbuf, sizeof(float)*npix);
+	if (fin.gcount() != (std::streamsize)(sizeof(float)*npix)) {
+		std::cerr << "Error: detector mask file [" << str_file << "] is too short, expecting " << npix << " 32-bit float values.\n";
+		nerr = 5;
+		goto _exit_point;
+	}
+	for (i = 0; i < npix; i++) {
+		w[i] = (double)inbuf[i];
+	}
+	nerr = add_dense(w, "mask " + str_file);
+_exit_point:
+	if (fin.is_open()) fin.close();
+	if (inbuf) free(inbuf);
+	if (w) free(w);
+	return nerr;
+}
+
+int merlin_detector_matrix::load_list(merlin_params * pprm, std::string str_file)
+{
+	int nerr = 0;
+	int i_pos = 0;
+	size_t iline = 0, isep = 0;
+	double rmin = 0., rmax = 0.;
+	std::ifstream fin;
+	std::string sline, skey, sprm, str_num;
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	fin.open(str_file);
+	if (!fin.is_open()) {
+		std::cerr << "Error: failed to open detector list file [" << str_file << "].\n";
+		return 1;
+	}
+	while (std::getline(fin, sline)) {
+		iline++;
+		if (sline.size() > 0 && sline[sline.size() - 1] == '\r') sline.erase(sline.size() - 1);
+		if (sline.size() == 0 || sline[0] == '#') continue;
+		isep = sline.find_first_of(" \t");
+		skey = sline.substr(0, isep);
+		sprm = (isep == sline.npos ? "" : sline.substr(sline.find_first_not_of(" \t", isep)));
+		if (skey == "annular") {
+			i_pos = pprm->read_param(0, &sprm, &str_num);
+			rmin = atof(str_num.c_str());
+			if (i_pos >= 0) i_pos = pprm->read_param(i_pos, &sprm, &str_num);
+			rmax = atof(str_num.c_str());
+			if (i_pos < 0) {
+				nerr = 2;
+			}
+			else {
+				nerr = add_annular(pprm, rmin, rmax);
+			}
+		}
+		else if (skey == "mask") {
+			nerr = add_mask(pprm, sprm);
+		}
+		else {
+			nerr = 3; // unknown detector type
+		}
+		if (nerr != 0) {
+			std::cerr << "Error: invalid detector in line " << iline << " of file [" << str_file << "]: " << sline << "\n";
+			break;
+		}
+	}
+	fin.close();
+	return nerr;
+}
+
+void merlin_detector_matrix::apply_block(const double * blk, size_t nstride, size_t nb, const size_t * pires, double * res, size_t nres) const
+{
+	size_t j = 0, j0 = 0, j1 = 0, f = 0;
+	int idet = 0, ndet = (int)v_name.size();
+	double w = 0.;
+	double acc[MERLIN_DETECTOR_BLOCK];
+	const double * p = NULL;
+	if (nb > MERLIN_DETECTOR_BLOCK) nb = MERLIN_DETECTOR_BLOCK;
+	for (idet = 0; idet < ndet; idet++) {
+		for (f = 0; f < MERLIN_DETECTOR_BLOCK; f++) acc[f] = 0.;
+		j0 = v_row[idet];
+		j1 = v_row[idet + 1];
+		if (nb == MERLIN_DETECTOR_BLOCK) { // full block, fixed length inner loop
+			for (j = j0; j < j1; j++) {
+				w = v_val[j];
+				p = blk + (size_t)v_col[j] * nstride;
+				for (f = 0; f < MERLIN_DETECTOR_BLOCK; f++) {
+					acc[f] += w * p[f];
+				}
+			}
+		}
+		else { // remaining frames at the end of a pass
+			for (j = j0; j < j1; j++) {
+				w = v_val[j];
+				p = blk + (size_t)v_col[j] * nstride;
+				for (f = 0; f < nb; f++) {
+					acc[f] += w * p[f];
+				}
+			}
+		}
+		for (f = 0; f < nb; f++) {
+			res[(size_t)idet * nres + pires[f]] = acc[f];
+		}
+	}
+}
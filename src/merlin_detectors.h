@@ -0,0 +1,95 @@
+// file : "merlin_detectors.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the sparse virtual detector matrix used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include "merlin_prm.h"
+
+constexpr size_t MERLIN_DETECTOR_BLOCK = 8; // number of frames multiplied together
+
+// Set of virtual detectors stored as sparse detector x pixel matrix in
+// compressed row format. Each row holds the non-zero weights of one
+// detector and the frame pixel indices they apply to, in ascending
+// pixel order.
+class merlin_detector_matrix
+{
+public:
+	// constructor
+	merlin_detector_matrix();
+	// destructor
+	~merlin_detector_matrix();
+
+protected:
+	size_t npix; // number of frame pixels
+	std::vector<size_t> v_row; // start of each row in v_col and v_val, n_det + 1 entries
+	std::vector<int> v_col; // frame pixel index of each weight
+	std::vector<double> v_val; // weights
+	std::vector<std::string> v_name; // description of each detector
+
+	// member functions
+public:
+	// removes all detectors and sets the number of frame pixels
+	void clear(size_t npix_in = 0);
+
+	// returns the number of detectors
+	int get_num_detectors(void) const;
+
+	// returns the number of frame pixels
+	size_t get_num_pixels(void) const;
+
+	// returns the number of stored weights
+	size_t get_num_weights(void) const;
+
+	// returns the description of detector idet
+	std::string get_name(int idet) const;
+
+	// appends a detector from npix weights w, zero weights are not stored
+	// - return value = error code (0: success)
+	int add_dense(const double * w, std::string str_name);
+
+	// appends an annular detector [rmin, rmax) using the frame calibration
+	// and the annular offset of *pprm
+	// - return value = error code (0: success)
+	int add_annular(merlin_params * pprm, double rmin, double rmax);
+
+	// appends a detector with weights loaded from a file of 32-bit float
+	// values, one for each frame pixel
+	// - return value = error code (0: success)
+	int add_mask(merlin_params * pprm, std::string str_file);
+
+	// appends the detectors listed in a text file, one per line as
+	//   annular <rmin>,<rmax>
+	//   mask <file-name>
+	// empty lines and lines starting with # are skipped
+	// - return value = error code (0: success)
+	int load_list(merlin_params * pprm, std::string str_file);
+
+	// multiplies nb frames of a block with all detectors
+	// - input blk = frame block, nstride values per pixel with the
+	//   value of frame f at blk[pixel * nstride + f]
+	// - input pires = result index of each frame in the block
+	// - output res = results, detector idet of frame f at
+	//   res[idet * nres + pires[f]]
+	void apply_block(const double * blk, size_t nstride, size_t nb, const size_t * pires, double * res, size_t nres) const;
+};
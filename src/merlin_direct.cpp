@@ -0,0 +1,304 @@
+// file : "merlin_direct.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the direct (unbuffered) data file reader.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_direct.h"
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#ifdef MERLINIO_HAVE_LIBURING
+#include <fcntl.h>
+#include <unistd.h>
+#include <liburing.h>
+#endif
+
+
+merlin_direct_reader::merlin_direct_reader()
+{
+	nfd = -1;
+	str_file = "";
+	ndepth = 0;
+	abuf[0] = NULL;
+	abuf[1] = NULL;
+	icur = 0;
+	nabuf = 0;
+	pring = NULL;
+	nahead_seg = 0;
+	ahead_a0 = 0;
+	ahead_a1 = 0;
+	ahead_seglen = 0;
+}
+
+merlin_direct_reader::~merlin_direct_reader()
+{
+	close();
+}
+
+bool merlin_direct_reader::is_available(void)
+{
+#ifdef MERLINIO_HAVE_LIBURING
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef MERLINIO_HAVE_LIBURING
+
+int merlin_direct_reader::init(int ndepth_in, size_t nbytes_max)
+{
+	int i = 0;
+	void * p = NULL;
+	struct io_uring * ring = NULL;
+	close();
+	if (ndepth_in < 1 || nbytes_max == 0) {
+		return 1; // invalid parameters
+	}
+	ring = new struct io_uring;
+	if (0 != io_uring_queue_init((unsigned)ndepth_in, ring, 0)) {
+		delete ring;
+		return 2; // no io_uring support
+	}
+	pring = ring;
+	ndepth = ndepth_in;
+	// a range may start and end within an aligned block
+	nabuf = (nbytes_max + 2 * MERLIN_DIRECT_ALIGN - 1) & ~(MERLIN_DIRECT_ALIGN - 1);
+	for (i = 0; i < 2; i++) {
+		if (0 != posix_memalign(&p, MERLIN_DIRECT_ALIGN, nabuf)) {
+			close();
+			return 100; // buffer allocation failed
+		}
+		abuf[i] = (char*)p;
+	}
+	icur = 0;
+	return 0;
+}
+
+void merlin_direct_reader::close(void)
+{
+	int i = 0;
+	if (NULL != pring) {
+		discard_ahead(); // the kernel may still write to the buffer
+	}
+	if (nfd >= 0) {
+		::close(nfd);
+		nfd = -1;
+	}
+	str_file = "";
+	if (NULL != pring) {
+		io_uring_queue_exit((struct io_uring*)pring);
+		delete (struct io_uring*)pring;
+		pring = NULL;
+	}
+	for (i = 0; i < 2; i++) {
+		if (NULL != abuf[i]) {
+			free(abuf[i]);
+			abuf[i] = NULL;
+		}
+	}
+	icur = 0;
+	nabuf = 0;
+	ndepth = 0;
+}
+
+int merlin_direct_reader::submit(int ibuf, size_t a0, size_t a1, size_t & nseglen, int & nseg)
+{
+	int nsub = 0;
+	size_t ofs = 0, len = 0;
+	struct io_uring * ring = (struct io_uring*)pring;
+	struct io_uring_sqe * sqe = NULL;
+	nseg = 0;
+	nseglen = ((a1 - a0) / (size_t)ndepth + MERLIN_DIRECT_ALIGN - 1) & ~(MERLIN_DIRECT_ALIGN - 1);
+	if (nseglen < MERLIN_DIRECT_SEGMENT_MIN) nseglen = MERLIN_DIRECT_SEGMENT_MIN;
+	// submit all segments, at most ndepth
+	for (ofs = 0; ofs < a1 - a0; ofs += nseglen) {
+		len = std::min(nseglen, a1 - a0 - ofs);
+		sqe = io_uring_get_sqe(ring);
+		if (NULL == sqe) {
+			break; // queue full, should not happen with nseglen >= range / ndepth
+		}
+		io_uring_prep_read(sqe, nfd, abuf[ibuf] + ofs, (unsigned)len, (__u64)(a0 + ofs));
+		io_uring_sqe_set_data(sqe, (void*)(uintptr_t)ofs);
+		nseg++;
+	}
+	nsub = io_uring_submit(ring);
+	if (nsub != nseg) {
+		nseg = std::max(nsub, 0); // requests to be collected
+		return 13; // failed to submit the read requests
+	}
+	return 0;
+}
+
+int merlin_direct_reader::complete(int nseg, size_t nseglen, size_t nlen, size_t nneed)
+{
+	int i = 0, nres = 0;
+	size_t ofs = 0, len = 0;
+	struct io_uring * ring = (struct io_uring*)pring;
+	struct io_uring_cqe * cqe = NULL;
+	// collect the completions, a short read is accepted at the end of
+	// the file if it covers the requested range
+	for (i = 0; i < nseg; i++) {
+		if (0 != io_uring_wait_cqe(ring, &cqe)) {
+			return 14;
+		}
+		ofs = (size_t)(uintptr_t)io_uring_cqe_get_data(cqe);
+		len = std::min(nseglen, nlen - ofs);
+		if (cqe->res < 0) {
+			nres = 14; // read error
+		}
+		else if ((size_t)cqe->res < len && ofs + (size_t)cqe->res < nneed) {
+			nres = 14; // data missing
+		}
+		io_uring_cqe_seen(ring, cqe);
+	}
+	return nres;
+}
+
+void merlin_direct_reader::discard_ahead(void)
+{
+	if (nahead_seg > 0) {
+		complete(nahead_seg, ahead_seglen, ahead_a1 - ahead_a0, 0);
+	}
+	nahead_seg = 0;
+}
+
+int merlin_direct_reader::read(const std::string & str_file_in, __int64 fpos, size_t nbytes, const char ** pdata)
+{
+	int nerr = 0, nseg = 0;
+	size_t a0 = 0, a1 = 0, nseglen = 0;
+	if (NULL == pring || NULL == abuf[0] || NULL == abuf[1]) {
+		return 1; // not initialized
+	}
+	if (NULL == pdata || fpos < 0) {
+		return 2; // invalid parameters
+	}
+	*pdata = NULL;
+	if (nfd < 0 || str_file != str_file_in) { // open the file
+		discard_ahead();
+		if (nfd >= 0) {
+			::close(nfd);
+			nfd = -1;
+		}
+		str_file = "";
+		nfd = open(str_file_in.c_str(), O_RDONLY | O_DIRECT);
+		if (nfd < 0) {
+			return 12; // failed to open the file for direct reading
+		}
+		str_file = str_file_in;
+	}
+	// aligned range
+	a0 = (size_t)fpos & ~(MERLIN_DIRECT_ALIGN - 1);
+	a1 = ((size_t)fpos + nbytes + MERLIN_DIRECT_ALIGN - 1) & ~(MERLIN_DIRECT_ALIGN - 1);
+	if (a1 - a0 > nabuf) {
+		return 3; // range is too large for the buffer
+	}
+	if (nahead_seg > 0 && a0 >= ahead_a0 && a1 <= ahead_a1) { // range read ahead
+		nseg = nahead_seg;
+		nahead_seg = 0;
+		nerr = complete(nseg, ahead_seglen, ahead_a1 - ahead_a0, (size_t)fpos + nbytes - ahead_a0);
+		if (nerr != 0) {
+			return nerr;
+		}
+		icur = 1 - icur;
+		*pdata = abuf[icur] + ((size_t)fpos - ahead_a0);
+		return 0;
+	}
+	discard_ahead(); // not the range read ahead
+	nerr = submit(icur, a0, a1, nseglen, nseg);
+	if (nerr != 0) {
+		complete(nseg, nseglen, a1 - a0, 0); // collect what was submitted
+		return nerr;
+	}
+	nerr = complete(nseg, nseglen, a1 - a0, (size_t)fpos + nbytes - a0);
+	if (nerr != 0) {
+		return nerr;
+	}
+	*pdata = abuf[icur] + ((size_t)fpos - a0);
+	return 0;
+}
+
+int merlin_direct_reader::read_ahead(const std::string & str_file_in, __int64 fpos, size_t nbytes)
+{
+	int nerr = 0, nseg = 0;
+	size_t a0 = 0, a1 = 0, nseglen = 0;
+	if (NULL == pring || nfd < 0 || nahead_seg > 0 || str_file != str_file_in || fpos < 0) {
+		return 0; // nothing to do
+	}
+	a0 = (size_t)fpos & ~(MERLIN_DIRECT_ALIGN - 1);
+	a1 = ((size_t)fpos + nbytes + MERLIN_DIRECT_ALIGN - 1) & ~(MERLIN_DIRECT_ALIGN - 1);
+	if (a1 - a0 > nabuf) {
+		return 3; // range is too large for the buffer
+	}
+	nerr = submit(1 - icur, a0, a1, nseglen, nseg);
+	if (nerr != 0) {
+		complete(nseg, nseglen, a1 - a0, 0); // collect what was submitted
+		return nerr;
+	}
+	nahead_seg = nseg;
+	ahead_a0 = a0;
+	ahead_a1 = a1;
+	ahead_seglen = nseglen;
+	return 0;
+}
+
+#else // direct reading is not available
+
+int merlin_direct_reader::init(int /*ndepth_in*/, size_t /*nbytes_max*/)
+{
+	close();
+	return 200; // not supported by this build
+}
+
+void merlin_direct_reader::close(void)
+{
+	nfd = -1;
+	str_file = "";
+	abuf[0] = NULL;
+	abuf[1] = NULL;
+	icur = 0;
+	nabuf = 0;
+	pring = NULL;
+	nahead_seg = 0;
+	ndepth = 0;
+}
+
+int merlin_direct_reader::read(const std::string & /*str_file_in*/, __int64 /*fpos*/, size_t /*nbytes*/, const char ** pdata)
+{
+	if (NULL != pdata) *pdata = NULL;
+	return 1; // not initialized
+}
+
+int merlin_direct_reader::read_ahead(const std::string & /*str_file_in*/, __int64 /*fpos*/, size_t /*nbytes*/)
+{
+	return 0; // nothing to do
+}
+
+#endif // MERLINIO_HAVE_LIBURING
+
+bool merlin_direct_reader::is_open(void)
+{
+	return (NULL != pring);
+}
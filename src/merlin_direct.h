@@ -0,0 +1,112 @@
+// file : "merlin_direct.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the direct (unbuffered) data file reader used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include <string>
+
+constexpr size_t MERLIN_DIRECT_ALIGN = 4096; // alignment of direct reads in bytes (offset, length, and buffer)
+constexpr size_t MERLIN_DIRECT_SEGMENT_MIN = 0x10000; // min. size of a read request in bytes
+
+// Reads byte ranges of data files with O_DIRECT, bypassing the page
+// cache. A range is widened to aligned file offsets, split into
+// segments, and the segments are submitted together to an io_uring
+// queue, so that up to ndepth requests are in flight at once. read
+// waits for all segments of its range. To overlap reading with the
+// processing of a range, the next range of the same file is submitted
+// by read_ahead into a second buffer and is taken by the following read
+// when it covers the requested range, otherwise it is discarded.
+// Available in Linux builds with MERLINIO_HAVE_LIBURING defined (link
+// with liburing), otherwise init fails and callers use file streams.
+// Use one reader per thread.
+class merlin_direct_reader
+{
+public:
+	// constructor
+	merlin_direct_reader();
+	// destructor
+	~merlin_direct_reader();
+	// no copies, the object owns the file, the queue, and the buffers
+	merlin_direct_reader(const merlin_direct_reader &) = delete;
+	merlin_direct_reader & operator=(const merlin_direct_reader &) = delete;
+
+protected:
+	int nfd; // file descriptor of the open data file (-1: none)
+	std::string str_file; // name of the open data file
+	int ndepth; // queue depth, max. number of requests in flight
+	char * abuf[2]; // aligned read buffers
+	int icur; // buffer holding the range of the last read
+	size_t nabuf; // size of each read buffer in bytes
+	void * pring; // io_uring queue
+	int nahead_seg; // number of segments of the range read ahead in flight (0: none)
+	size_t ahead_a0; // aligned begin of the range read ahead
+	size_t ahead_a1; // aligned end of the range read ahead
+	size_t ahead_seglen; // segment length of the range read ahead
+
+	// member functions
+protected:
+	// submits the aligned range [a0, a1) of the open file to be read
+	// into buffer ibuf in segments
+	// - output nseglen = length of the segments
+	// - output nseg = number of segments submitted, to be collected by
+	//   complete also in case of an error
+	// - return value = error code (0: success)
+	int submit(int ibuf, size_t a0, size_t a1, size_t & nseglen, int & nseg);
+
+	// waits for nseg segments of length nseglen of an aligned range of
+	// length nlen, the first nneed bytes of the range must be read
+	// - return value = error code (0: success)
+	int complete(int nseg, size_t nseglen, size_t nlen, size_t nneed);
+
+	// waits for the range read ahead and discards it
+	void discard_ahead(void);
+
+public:
+	// returns true if direct reading is supported by this build
+	static bool is_available(void);
+
+	// sets up the queue with ndepth_in entries and two read buffers for
+	// ranges of up to nbytes_max bytes
+	// - return value = error code (0: success)
+	int init(int ndepth_in, size_t nbytes_max);
+
+	// closes the file and the queue and frees the buffers
+	void close(void);
+
+	// returns true if the reader is initialized
+	bool is_open(void);
+
+	// reads nbytes at position fpos of the file str_file_in
+	// - output pdata = pointer to the data, valid until the next call
+	// - return value = error code (0: success, 12: failed to open the
+	//   file, e.g. O_DIRECT is not supported by its file system)
+	int read(const std::string & str_file_in, __int64 fpos, size_t nbytes, const char ** pdata);
+
+	// starts reading nbytes at position fpos of the file str_file_in
+	// for the next call of read, the data of the last read stays valid,
+	// nothing is done when a range is already in flight or when the
+	// file is not the file of the last read
+	// - return value = error code (0: success or nothing to do)
+	int read_ahead(const std::string & str_file_in, __int64 fpos, size_t nbytes);
+};
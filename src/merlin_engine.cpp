@@ -0,0 +1,417 @@
+// file : "merlin_engine.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the multi-threaded frame processing engine.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_engine.h"
+#include <chrono>
+#include <map>
+
+constexpr size_t MERLIN_ENGINE_CHUNK_MAX = 64; // max. number of frames per chunk of work
+
+
+merlin_engine::merlin_engine()
+{
+	pprm = NULL;
+	pv_items = NULL;
+	nthreads = 1;
+	nfrm_pix = 0;
+	braw = false;
+	nitem_done = 0;
+	nsteal = 0;
+	bcancel = false;
+	nerr_run = 0;
+}
+
+merlin_engine::~merlin_engine()
+{
+	size_t i = 0;
+	for (i = 0; i < v_queues.size(); i++) {
+		if (NULL != v_queues[i]) delete v_queues[i];
+	}
+	v_queues.clear();
+}
+
+int merlin_engine::init(merlin_params * pprm_in)
+{
+	if (NULL == pprm_in) {
+		return 1; // missing parameter 1
+	}
+	pprm = pprm_in;
+	nfrm_pix = (size_t)pprm->hdr_frm.n_columns * pprm->hdr_frm.n_rows;
+	nthreads = pprm->nthreads;
+	if (nthreads <= 0) { // use all hardware threads
+		nthreads = (int)std::thread::hardware_concurrency();
+	}
+	if (nthreads <= 0) {
+		nthreads = 1;
+	}
+	return 0;
+}
+
+int merlin_engine::get_num_threads(void)
+{
+	return nthreads;
+}
+
+void merlin_engine::set_error(int nerr)
+{
+	std::lock_guard<std::mutex> lock(mtx_err);
+	if (nerr_run == 0) {
+		nerr_run = nerr;
+	}
+	bcancel = true;
+}
+
+void merlin_engine::report_progress(int & prog_pct_old)
+{
+	int prog_pct = 0;
+	size_t n = pv_items->size();
+	if (!pprm->btalk || n == 0) return;
+	prog_pct = (int)(100. * (double)nitem_done / (double)n); // progress in percent
+	if (prog_pct > prog_pct_old && prog_pct < 100) { // progress step ...
+		std::cout << "  " << prog_pct << " %\r";
+		prog_pct_old = prog_pct;
+	}
+}
+
+bool merlin_engine::next_chunk(int ithread, size_t & i0, size_t & i1)
+{
+	int k = 0, ipass = 0;
+	merlin_work_queue * pq = NULL;
+	{ // take work from the front of the own queue
+		pq = v_queues[ithread];
+		std::lock_guard<std::mutex> lock(pq->mtx);
+		if (!pq->q_chunks.empty()) {
+			i0 = pq->q_chunks.front().first;
+			i1 = pq->q_chunks.front().second;
+			pq->q_chunks.pop_front();
+			return true;
+		}
+	}
+	for (ipass = 0; ipass < 2; ipass++) { // steal work from the back of other queues, own group first
+		for (k = 1; k < nthreads; k++) {
+			pq = v_queues[(ithread + k) % nthreads];
+			if ((pq->ngroup == v_queues[ithread]->ngroup) != (ipass == 0)) continue;
+			std::lock_guard<std::mutex> lock(pq->mtx);
+			if (!pq->q_chunks.empty()) {
+				i0 = pq->q_chunks.back().first;
+				i1 = pq->q_chunks.back().second;
+				pq->q_chunks.pop_back();
+				nsteal++;
+				return true;
+			}
+		}
+	}
+	return false; // no work left
+}
+
+void merlin_engine::run_worker(int ithread)
+{
+	int nerr = 0;
+	size_t i = 0, i0 = 0, i1 = 0;
+	size_t irun = 0; // end of the current run of consecutive frames
+	double * buf = NULL;
+	const char * pdata = NULL;
+	merlin_frame_reader reader;
+	nerr = reader.init(pprm, nthreads);
+	if (nerr != 0) {
+		set_error(102);
+		return;
+	}
+	if (!braw) {
+		buf = (double*)calloc(nfrm_pix, sizeof(double));
+		if (NULL == buf) {
+			set_error(102);
+			return;
+		}
+	}
+	while (!bcancel && next_chunk(ithread, i0, i1)) {
+		irun = i0;
+		for (i = i0; i < i1; i++) {
+			if (bcancel) break;
+			const merlin_frame_item & item = (*pv_items)[i];
+			if (i >= irun) { // frames of the chunk which can be read together
+				irun = i + merlin_frame_run(*pv_items, i, i1);
+			}
+			if (braw) {
+				nerr = reader.get_frame_raw(item.idx, &pdata, irun - i);
+			}
+			else {
+				nerr = reader.read_frame(item.idx, buf, irun - i);
+			}
+			if (nerr != 0) { // reading failed
+				{
+					std::lock_guard<std::mutex> lock(mtx_err);
+					std::cerr << "Error: failed loading data of frame # " << item.idx << " (code " << nerr << ").\n";
+				}
+				set_error(106);
+				break;
+			}
+			nerr = (braw ? raw_kernel(ithread, item, pdata) : kernel(ithread, item, buf));
+			if (nerr != 0) { // processing failed
+				set_error(nerr);
+				break;
+			}
+			nitem_done++;
+		}
+	}
+	if (buf) free(buf);
+}
+
+int merlin_engine::run(const std::vector<merlin_frame_item> * pv_items_in, merlin_frame_kernel kernel_in)
+{
+	int nerr = 0;
+	int islot = -1;
+	int prog_pct_old = 0;
+	size_t n = 0;
+	double * buf = NULL;
+	merlin_frame_item item;
+	merlin_prefetch pf;
+	if (NULL == pprm) {
+		return 1; // not initialized
+	}
+	if (NULL == pv_items_in) {
+		return 2; // missing parameter 1
+	}
+	pv_items = pv_items_in;
+	kernel = kernel_in;
+	braw = false;
+	n = pv_items->size();
+	nitem_done = 0;
+	nsteal = 0;
+	bcancel = false;
+	nerr_run = 0;
+	if (n == 0) {
+		return 0; // nothing to do
+	}
+	if (pprm->btalk) {
+		std::cout << "  0 %\r";
+	}
+	if (nthreads <= 1) { // single thread with read-ahead
+		nerr = pf.start(pprm, pv_items, pprm->nprefetch);
+		if (nerr != 0) {
+			std::cerr << "Error: failed to start reading frames (code " << nerr << ").\n";
+			return 102;
+		}
+		while (true) {
+			nerr = pf.acquire(islot, item, &buf); // get the next frame
+			if (nerr < 0) { // end of list
+				nerr = 0;
+				break;
+			}
+			if (nerr != 0) { // reading failed
+				std::cerr << "Error: failed loading data of frame # " << item.idx << " (code " << nerr << ").\n";
+				nerr = 106;
+				break;
+			}
+			nerr = kernel(0, item, buf);
+			pf.release(islot);
+			if (nerr != 0) break; // processing failed
+			nitem_done++;
+			report_progress(prog_pct_old);
+		}
+		if (pprm->btalk) pf.print_stats();
+		pf.stop();
+		return nerr;
+	}
+	return run_workers();
+}
+
+int merlin_engine::run_raw(const std::vector<merlin_frame_item> * pv_items_in, merlin_raw_kernel kernel_in)
+{
+	if (NULL == pprm) {
+		return 1; // not initialized
+	}
+	if (NULL == pv_items_in) {
+		return 2; // missing parameter 1
+	}
+	pv_items = pv_items_in;
+	raw_kernel = kernel_in;
+	braw = true;
+	nitem_done = 0;
+	nsteal = 0;
+	bcancel = false;
+	nerr_run = 0;
+	if (pv_items->size() == 0) {
+		return 0; // nothing to do
+	}
+	if (pprm->btalk) {
+		std::cout << "  0 %\r";
+	}
+	return run_workers();
+}
+
+void merlin_engine::distribute_blocks(size_t nchunk)
+{
+	int ithread = 0;
+	size_t n = pv_items->size(), nchunks = 0, ichunk = 0, ic0 = 0, ic1 = 0;
+	nchunks = (n + nchunk - 1) / nchunk;
+	for (ithread = 0; ithread < nthreads; ithread++) {
+		v_queues[ithread]->q_chunks.clear();
+		v_queues[ithread]->ngroup = 0;
+		ic0 = nchunks * (size_t)ithread / (size_t)nthreads;
+		ic1 = nchunks * (size_t)(ithread + 1) / (size_t)nthreads;
+		for (ichunk = ic0; ichunk < ic1; ichunk++) {
+			v_queues[ithread]->q_chunks.push_back(std::make_pair(ichunk * nchunk, std::min(n, (ichunk + 1) * nchunk)));
+		}
+	}
+}
+
+size_t merlin_engine::distribute_shards(size_t nchunk)
+{
+	int ithread = 0, it0 = 0, nt = 0;
+	int fidx = -1, fidx2 = -1; // file index
+	std::streampos fpos; // file position
+	size_t n = pv_items->size(), i = 0, i0 = 0, ishard = 0, nshards = 0, ichunk = 0, ic0 = 0, ic1 = 0;
+	size_t nload = 0;
+	std::map<int, size_t> map_shard; // shard index of each file index
+	std::vector<std::vector<std::pair<size_t, size_t>>> v_shard_chunks; // chunks of each shard
+	std::vector<size_t> v_shard_items; // number of items of each shard
+	std::vector<int> v_shard_threads; // number of workers of each shard
+	std::vector<size_t> v_thread_load; // number of items assigned to each worker
+	// split the item list into chunks of frames from the same file
+	i0 = 0;
+	for (i = 0; i <= n; i++) {
+		if (i < n && 0 != pprm->get_frame_filepos((*pv_items)[i].idx, fidx2, fpos)) {
+			fidx2 = fidx; // unknown file, handled with the frames before
+		}
+		if (i > i0 && (i == n || fidx2 != fidx || i - i0 == nchunk)) { // end of a chunk
+			if (map_shard.find(fidx) == map_shard.end()) { // new shard
+				map_shard[fidx] = v_shard_chunks.size();
+				v_shard_chunks.push_back(std::vector<std::pair<size_t, size_t>>());
+				v_shard_items.push_back(0);
+			}
+			ishard = map_shard[fidx];
+			v_shard_chunks[ishard].push_back(std::make_pair(i0, i));
+			v_shard_items[ishard] += i - i0;
+			i0 = i;
+		}
+		fidx = fidx2;
+	}
+	nshards = v_shard_chunks.size();
+	for (ithread = 0; ithread < nthreads; ithread++) {
+		v_queues[ithread]->q_chunks.clear();
+		v_queues[ithread]->ngroup = ithread;
+	}
+	if (nshards == 0) return 0;
+	if ((size_t)nthreads >= nshards) { // groups of workers for each shard
+		v_shard_threads.assign(nshards, 1);
+		for (ithread = (int)nshards; ithread < nthreads; ithread++) { // more workers for the shards with most items per worker
+			ic0 = 0;
+			for (ishard = 1; ishard < nshards; ishard++) {
+				if (v_shard_items[ishard] * (size_t)v_shard_threads[ic0] > v_shard_items[ic0] * (size_t)v_shard_threads[ishard]) ic0 = ishard;
+			}
+			v_shard_threads[ic0]++;
+		}
+		it0 = 0;
+		for (ishard = 0; ishard < nshards; ishard++) { // contiguous blocks of the shard for each worker of its group
+			nt = v_shard_threads[ishard];
+			for (ithread = it0; ithread < it0 + nt; ithread++) {
+				v_queues[ithread]->ngroup = (int)ishard;
+				ic0 = v_shard_chunks[ishard].size() * (size_t)(ithread - it0) / (size_t)nt;
+				ic1 = v_shard_chunks[ishard].size() * (size_t)(ithread - it0 + 1) / (size_t)nt;
+				for (ichunk = ic0; ichunk < ic1; ichunk++) {
+					v_queues[ithread]->q_chunks.push_back(v_shard_chunks[ishard][ichunk]);
+				}
+			}
+			it0 += nt;
+		}
+	}
+	else { // whole shards for each worker, to the worker with the least items
+		v_thread_load.assign(nthreads, 0);
+		for (ishard = 0; ishard < nshards; ishard++) {
+			it0 = 0;
+			nload = v_thread_load[0];
+			for (ithread = 1; ithread < nthreads; ithread++) {
+				if (v_thread_load[ithread] < nload) {
+					it0 = ithread;
+					nload = v_thread_load[ithread];
+				}
+			}
+			v_thread_load[it0] += v_shard_items[ishard];
+			for (ichunk = 0; ichunk < v_shard_chunks[ishard].size(); ichunk++) {
+				v_queues[it0]->q_chunks.push_back(v_shard_chunks[ishard][ichunk]);
+			}
+		}
+	}
+	return nshards;
+}
+
+int merlin_engine::run_workers(void)
+{
+	int ithread = 0;
+	int prog_pct_old = 0;
+	size_t n = pv_items->size(), nchunk = 0, nshards = 0;
+	std::vector<std::thread> v_threads;
+	// distribute chunks of the item list over the worker queues
+	nchunk = n / ((size_t)nthreads * 16);
+	if (nchunk < 1) nchunk = 1;
+	if (nchunk > MERLIN_ENGINE_CHUNK_MAX) nchunk = MERLIN_ENGINE_CHUNK_MAX;
+	while ((int)v_queues.size() < nthreads) {
+		v_queues.push_back(new merlin_work_queue);
+	}
+	if (pprm->bshard) {
+		nshards = distribute_shards(nchunk);
+	}
+	else {
+		distribute_blocks(nchunk);
+	}
+	// run the workers and report progress
+	for (ithread = 0; ithread < nthreads; ithread++) {
+		v_threads.push_back(std::thread(&merlin_engine::run_worker, this, ithread));
+	}
+	while (!bcancel && nitem_done < n) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		report_progress(prog_pct_old);
+	}
+	for (ithread = 0; ithread < nthreads; ithread++) {
+		v_threads[ithread].join();
+	}
+	if (pprm->btalk && pprm->ndebug > 0) {
+		std::cout << "- processed " << nitem_done << " frames on " << nthreads << " threads (" << nsteal << " chunks of " << nchunk << " frames stolen)\n";
+		if (pprm->bshard) std::cout << "- sharded execution over " << nshards << " data files\n";
+	}
+	return nerr_run;
+}
+
+void merlin_engine::parallel_for(size_t n, merlin_range_kernel kernel_in)
+{
+	int ithread = 0;
+	size_t nt = (size_t)(nthreads > 1 ? nthreads : 1);
+	std::vector<std::thread> v_threads;
+	if (n == 0) return;
+	if (nt > n) nt = n;
+	if (nt == 1) {
+		kernel_in(0, n);
+		return;
+	}
+	for (ithread = 0; ithread < (int)nt; ithread++) {
+		v_threads.push_back(std::thread(kernel_in, n * (size_t)ithread / nt, n * (size_t)(ithread + 1) / nt));
+	}
+	for (ithread = 0; ithread < (int)nt; ithread++) {
+		v_threads[ithread].join();
+	}
+}
@@ -0,0 +1,140 @@
+// file : "merlin_engine.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the multi-threaded frame processing engine used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include "merlin_prefetch.h"
+#include <atomic>
+#include <functional>
+
+// processing function called for each frame
+// - input ithread = index of the calling worker (0 ... nthreads-1)
+// - input item = frame item with frame and result index
+// - input buf = decoded frame data, may be modified by the function
+// - return value = error code (0: success)
+typedef std::function<int(int ithread, const merlin_frame_item & item, double * buf)> merlin_frame_kernel;
+
+// processing function called for the raw data of each frame
+// - input ithread = index of the calling worker (0 ... nthreads-1)
+// - input item = frame item with frame and result index
+// - input pdata = raw frame data as stored in the data file
+// - return value = error code (0: success)
+typedef std::function<int(int ithread, const merlin_frame_item & item, const char * pdata)> merlin_raw_kernel;
+
+// processing function called for a range [i0, i1) of an index space
+typedef std::function<void(size_t i0, size_t i1)> merlin_range_kernel;
+
+// queue of item ranges owned by one worker
+struct merlin_work_queue {
+	int ngroup = 0; // worker group, chunks are stolen within the group first
+	std::mutex mtx;
+	std::deque<std::pair<size_t, size_t>> q_chunks; // [begin, end) ranges of the item list
+};
+
+// Distributes the frames of a list over a pool of worker threads. Each
+// worker starts with a contiguous block of the list, split into small
+// chunks, and steals chunks from the end of other workers' blocks once
+// its own block is done. Each worker has its own frame reader and frame
+// buffer. With one thread, frames are delivered by the prefetching
+// pipeline (merlin_prefetch) instead.
+// With merlin_params::bshard, each data file is a shard handled by its
+// own group of workers, so that several files are read in parallel.
+// Workers steal from their own group first and from other groups only
+// when the own shard is done. Partial results are merged by the
+// operations as for any other distribution of frames over threads.
+class merlin_engine
+{
+public:
+	// constructor
+	merlin_engine();
+	// destructor
+	~merlin_engine();
+
+protected:
+	merlin_params * pprm; // parameters with the frame file positions
+	const std::vector<merlin_frame_item> * pv_items; // frames to process
+	merlin_frame_kernel kernel; // per-frame processing
+	merlin_raw_kernel raw_kernel; // per-frame processing of raw data
+	bool braw; // workers hand raw data to raw_kernel instead of decoded data to kernel
+	int nthreads; // number of worker threads
+	size_t nfrm_pix; // number of pixels per frame
+	std::vector<merlin_work_queue*> v_queues; // work queues, one per worker
+	std::atomic<size_t> nitem_done; // number of processed items
+	std::atomic<size_t> nsteal; // number of stolen chunks
+	std::atomic<bool> bcancel; // flags all workers to stop
+	std::mutex mtx_err; // protects error reporting
+	int nerr_run; // first error code of the current run
+
+	// member functions
+protected:
+	// gets the next chunk of work for worker ithread, returns false if no work is left
+	bool next_chunk(int ithread, size_t & i0, size_t & i1);
+
+	// worker thread function
+	void run_worker(int ithread);
+
+	// distributes chunks of nchunk items over the worker queues,
+	// contiguous blocks of the item list for each worker
+	void distribute_blocks(size_t nchunk);
+
+	// distributes chunks of up to nchunk items over the worker queues,
+	// one group of workers for the items of each data file
+	// - return value = number of shards (data files)
+	size_t distribute_shards(size_t nchunk);
+
+	// distributes the items over the worker threads and runs them
+	// - return value = error code (0: success)
+	int run_workers(void);
+
+	// records an error and stops all workers
+	void set_error(int nerr);
+
+	// writes the progress in percent for the items processed so far
+	void report_progress(int & prog_pct_old);
+
+public:
+	// prepares the engine for the parameters *pprm_in and determines
+	// the number of worker threads from pprm_in->nthreads
+	// - return value = error code (0: success)
+	int init(merlin_params * pprm_in);
+
+	// returns the number of worker threads used by run
+	int get_num_threads(void);
+
+	// processes all frames of *pv_items_in with kernel_in
+	// - return value = error code (0: success), 102 = failed to prepare
+	//   frame input, 106 = failed to read a frame, or the first error
+	//   code returned by kernel_in
+	int run(const std::vector<merlin_frame_item> * pv_items_in, merlin_frame_kernel kernel_in);
+
+	// processes all frames of *pv_items_in with kernel_in on the raw
+	// frame data without decoding, always on worker threads
+	// - return value = error code (0: success), 102 = failed to prepare
+	//   frame input, 106 = failed to read a frame, or the first error
+	//   code returned by kernel_in
+	int run_raw(const std::vector<merlin_frame_item> * pv_items_in, merlin_raw_kernel kernel_in);
+
+	// calls kernel_in for contiguous parts of [0, n) on all worker threads
+	void parallel_for(size_t n, merlin_range_kernel kernel_in);
+};
@@ -26,19 +26,52 @@ This file is part of Merlinio.
 
 #include "pch.h"
 #include <vector>
+#include <cstring>
 #include "merlin_hdr.h"
+#include "merlin_decode.h"
 
 int imod(int i, int n)
 {
 	return ((i%n + n) % n);
 }
 
+__int64 imod64(__int64 i, __int64 n)
+{
+	return ((i%n + n) % n);
+}
+
+
+// parses the lines of a merlin main header for important information
+static void merlin_parse_header_lines(std::vector<std::string> & v_str_header, merlin_hdr * phdr)
+{
+	std::vector<std::string>::iterator i_hdr_ln;
+	i_hdr_ln = v_str_header.begin();
+	for (i_hdr_ln = v_str_header.begin(); i_hdr_ln != v_str_header.end(); i_hdr_ln++) {
+		if (0 == i_hdr_ln->find("Time and Date Stamp (yr, mnth, day, hr, min, s):")) {
+			phdr->s_timestamp = i_hdr_ln->substr(49, i_hdr_ln->size() - 49);
+			continue;
+		}
+		if (0 == i_hdr_ln->find("Frames in Acquisition (Number):")) {
+			phdr->n_frames = (__int64)atoll(i_hdr_ln->substr(32, i_hdr_ln->size() - 32).c_str());
+			continue;
+		}
+		if (0 == i_hdr_ln->find("Frames per Trigger (Number):")) {
+			phdr->n_columns = atoi(i_hdr_ln->substr(29, i_hdr_ln->size() - 29).c_str());
+			continue;
+		}
+	}
+	if (phdr->n_frames > 0 && phdr->n_frames > phdr->n_columns && phdr->n_columns > 0) {
+		phdr->n_rows = (int)((phdr->n_frames - imod64(phdr->n_frames, phdr->n_columns)) / phdr->n_columns);
+	}
+	if (phdr->n_columns > 0 && 0 < imod64(phdr->n_frames, phdr->n_columns)) {
+		phdr->n_rows++;
+	}
+}
 
 int merlin_read_header(std::ifstream * pfin, merlin_hdr * phdr)
 {
 	std::string str_line;
 	std::vector<std::string> v_str_header;
-	std::vector<std::string>::iterator i_hdr_ln;
 	if ( NULL == pfin ) {
 		return 1; // failure due to unknown parameter addresses
 	}
@@ -60,28 +93,34 @@ int merlin_read_header(std::ifstream * pfin, merlin_hdr * phdr)
 		return 2; // failure due invalid stream state
 	}
 	if (phdr != NULL) {
-		// parse the header lines for important information
-		i_hdr_ln = v_str_header.begin();
-		for (i_hdr_ln = v_str_header.begin(); i_hdr_ln != v_str_header.end(); i_hdr_ln++) {
-			if (0 == i_hdr_ln->find("Time and Date Stamp (yr, mnth, day, hr, min, s):")) {
-				phdr->s_timestamp = i_hdr_ln->substr(49, i_hdr_ln->size() - 49);
-				continue;
-			}
-			if (0 == i_hdr_ln->find("Frames in Acquisition (Number):")) {
-				phdr->n_frames = atoi(i_hdr_ln->substr(32, i_hdr_ln->size() - 32).c_str());
-				continue;
-			}
-			if (0 == i_hdr_ln->find("Frames per Trigger (Number):")) {
-				phdr->n_columns = atoi(i_hdr_ln->substr(29, i_hdr_ln->size() - 29).c_str());
-				continue;
-			}
-		}
-		if (phdr->n_frames > 0 && phdr->n_frames > phdr->n_columns && phdr->n_columns > 0) {
-			phdr->n_rows = (phdr->n_frames - imod(phdr->n_frames, phdr->n_columns)) / phdr->n_columns;
-		}
-		if (0 < imod(phdr->n_frames, phdr->n_columns)) {
-			phdr->n_rows++;
+		merlin_parse_header_lines(v_str_header, phdr);
+	}
+	return 0;
+}
+
+int merlin_parse_header(const char * pdata, size_t nbytes, merlin_hdr * phdr)
+{
+	size_t i = 0, i0 = 0;
+	std::string str_line;
+	std::vector<std::string> v_str_header;
+	if (NULL == pdata) {
+		return 1; // failure due to unknown parameter addresses
+	}
+	// split into lines
+	for (i = 0; i <= nbytes; i++) {
+		if (i < nbytes && pdata[i] != '\n' && pdata[i] != '\0') continue;
+		str_line.assign(pdata + i0, i - i0);
+		if (str_line.size() > 0 && str_line[str_line.size() - 1] == '\r') str_line.erase(str_line.size() - 1);
+		if (0 == str_line.find("End")) {
+			v_str_header.push_back("End");
+			break;
 		}
+		v_str_header.push_back(str_line);
+		if (i < nbytes && pdata[i] == '\0') break; // end of the header string
+		i0 = i + 1;
+	}
+	if (phdr != NULL) {
+		merlin_parse_header_lines(v_str_header, phdr);
 	}
 	return 0;
 }
@@ -112,13 +151,173 @@ int merlin_read_frame_header_param(int ipos, std::string * pstr_hdr, std::string
 	return lcpos; // return position which the possible begin of a new parameter or eos
 }
 
+// a token of a header string, not terminated
+struct merlin_token {
+	const char * p = NULL; // first character
+	size_t n = 0; // number of characters
+};
+
+// gets the next comma separated token from pdata[ipos ... nbytes-1] and
+// moves ipos to the begin of the following token, skipping repeated
+// separators. Returns false if no more token is available.
+static bool merlin_next_token(const char * pdata, size_t nbytes, size_t & ipos, merlin_token & tok)
+{
+	size_t i = ipos;
+	if (i >= nbytes || pdata[i] == '\0') {
+		return false; // end of the header string
+	}
+	tok.p = pdata + i;
+	while (i < nbytes && pdata[i] != ',' && pdata[i] != '\0') {
+		i++;
+	}
+	tok.n = (size_t)(pdata + i - tok.p);
+	while (i < nbytes && pdata[i] == ',') {
+		i++;
+	}
+	ipos = i;
+	return true;
+}
+
+// converts a decimal integer token (like atoi)
+static __int64 merlin_token_int(const merlin_token & tok)
+{
+	size_t i = 0;
+	__int64 nsgn = 1;
+	__int64 nval = 0;
+	while (i < tok.n && (tok.p[i] == ' ' || tok.p[i] == '\t')) i++;
+	if (i < tok.n && (tok.p[i] == '-' || tok.p[i] == '+')) {
+		if (tok.p[i] == '-') nsgn = -1;
+		i++;
+	}
+	while (i < tok.n && tok.p[i] >= '0' && tok.p[i] <= '9') {
+		nval = 10 * nval + (__int64)(tok.p[i] - '0');
+		i++;
+	}
+	return nsgn * nval;
+}
+
+// converts a hexadecimal integer token (like strtoul with base 16)
+static unsigned int merlin_token_hex(const merlin_token & tok)
+{
+	size_t i = 0;
+	unsigned int nval = 0;
+	char c = 0;
+	while (i < tok.n && (tok.p[i] == ' ' || tok.p[i] == '\t')) i++;
+	for (; i < tok.n; i++) {
+		c = tok.p[i];
+		if (c >= '0' && c <= '9') nval = 16 * nval + (unsigned int)(c - '0');
+		else if (c >= 'a' && c <= 'f') nval = 16 * nval + (unsigned int)(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F') nval = 16 * nval + (unsigned int)(c - 'A' + 10);
+		else break;
+	}
+	return nval;
+}
+
+// converts a floating point token (like atof)
+static double merlin_token_double(const merlin_token & tok)
+{
+	char cbuf[64]; // terminated copy of the token
+	size_t n = (tok.n < sizeof(cbuf) - 1 ? tok.n : sizeof(cbuf) - 1);
+	memcpy(cbuf, tok.p, n);
+	cbuf[n] = '\0';
+	return atof(cbuf);
+}
+
+int merlin_parse_frame_header_size(const char * pdata, size_t nbytes, int & nhdr, size_t * pipos)
+{
+	size_t ipos = 0;
+	merlin_token tok;
+	nhdr = 0;
+	if (NULL == pdata) {
+		return 1; // invalid input parameter 1
+	}
+	if (nbytes > 128) nbytes = 128; // the size is found in the first 128 bytes
+	// - 1st item = header ID (string), 2nd item = acqusition sequence number (U32)
+	if (!merlin_next_token(pdata, nbytes, ipos, tok)) { return 3; }
+	if (!merlin_next_token(pdata, nbytes, ipos, tok)) { return 3; }
+	// - 3rd item = header length in bytes (U16)
+	if (!merlin_next_token(pdata, nbytes, ipos, tok) || ipos >= nbytes) { return 3; }
+	nhdr = (int)merlin_token_int(tok);
+	if (NULL != pipos) *pipos = ipos;
+	if (nhdr <= 0 || nhdr > MERLIN_FRAME_HDR_SIZE_MAX) {
+		return 4; // unsupported header size
+	}
+	return 0;
+}
+
+int merlin_parse_frame_header(const char * pdata, size_t nbytes, merlin_frame_hdr * pfhdr, bool bstrings)
+{
+	int nerr = 0;
+	int nhdr = 0;
+	size_t ipos = 0, nlen = 0;
+	merlin_token tok;
+	if (NULL == pdata) {
+		return 1; // invalid input parameter 1
+	}
+	if (NULL == pfhdr) {
+		return 2; // invalid input parameter 3
+	}
+	nerr = merlin_parse_frame_header_size(pdata, nbytes, nhdr, NULL);
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (nbytes < (size_t)nhdr) {
+		return 6; // truncated header
+	}
+	nlen = (size_t)nhdr;
+	// - 1st item = header ID (string)
+	merlin_next_token(pdata, nlen, ipos, tok);
+	if (bstrings) pfhdr->s_hid.assign(tok.p, tok.n);
+	// - 2nd item = acqusition sequence number (U32)
+	merlin_next_token(pdata, nlen, ipos, tok);
+	pfhdr->i_seq = merlin_token_int(tok) - 1; // reduce by one to get the 0 based index (merlin starts with 1)
+	// - 3rd item = header length in bytes (U16)
+	merlin_next_token(pdata, nlen, ipos, tok);
+	pfhdr->n_size = (__int16)nhdr;
+	// - 4th item = number of chips (U8)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	pfhdr->n_chips = (__int8)merlin_token_int(tok);
+	// - 5th item = pixel dimension X (U32)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	pfhdr->n_columns = (__int32)merlin_token_int(tok);
+	// - 6th item = pixel dimension Y (U32)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	pfhdr->n_rows = (__int32)merlin_token_int(tok);
+	// - 7th item = pixel depth in file (string, e.g. "U16")
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen || tok.n < 2) { return 5; } // parsing error
+	tok.p++; tok.n = (tok.n > 3 ? 2 : tok.n - 1); // skip the type letter
+	pfhdr->n_bpi = (__int8)merlin_token_int(tok);
+	// - 8th item = sensor layout (string)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	if (bstrings) pfhdr->s_sensor_layout.assign(tok.p, tok.n);
+	// - 9th item = chip select (U8h)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	pfhdr->n_chip_select = (__int8)merlin_token_hex(tok);
+	// - 10th item = timestamp (string)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	if (bstrings) pfhdr->s_time.assign(tok.p, tok.n);
+	// - 11th item = shutter open time (double)
+	if (!merlin_next_token(pdata, nlen, ipos, tok) || ipos >= nlen) { return 5; } // parsing error
+	pfhdr->d_dwell = merlin_token_double(tok);
+	// remaining items to be implemented and currently ignored,
+	// essentially because we never use it and due to a messy
+	// format specification.
+	// - 12th item = counter (U8) for colour mode
+	// - 13th item = colour mode (U8)
+	// - 14th item = gain mode (U8)
+	// - 15th-22nd item = 8 threashold values in keV (float)
+	// - 23rd item ++ = DAC section (many numbers)
+	// + extensions
+	// + padding
+	return 0;
+}
+
 int merlin_read_frame_header(std::ifstream * pfin, merlin_frame_hdr * pfhdr)
 {
+	int nerr = 0;
 	std::streampos ipos = 0;
-	char * cbuf = new char[MERLIN_FRAME_HDR_SIZE_MAX]; // i/o buffer
-	std::string str_tmp;
-	std::string str_num;
-	int ihpos = 0, nhdr = 0;
+	char cbuf[MERLIN_FRAME_HDR_SIZE_MAX]; // i/o buffer
+	int nhdr = 0;
 	if (NULL == pfin) {
 		return 1; // failure due to unknown parameter addresses
 	}
@@ -131,93 +330,60 @@ int merlin_read_frame_header(std::ifstream * pfin, merlin_frame_hdr * pfhdr)
 	// read the first part of the frame header (128 characters)
 	pfin->read(cbuf, 128);
 	if (pfin->fail()) { return 13; } // header test reading failed
-	str_tmp = cbuf;
-	// parse to 3rd entry for reading the header length
-	// - 1st item = header ID (string)
-	ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-	if (ihpos < 0 || ihpos >= 128) { return 3; } // pre-parsing error
-	if (pfhdr) pfhdr->s_hid = str_num;
-	// - 2nd item = acqusition sequence number (U32)
-	ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-	if (ihpos < 0 || ihpos >= 128) { return 3; } // pre-parsing error
-	if (pfhdr) pfhdr->i_seq = (__int32)(atoi(str_num.c_str())-1); // reduce by one to get the 0 based index (merlin starts with 1)
-	// - 3rd item = header length in bytes (U16)
-	ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-	if (ihpos < 0 || ihpos >= 128) { return 3; } // pre-parsing error
-	nhdr = atoi(str_num.c_str());
-	if (pfhdr) pfhdr->n_size = (__int16)nhdr;
+	nerr = merlin_parse_frame_header_size(cbuf, 128, nhdr, NULL);
+	if (nerr != 0) { return nerr; } // pre-parsing error or unsupported header size
 	//
 	// read the full header
-	if (nhdr > 0 && nhdr <= MERLIN_FRAME_HDR_SIZE_MAX) {
-		pfin->seekg(ipos);
-		if (pfin->fail()) { return 14; } // file re-positioning failed
-		pfin->read(cbuf, nhdr);
-		if (pfin->fail()) { return 15; } // full header reading failed
-		str_tmp.clear();
-		str_tmp = cbuf;
-	}
-	else {
-		return 4; // unsupported header size
-	}
+	pfin->seekg(ipos);
+	if (pfin->fail()) { return 14; } // file re-positioning failed
+	pfin->read(cbuf, nhdr);
+	if (pfin->fail()) { return 15; } // full header reading failed
 	//
-	if (pfhdr != NULL) { // parse header content, continuing from ihpos
-		// - 4th item = number of chips (U8)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->n_chips = (__int8)atoi(str_num.c_str());
-		// - 5th item = pixel dimension X (U32)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->n_columns = (__int32)atoi(str_num.c_str());
-		// - 6th item = pixel dimension Y (U32)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->n_rows = (__int32)atoi(str_num.c_str());
-		// - 7th item = pixel depth in file (string)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->n_bpi = (__int8)atoi(str_num.substr(1,2).c_str());
-		// - 8th item = sensor layout (string)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->s_sensor_layout = str_num;
-		// - 9th item = chip select (U8h)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->n_chip_select = (__int8)std::strtoul(str_num.c_str(), 0, 16);
-		// - 10th item = timestamp (string)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->s_time = str_num;
-		// - 11th item = shutter open time (double)
-		ihpos = merlin_read_frame_header_param(ihpos, &str_tmp, &str_num);
-		if (ihpos < 0 || ihpos >= nhdr) { return 5; } // parsing error
-		pfhdr->d_dwell = (double)atof(str_num.c_str());
-		// remaining items to be implemented and currently ignored,
-		// essentially because we never use it and due to a messy
-		// format specification.
-		// - 12th item = counter (U8) for colour mode
-		// - 13th item = colour mode (U8)
-		// - 14th item = gain mode (U8)
-		// - 15th-22nd item = 8 threashold values in keV (float)
-		// - 23rd item ++ = DAC section (many numbers)
-		// + extensions
-		// + padding
+	if (pfhdr != NULL) { // parse header content
+		nerr = merlin_parse_frame_header(cbuf, (size_t)nhdr, pfhdr, true);
+		if (nerr != 0) { return nerr; }
 	}
 	pfin->seekg(ipos + (std::streampos)nhdr); // for some reasons the positioning after reading can fail, catch it!
 	if (pfin->fail()) { return 16; } // file re-positioning failed
 	return 0;
 }
 
+int merlin_decode_data(double *buf, const char * inbuf, merlin_frame_hdr * pfhdr, bool swapbytes)
+{
+	const unsigned char * pdata = (const unsigned char*)inbuf;
+	size_t n;
+	if (NULL == buf) {
+		return 1; // invalid input parameter 1
+	}
+	if (NULL == inbuf) {
+		return 2; // invalid input parameter 2
+	}
+	if (NULL == pfhdr) {
+		return 3; // invalid input parameter 3
+	}
+	n = (size_t)pfhdr->n_columns*pfhdr->n_rows;
+	// switch depending on data type (kernels selected by cpu features)
+	switch (pfhdr->n_bpi) {
+	case 8:
+		merlin_decode_u8(buf, pdata, n);
+		break;
+	case 16:
+		merlin_decode_u16(buf, pdata, n, swapbytes);
+		break;
+	case 32:
+		merlin_decode_u32(buf, pdata, n, swapbytes);
+		break;
+	default:
+		return 200; // unsupported data type
+		break;
+	}
+	return 0;
+}
+
 int merlin_read_data(double *buf, std::streampos pos, std::ifstream * pfin, merlin_hdr * phdr, merlin_frame_hdr * pfhdr, bool swapbytes)
 {
 	int nerr = 0;
 	char * inbuf = NULL;
-	char bs[4];
-	unsigned __int8 * pdata8 = NULL;
-	unsigned __int16 * pdata16 = NULL;
-	unsigned __int32 * pdata32 = NULL;
-	size_t i, j, n;
 	if (NULL == buf) {
 		return 1; // invalid input parameter 1
 	}
@@ -251,54 +417,7 @@ int merlin_read_data(double *buf, std::streampos pos, std::ifstream * pfin, merl
 		goto _exit_point;
 	}
 
-	n = pfhdr->n_columns*pfhdr->n_rows;
-	// switch depending on data type
-	switch (pfhdr->n_bpi) {
-	case 8:
-		pdata8 = (unsigned __int8*)(inbuf);
-		for (i = 0; i < n; i++) {
-			buf[i] = (double)pdata8[i];
-		}
-		break;
-	case 16:
-		if (swapbytes) {
-			for (i = 0; i < n; i++) {
-				j = 2 * i;
-				bs[1] = inbuf[j];
-				bs[0] = inbuf[j + 1];
-				buf[i] = (double)(*((unsigned __int16*)bs));
-			}
-		}
-		else {
-			pdata16 = (unsigned __int16*)(inbuf);
-			for (i = 0; i < n; i++) {
-				buf[i] = (double)pdata16[i];
-			}
-		}
-		break;
-	case 32:
-		if (swapbytes) {
-			for (i = 0; i < n; i++) {
-				j = 4 * i;
-				bs[3] = inbuf[j];
-				bs[2] = inbuf[j + 1];
-				bs[1] = inbuf[j + 2];
-				bs[0] = inbuf[j + 3];
-				buf[i] = (double)(*((unsigned __int32*)bs));
-			}
-		}
-		else {
-			pdata32 = (unsigned __int32*)(inbuf);
-			for (i = 0; i < n; i++) {
-				buf[i] = (double)pdata32[i];
-			}
-		}
-		
-		break;
-	default:
-		return 200; // unsupported data type
-		break;
-	}
+	nerr = merlin_decode_data(buf, inbuf, pfhdr, swapbytes);
 
 _exit_point:
 	if (NULL != inbuf) {
@@ -52,7 +52,7 @@ struct merlin_range {
 };
 
 struct merlin_hdr {
-	int n_frames = 0; // nframes = nx*ny
+	__int64 n_frames = 0; // nframes = nx*ny
 	int n_columns = 0; // nx
 	int n_rows = 0; // ny
 	int n_files = 0; // number of files
@@ -66,7 +66,7 @@ struct merlin_frame_hdr {
 	__int16 n_size = 0; // header size in bytes
 	__int32 n_columns = 0; // nx
 	__int32 n_rows = 0; // ny
-	__int32 i_seq = 0; // frame acquisition sequence (zero based index)
+	__int64 i_seq = 0; // frame acquisition sequence (zero based index)
 	__int8 n_chips = 0; // number of chips
 	__int8 n_bpi = 16; // number of bits per item
 	__int8 n_chip_select = 0; // chip selection bits (least significant bit is first chip)
@@ -83,11 +83,17 @@ struct merlin_frame_calib {
 };
 
 int imod(int i, int n);
+__int64 imod64(__int64 i, __int64 n);
 
 // reads data from the merlin main header file opened as ifstream
 // - fills information to the provided merlin_frame_hdr * phdr
 int merlin_read_header(std::ifstream * pfin, merlin_hdr * phdr);
 
+// parses the merlin main header from memory (pdata, nbytes), e.g. the
+// acquisition header received from a data stream
+// - fills information to the provided merlin_hdr * phdr
+int merlin_parse_header(const char * pdata, size_t nbytes, merlin_hdr * phdr);
+
 // gets the next parameter string from the frame header string starting
 // at position ipos of the header string. ipos is expected to be
 // the first character of the parameter string. The function returns
@@ -99,6 +105,30 @@ int merlin_read_frame_header_param(int ipos, std::string * pstr_hdr, std::string
 // - the stream position moved to after the header
 int merlin_read_frame_header(std::ifstream * pfin, merlin_frame_hdr * pfhdr);
 
+// parses the header size from the first items of a frame header in
+// memory (pdata, nbytes) without heap allocations
+// - output nhdr = header size in bytes
+// - output pipos = position after the 3rd item (optional, may be NULL)
+// - return value = error code (0: success, 3: pre-parsing error,
+//   4: unsupported header size)
+int merlin_parse_frame_header_size(const char * pdata, size_t nbytes, int & nhdr, size_t * pipos);
+
+// parses a frame header from memory (pdata, nbytes)
+// - output pfhdr = frame header information, the string items are
+//   only set when bstrings is true, otherwise no heap allocation
+//   takes place
+// - return value = error code (0: success, 3: pre-parsing error,
+//   4: unsupported header size, 5: parsing error, 6: truncated header)
+int merlin_parse_frame_header(const char * pdata, size_t nbytes, merlin_frame_hdr * pfhdr, bool bstrings);
+
+// decodes raw frame data from memory (inbuf) to double
+// - output buf = pointer to buffer recieving pre-processed data
+// - input inbuf = pointer to the raw frame data (as stored in the file)
+// - input pfhdr = pointer to struct merlin_frame_hdr
+// - input swapbytes = do byte swap on data transfer to double
+// returns an error code > 0 in case of failures
+int merlin_decode_data(double *buf, const char * inbuf, merlin_frame_hdr * pfhdr, bool swapbytes);
+
 // reads data from file from given file position and returns as double
 // (pre-processing can be applied in this function, switches via merlin_hdr)
 // - output buf = pointer to buffer recieving pre-processed data
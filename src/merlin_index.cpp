@@ -0,0 +1,459 @@
+// file : "merlin_index.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the frame index sidecar file I/O.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_index.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdio>
+
+// Index file layout (native byte order, checked by an order mark):
+//   char[8]  magic "MRLNIDX"
+//   u32      format version, u32 byte order mark 0x01020304
+//   u32      flags (bit 0: careful frame header scan)
+//   merlin_hdr        (i64, 3 x i32, 2 x u64, string)
+//   merlin_frame_hdr  (i16, 2 x i32, i64, 3 x i8, f64, 3 x string)
+//   u64      number of files, then per file: i64 size, i64 mtime
+//   i64      regular frame distance in bytes
+//   u64      number of segments, then per segment:
+//            i64 frame0, i64 n_frames, i32 ifile, i64 base, i64 stride
+//   u64      number of exceptions, then per exception:
+//            i64 idx, i32 ifile, i64 pos
+// Strings are stored as u32 length followed by the characters.
+
+static const char MERLIN_INDEX_MAGIC[8] = { 'M','R','L','N','I','D','X','\0' };
+constexpr unsigned __int32 MERLIN_INDEX_BOM = 0x01020304;
+
+// appends nbytes from psrc to the byte buffer v
+static void idx_put(std::vector<char> & v, const void * psrc, size_t nbytes)
+{
+	const char * p = (const char*)psrc;
+	v.insert(v.end(), p, p + nbytes);
+}
+
+static void idx_put_str(std::vector<char> & v, const std::string & str)
+{
+	unsigned __int32 n = (unsigned __int32)str.size();
+	idx_put(v, &n, sizeof(n));
+	idx_put(v, str.data(), str.size());
+}
+
+// sequential reader of a byte buffer
+struct idx_cursor {
+	const char * p = NULL; // current position
+	const char * pend = NULL; // end of the buffer
+	bool bfail = false; // flags reading beyond the end
+};
+
+static void idx_get(idx_cursor & c, void * pdst, size_t nbytes)
+{
+	if (c.bfail || (size_t)(c.pend - c.p) < nbytes) {
+		c.bfail = true;
+		memset(pdst, 0, nbytes);
+		return;
+	}
+	memcpy(pdst, c.p, nbytes);
+	c.p += nbytes;
+}
+
+static void idx_get_str(idx_cursor & c, std::string & str)
+{
+	unsigned __int32 n = 0;
+	idx_get(c, &n, sizeof(n));
+	if (c.bfail || (size_t)(c.pend - c.p) < (size_t)n) {
+		c.bfail = true;
+		str.clear();
+		return;
+	}
+	str.assign(c.p, (size_t)n);
+	c.p += n;
+}
+
+
+merlin_frame_index::merlin_frame_index()
+{
+	nstride = 0;
+	nframes = 0;
+}
+
+merlin_frame_index::~merlin_frame_index()
+{
+	v_seg.clear();
+	v_exc.clear();
+}
+
+void merlin_frame_index::clear(__int64 stride)
+{
+	nstride = stride;
+	nframes = 0;
+	v_seg.clear();
+	v_exc.clear();
+}
+
+__int64 merlin_frame_index::size(void) const
+{
+	return nframes;
+}
+
+__int64 merlin_frame_index::get_stride(void) const
+{
+	return nstride;
+}
+
+void merlin_frame_index::push_back(int ifile, std::streampos pos)
+{
+	__int64 ipos = (__int64)(std::streamoff)pos;
+	__int64 idx = nframes; // index of the new frame
+	size_t nseg = v_seg.size();
+	merlin_frame_segment seg;
+	merlin_frame_exception exc;
+	if (nseg > 0) {
+		merlin_frame_segment & s = v_seg[nseg - 1];
+		if (s.ifile == ifile && ipos == s.base + (__int64)(idx - s.frame0) * s.stride) { // continues the last segment
+			s.n_frames++;
+			nframes++;
+			return;
+		}
+		if (s.n_frames == 1 && nseg > 1) { // the previous frame may be a single irregular frame
+			merlin_frame_segment & sp = v_seg[nseg - 2];
+			if (sp.ifile == ifile && ipos == sp.base + (__int64)(idx - sp.frame0) * sp.stride) {
+				exc.idx = s.frame0; // keep the previous frame as exception
+				exc.ifile = s.ifile;
+				exc.pos = s.base;
+				v_exc.push_back(exc);
+				sp.n_frames += 2; // the segment before covers both frames
+				v_seg.pop_back();
+				nframes++;
+				return;
+			}
+		}
+	}
+	// start a new segment
+	seg.frame0 = idx;
+	seg.n_frames = 1;
+	seg.ifile = ifile;
+	seg.base = ipos;
+	seg.stride = nstride;
+	v_seg.push_back(seg);
+	nframes++;
+}
+
+void merlin_frame_index::push_back_regular(int ifile, std::streampos pos0, __int64 n)
+{
+	if (n <= 0) return;
+	push_back(ifile, pos0);
+	// the last segment now contains the first frame, following frames continue it
+	v_seg.back().n_frames += (n - 1);
+	nframes += (n - 1);
+}
+
+int merlin_frame_index::get(__int64 idx, int & ifile, std::streampos & pos) const
+{
+	size_t i0 = 0, i1 = 0, im = 0;
+	if (idx < 0 || idx >= nframes) {
+		return 1; // invalid index
+	}
+	if (v_exc.size() > 0) { // check irregular frames first
+		i0 = 0; i1 = v_exc.size();
+		while (i0 < i1) { // find the first exception with exc.idx >= idx
+			im = (i0 + i1) >> 1;
+			if (v_exc[im].idx < idx) i0 = im + 1; else i1 = im;
+		}
+		if (i0 < v_exc.size() && v_exc[i0].idx == idx) {
+			ifile = v_exc[i0].ifile;
+			pos = (std::streampos)(std::streamoff)v_exc[i0].pos;
+			return 0;
+		}
+	}
+	i0 = 0; i1 = v_seg.size();
+	while (i1 - i0 > 1) { // find the last segment with frame0 <= idx
+		im = (i0 + i1) >> 1;
+		if (v_seg[im].frame0 <= idx) i0 = im; else i1 = im;
+	}
+	const merlin_frame_segment & s = v_seg[i0];
+	ifile = s.ifile;
+	pos = (std::streampos)(std::streamoff)(s.base + (__int64)(idx - s.frame0) * s.stride);
+	return 0;
+}
+
+size_t merlin_frame_index::get_memory_size(void) const
+{
+	return v_seg.capacity() * sizeof(merlin_frame_segment) + v_exc.capacity() * sizeof(merlin_frame_exception);
+}
+
+const std::vector<merlin_frame_segment> & merlin_frame_index::get_segments(void) const
+{
+	return v_seg;
+}
+
+const std::vector<merlin_frame_exception> & merlin_frame_index::get_exceptions(void) const
+{
+	return v_exc;
+}
+
+int merlin_frame_index::set_tables(__int64 stride, std::vector<merlin_frame_segment> & v_seg_in, std::vector<merlin_frame_exception> & v_exc_in)
+{
+	size_t i = 0;
+	__int64 n = 0;
+	for (i = 0; i < v_seg_in.size(); i++) { // segments must be contiguous
+		if (v_seg_in[i].frame0 != n || v_seg_in[i].n_frames <= 0) {
+			return 1;
+		}
+		n += v_seg_in[i].n_frames;
+	}
+	for (i = 0; i < v_exc_in.size(); i++) { // exceptions must be sorted and in range
+		if (v_exc_in[i].idx < 0 || v_exc_in[i].idx >= n || (i > 0 && v_exc_in[i].idx <= v_exc_in[i - 1].idx)) {
+			return 2;
+		}
+	}
+	nstride = stride;
+	nframes = n;
+	v_seg.swap(v_seg_in);
+	v_exc.swap(v_exc_in);
+	return 0;
+}
+
+
+int merlin_get_file_stamp(std::string str_file, merlin_file_stamp & stamp)
+{
+#ifdef _WIN32
+	struct _stat64 statbuf; // 64-bit file sizes
+	stamp.n_size = 0;
+	stamp.t_modified = 0;
+	if (_stat64(str_file.c_str(), &statbuf) != 0) {
+		return 1; // file not found
+	}
+#else
+	struct stat statbuf;
+	stamp.n_size = 0;
+	stamp.t_modified = 0;
+	if (stat(str_file.c_str(), &statbuf) != 0) {
+		return 1; // file not found
+	}
+#endif
+	stamp.n_size = (__int64)statbuf.st_size;
+	stamp.t_modified = (__int64)statbuf.st_mtime;
+	return 0;
+}
+
+int merlin_write_index(std::string str_file, merlin_index_data * pidx)
+{
+	int nerr = 0;
+	unsigned __int32 u32 = 0;
+	unsigned __int64 u64 = 0;
+	__int64 i64 = 0;
+	size_t i = 0;
+	std::vector<char> v; // serialized index
+	std::string str_tmp = str_file + ".tmp";
+	std::ofstream fout;
+	if (NULL == pidx) {
+		return 1; // missing parameter 2
+	}
+	const std::vector<merlin_frame_segment> & v_seg = pidx->frm_index.get_segments();
+	const std::vector<merlin_frame_exception> & v_exc = pidx->frm_index.get_exceptions();
+	v.reserve(256 + 16 * pidx->v_stamp.size() + 36 * v_seg.size() + 20 * v_exc.size());
+	// head
+	idx_put(v, MERLIN_INDEX_MAGIC, sizeof(MERLIN_INDEX_MAGIC));
+	u32 = MERLIN_INDEX_VERSION; idx_put(v, &u32, sizeof(u32));
+	u32 = MERLIN_INDEX_BOM; idx_put(v, &u32, sizeof(u32));
+	u32 = (pidx->bscanframeheaders ? 1 : 0); idx_put(v, &u32, sizeof(u32));
+	// global header
+	idx_put(v, &pidx->hdr.n_frames, sizeof(__int64));
+	idx_put(v, &pidx->hdr.n_columns, sizeof(__int32));
+	idx_put(v, &pidx->hdr.n_rows, sizeof(__int32));
+	idx_put(v, &pidx->hdr.n_files, sizeof(__int32));
+	u64 = (unsigned __int64)pidx->hdr.n_fhdr_bytes; idx_put(v, &u64, sizeof(u64));
+	u64 = (unsigned __int64)pidx->hdr.n_data_bytes; idx_put(v, &u64, sizeof(u64));
+	idx_put_str(v, pidx->hdr.s_timestamp);
+	// frame header template
+	idx_put(v, &pidx->hdr_frm.n_size, sizeof(__int16));
+	idx_put(v, &pidx->hdr_frm.n_columns, sizeof(__int32));
+	idx_put(v, &pidx->hdr_frm.n_rows, sizeof(__int32));
+	idx_put(v, &pidx->hdr_frm.i_seq, sizeof(__int64));
+	idx_put(v, &pidx->hdr_frm.n_chips, sizeof(__int8));
+	idx_put(v, &pidx->hdr_frm.n_bpi, sizeof(__int8));
+	idx_put(v, &pidx->hdr_frm.n_chip_select, sizeof(__int8));
+	idx_put(v, &pidx->hdr_frm.d_dwell, sizeof(double));
+	idx_put_str(v, pidx->hdr_frm.s_sensor_layout);
+	idx_put_str(v, pidx->hdr_frm.s_hid);
+	idx_put_str(v, pidx->hdr_frm.s_time);
+	// file stamps
+	u64 = (unsigned __int64)pidx->v_stamp.size(); idx_put(v, &u64, sizeof(u64));
+	for (i = 0; i < pidx->v_stamp.size(); i++) {
+		idx_put(v, &pidx->v_stamp[i].n_size, sizeof(__int64));
+		idx_put(v, &pidx->v_stamp[i].t_modified, sizeof(__int64));
+	}
+	// frame tables
+	i64 = pidx->frm_index.get_stride(); idx_put(v, &i64, sizeof(i64));
+	u64 = (unsigned __int64)v_seg.size(); idx_put(v, &u64, sizeof(u64));
+	for (i = 0; i < v_seg.size(); i++) {
+		idx_put(v, &v_seg[i].frame0, sizeof(__int64));
+		idx_put(v, &v_seg[i].n_frames, sizeof(__int64));
+		idx_put(v, &v_seg[i].ifile, sizeof(__int32));
+		idx_put(v, &v_seg[i].base, sizeof(__int64));
+		idx_put(v, &v_seg[i].stride, sizeof(__int64));
+	}
+	u64 = (unsigned __int64)v_exc.size(); idx_put(v, &u64, sizeof(u64));
+	for (i = 0; i < v_exc.size(); i++) {
+		idx_put(v, &v_exc[i].idx, sizeof(__int64));
+		idx_put(v, &v_exc[i].ifile, sizeof(__int32));
+		idx_put(v, &v_exc[i].pos, sizeof(__int64));
+	}
+	// write to a temporary file and replace the index file
+	fout.open(str_tmp, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!fout.is_open()) {
+		return 10; // failed to open the file
+	}
+	fout.write(v.data(), v.size());
+	if (fout.fail()) {
+		nerr = 11; // failed to write
+	}
+	fout.close();
+	if (nerr == 0) {
+		remove(str_file.c_str());
+		if (0 != rename(str_tmp.c_str(), str_file.c_str())) {
+			nerr = 12; // failed to replace the index file
+		}
+	}
+	if (nerr != 0) {
+		remove(str_tmp.c_str());
+	}
+	return nerr;
+}
+
+int merlin_read_index(std::string str_file, merlin_index_data * pidx)
+{
+	unsigned __int32 u32 = 0;
+	unsigned __int64 u64 = 0;
+	__int64 i64 = 0;
+	size_t i = 0, n = 0, nbytes = 0;
+	char magic[sizeof(MERLIN_INDEX_MAGIC)];
+	merlin_file_stamp stamp;
+	std::vector<merlin_frame_segment> v_seg; // segment table
+	std::vector<merlin_frame_exception> v_exc; // exception table
+	std::vector<char> v; // serialized index
+	std::ifstream fin;
+	idx_cursor c;
+	if (NULL == pidx) {
+		return 4; // missing parameter 2
+	}
+	if (0 != merlin_get_file_stamp(str_file, stamp)) {
+		return 1; // file not found
+	}
+	// read the whole file at once
+	nbytes = (size_t)stamp.n_size;
+	fin.open(str_file, std::ios::in | std::ios::binary);
+	if (!fin.is_open()) {
+		return 1; // file not accessible
+	}
+	v.resize(nbytes);
+	fin.read(v.data(), nbytes);
+	if (fin.fail()) {
+		return 3; // truncated
+	}
+	fin.close();
+	c.p = v.data();
+	c.pend = v.data() + v.size();
+	// head
+	idx_get(c, magic, sizeof(magic));
+	if (c.bfail || 0 != memcmp(magic, MERLIN_INDEX_MAGIC, sizeof(magic))) {
+		return 2; // unknown format
+	}
+	idx_get(c, &u32, sizeof(u32));
+	if (u32 != MERLIN_INDEX_VERSION) {
+		return 2; // unknown version
+	}
+	idx_get(c, &u32, sizeof(u32));
+	if (u32 != MERLIN_INDEX_BOM) {
+		return 2; // written with a different byte order
+	}
+	idx_get(c, &u32, sizeof(u32));
+	pidx->bscanframeheaders = (0 != (u32 & 1));
+	// global header
+	idx_get(c, &pidx->hdr.n_frames, sizeof(__int64));
+	idx_get(c, &pidx->hdr.n_columns, sizeof(__int32));
+	idx_get(c, &pidx->hdr.n_rows, sizeof(__int32));
+	idx_get(c, &pidx->hdr.n_files, sizeof(__int32));
+	idx_get(c, &u64, sizeof(u64)); pidx->hdr.n_fhdr_bytes = (size_t)u64;
+	idx_get(c, &u64, sizeof(u64)); pidx->hdr.n_data_bytes = (size_t)u64;
+	idx_get_str(c, pidx->hdr.s_timestamp);
+	// frame header template
+	idx_get(c, &pidx->hdr_frm.n_size, sizeof(__int16));
+	idx_get(c, &pidx->hdr_frm.n_columns, sizeof(__int32));
+	idx_get(c, &pidx->hdr_frm.n_rows, sizeof(__int32));
+	idx_get(c, &pidx->hdr_frm.i_seq, sizeof(__int64));
+	idx_get(c, &pidx->hdr_frm.n_chips, sizeof(__int8));
+	idx_get(c, &pidx->hdr_frm.n_bpi, sizeof(__int8));
+	idx_get(c, &pidx->hdr_frm.n_chip_select, sizeof(__int8));
+	idx_get(c, &pidx->hdr_frm.d_dwell, sizeof(double));
+	idx_get_str(c, pidx->hdr_frm.s_sensor_layout);
+	idx_get_str(c, pidx->hdr_frm.s_hid);
+	idx_get_str(c, pidx->hdr_frm.s_time);
+	// file stamps
+	idx_get(c, &u64, sizeof(u64));
+	if (c.bfail || u64 != (unsigned __int64)pidx->hdr.n_files) {
+		return 3; // inconsistent number of files
+	}
+	pidx->v_stamp.resize((size_t)u64);
+	for (i = 0; i < pidx->v_stamp.size(); i++) {
+		idx_get(c, &pidx->v_stamp[i].n_size, sizeof(__int64));
+		idx_get(c, &pidx->v_stamp[i].t_modified, sizeof(__int64));
+	}
+	// frame tables
+	idx_get(c, &i64, sizeof(i64)); // regular frame distance
+	idx_get(c, &u64, sizeof(u64));
+	if (c.bfail || u64 > (unsigned __int64)(c.pend - c.p) / 36) {
+		return 3; // truncated segment table
+	}
+	n = (size_t)u64;
+	v_seg.resize(n);
+	for (i = 0; i < n; i++) {
+		idx_get(c, &v_seg[i].frame0, sizeof(__int64));
+		idx_get(c, &v_seg[i].n_frames, sizeof(__int64));
+		idx_get(c, &v_seg[i].ifile, sizeof(__int32));
+		idx_get(c, &v_seg[i].base, sizeof(__int64));
+		idx_get(c, &v_seg[i].stride, sizeof(__int64));
+	}
+	idx_get(c, &u64, sizeof(u64));
+	if (c.bfail || u64 > (unsigned __int64)(c.pend - c.p) / 20) {
+		return 3; // truncated exception table
+	}
+	n = (size_t)u64;
+	v_exc.resize(n);
+	for (i = 0; i < n; i++) {
+		idx_get(c, &v_exc[i].idx, sizeof(__int64));
+		idx_get(c, &v_exc[i].ifile, sizeof(__int32));
+		idx_get(c, &v_exc[i].pos, sizeof(__int64));
+	}
+	if (c.bfail) {
+		return 3; // truncated
+	}
+	if (0 != pidx->frm_index.set_tables(i64, v_seg, v_exc)) {
+		return 3; // inconsistent frame tables
+	}
+	return 0;
+}
@@ -0,0 +1,125 @@
+// file : "merlin_index.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the frame index sidecar file I/O used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include "merlin_hdr.h"
+
+constexpr unsigned __int32 MERLIN_INDEX_VERSION = 3; // version of the index file format
+
+// validation stamp of a file
+struct merlin_file_stamp {
+	__int64 n_size = 0; // file size in bytes
+	__int64 t_modified = 0; // time of the last modification
+};
+
+// frames (frame0 ... frame0 + n_frames - 1) stored at regular
+// positions base + k * stride in data file ifile
+struct merlin_frame_segment {
+	__int64 frame0 = 0; // first frame index of the segment
+	__int64 n_frames = 0; // number of frames in the segment
+	int ifile = 0; // file index
+	__int64 base = 0; // data position of the first frame
+	__int64 stride = 0; // distance between frames in bytes
+};
+
+// a frame stored off the regular position of its segment
+struct merlin_frame_exception {
+	__int64 idx = 0; // frame index
+	int ifile = 0; // file index
+	__int64 pos = 0; // data position
+};
+
+// Compact table of frame data positions. Regular frames are described
+// arithmetically by segments, usually one per data file. Single frames
+// breaking the pattern of a segment are kept in a sorted exception list.
+class merlin_frame_index
+{
+public:
+	// constructor
+	merlin_frame_index();
+	// destructor
+	~merlin_frame_index();
+
+protected:
+	__int64 nstride; // default distance between frames in bytes
+	__int64 nframes; // number of frames
+	std::vector<merlin_frame_segment> v_seg; // segments sorted by frame0
+	std::vector<merlin_frame_exception> v_exc; // exceptions sorted by idx
+
+	// member functions
+public:
+	// removes all frames and sets the regular frame distance in bytes
+	void clear(__int64 stride = 0);
+
+	// returns the number of frames
+	__int64 size(void) const;
+
+	// returns the regular frame distance in bytes
+	__int64 get_stride(void) const;
+
+	// appends the next frame in file ifile at data position pos
+	void push_back(int ifile, std::streampos pos);
+
+	// appends n frames in file ifile at regular positions from pos0
+	void push_back_regular(int ifile, std::streampos pos0, __int64 n);
+
+	// determines file index and data position of frame idx
+	// - return value = error code (0: success, 1: invalid index)
+	int get(__int64 idx, int & ifile, std::streampos & pos) const;
+
+	// returns the memory used by the tables in bytes
+	size_t get_memory_size(void) const;
+
+	// access to the tables for file i/o
+	const std::vector<merlin_frame_segment> & get_segments(void) const;
+	const std::vector<merlin_frame_exception> & get_exceptions(void) const;
+
+	// sets the tables, checks that segments are contiguous and that
+	// exceptions are sorted and in range
+	// - return value = error code (0: success)
+	int set_tables(__int64 stride, std::vector<merlin_frame_segment> & v_seg_in, std::vector<merlin_frame_exception> & v_exc_in);
+};
+
+// content of a frame index file "<input-file-name>.idx"
+struct merlin_index_data {
+	bool bscanframeheaders = false; // index was made by a careful frame header scan
+	merlin_hdr hdr; // global header with file and frame sizes
+	merlin_frame_hdr hdr_frm; // frame header template
+	std::vector<merlin_file_stamp> v_stamp; // stamps of the ".mib" files
+	merlin_frame_index frm_index; // data positions of the frames
+};
+
+// gets the validation stamp of file str_file
+// - return value = error code (0: success, 1: file not found)
+int merlin_get_file_stamp(std::string str_file, merlin_file_stamp & stamp);
+
+// writes the frame index data *pidx to file str_file
+// - return value = error code (0: success)
+int merlin_write_index(std::string str_file, merlin_index_data * pidx);
+
+// reads the frame index data *pidx from file str_file with a single read
+// - return value = error code (0: success, 1: file not found,
+//   2: unknown format or version, 3: truncated or inconsistent data)
+int merlin_read_index(std::string str_file, merlin_index_data * pidx);
@@ -0,0 +1,338 @@
+// file : "merlin_mmap.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of read-only memory mapped file access.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_mmap.h"
+#include <cstdint>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+merlin_mmap_file::merlin_mmap_file()
+{
+	pdata = NULL;
+	nsize = 0;
+#ifdef _WIN32
+	hfile = INVALID_HANDLE_VALUE;
+	hmap = NULL;
+#else
+	nfd = -1;
+#endif
+}
+
+merlin_mmap_file::~merlin_mmap_file()
+{
+	close();
+}
+
+int merlin_mmap_file::open(std::string str_file)
+{
+	close();
+#ifdef _WIN32
+	LARGE_INTEGER lsize;
+	hfile = CreateFileA(str_file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hfile == INVALID_HANDLE_VALUE) {
+		return 1; // failed to open the file
+	}
+	if (!GetFileSizeEx((HANDLE)hfile, &lsize)) {
+		close();
+		return 2; // failed to determine the file size
+	}
+	if ((unsigned __int64)lsize.QuadPart > (unsigned __int64)SIZE_MAX) {
+		close();
+		return 3; // file too large for the address space
+	}
+	nsize = (size_t)lsize.QuadPart;
+	if (nsize == 0) {
+		return 0; // nothing to map, the empty file is open
+	}
+	hmap = CreateFileMappingA((HANDLE)hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hmap == NULL) {
+		close();
+		return 4; // failed to create the file mapping
+	}
+	pdata = (const char*)MapViewOfFile((HANDLE)hmap, FILE_MAP_READ, 0, 0, 0);
+	if (pdata == NULL) {
+		close();
+		return 5; // failed to map the file
+	}
+#else
+	struct stat statbuf;
+	void * pmap = NULL;
+	nfd = ::open(str_file.c_str(), O_RDONLY);
+	if (nfd < 0) {
+		return 1; // failed to open the file
+	}
+	if (fstat(nfd, &statbuf) != 0) {
+		close();
+		return 2; // failed to determine the file size
+	}
+	if ((unsigned long long)statbuf.st_size > (unsigned long long)SIZE_MAX) {
+		close();
+		return 3; // file too large for the address space
+	}
+	nsize = (size_t)statbuf.st_size;
+	if (nsize == 0) {
+		return 0; // nothing to map, the empty file is open
+	}
+	pmap = mmap(NULL, nsize, PROT_READ, MAP_SHARED, nfd, 0);
+	if (pmap == MAP_FAILED) {
+		close();
+		return 5; // failed to map the file
+	}
+	pdata = (const char*)pmap;
+#endif
+	return 0;
+}
+
+void merlin_mmap_file::close(void)
+{
+#ifdef _WIN32
+	if (pdata != NULL) {
+		UnmapViewOfFile((LPCVOID)pdata);
+	}
+	if (hmap != NULL) {
+		CloseHandle((HANDLE)hmap);
+	}
+	if (hfile != INVALID_HANDLE_VALUE) {
+		CloseHandle((HANDLE)hfile);
+	}
+	hmap = NULL;
+	hfile = INVALID_HANDLE_VALUE;
+#else
+	if (pdata != NULL) {
+		munmap((void*)pdata, nsize);
+	}
+	if (nfd >= 0) {
+		::close(nfd);
+	}
+	nfd = -1;
+#endif
+	pdata = NULL;
+	nsize = 0;
+}
+
+bool merlin_mmap_file::is_open(void)
+{
+#ifdef _WIN32
+	return (hfile != INVALID_HANDLE_VALUE);
+#else
+	return (nfd >= 0);
+#endif
+}
+
+const char * merlin_mmap_file::data(void)
+{
+	return pdata;
+}
+
+size_t merlin_mmap_file::size(void)
+{
+	return nsize;
+}
+
+int merlin_mmap_file::advise(size_t pos, size_t nbytes, int nadvice)
+{
+	if (pdata == NULL || pos >= nsize) {
+		return 1; // nothing mapped or invalid position
+	}
+	if (nbytes > nsize - pos) nbytes = nsize - pos;
+#ifdef _WIN32
+	return 0; // no advice, the file is opened for sequential scans
+#else
+	size_t npage = (size_t)sysconf(_SC_PAGESIZE);
+	size_t p0 = 0, p1 = 0;
+	if (nadvice == MERLIN_ADVISE_WILLNEED) { // all pages touching the range
+		p0 = pos & ~(npage - 1);
+		p1 = pos + nbytes;
+		if (0 != madvise((void*)(pdata + p0), p1 - p0, MADV_WILLNEED)) {
+			return 2;
+		}
+		return 0;
+	}
+	if (nadvice == MERLIN_ADVISE_DONTNEED) { // pages inside the range, unmap and release them
+		p0 = (pos + npage - 1) & ~(npage - 1);
+		p1 = (pos + nbytes) & ~(npage - 1);
+		if (p1 <= p0) return 0; // no full page
+		if (0 != madvise((void*)(pdata + p0), p1 - p0, MADV_DONTNEED)) {
+			return 2;
+		}
+		if (0 != posix_fadvise(nfd, (off_t)p0, (off_t)(p1 - p0), POSIX_FADV_DONTNEED)) {
+			return 3;
+		}
+		return 0;
+	}
+	return 4; // unknown advice
+#endif
+}
+
+
+
+merlin_data_map::merlin_data_map()
+{
+	v_files.clear();
+}
+
+merlin_data_map::~merlin_data_map()
+{
+	close();
+}
+
+int merlin_data_map::open(std::string str_file_input, int n_files)
+{
+	int i = 0;
+	std::string str_file = "";
+	merlin_mmap_file * pfile = NULL;
+	close();
+	if (n_files <= 0) {
+		return 1; // invalid number of files
+	}
+	for (i = 0; i < n_files; i++) {
+		str_file = str_file_input + std::to_string(i + 1) + ".mib"; // file name construction
+		pfile = new merlin_mmap_file();
+		v_files.push_back(pfile);
+		if (0 != pfile->open(str_file)) {
+			close();
+			return 2; // failed to map a file
+		}
+	}
+	return 0;
+}
+
+void merlin_data_map::close(void)
+{
+	size_t i = 0;
+	for (i = 0; i < v_files.size(); i++) {
+		if (NULL != v_files[i]) {
+			delete v_files[i];
+		}
+	}
+	v_files.clear();
+}
+
+bool merlin_data_map::is_open(void)
+{
+	return (v_files.size() > 0);
+}
+
+int merlin_data_map::get_num_files(void)
+{
+	return (int)v_files.size();
+}
+
+size_t merlin_data_map::get_file_size(int ifile)
+{
+	if (ifile < 0 || ifile >= (int)v_files.size()) {
+		return 0; // invalid file index
+	}
+	return v_files[ifile]->size();
+}
+
+const char * merlin_data_map::get_data(int ifile, std::streampos pos, size_t nbytes)
+{
+	merlin_mmap_file * pfile = NULL;
+	unsigned __int64 upos = 0;
+	if (ifile < 0 || ifile >= (int)v_files.size() || (std::streamoff)pos < 0) {
+		return NULL; // invalid file index or position
+	}
+	pfile = v_files[ifile];
+	if (NULL == pfile->data()) {
+		return NULL; // nothing mapped
+	}
+	upos = (unsigned __int64)(std::streamoff)pos;
+	if (upos + nbytes > (unsigned __int64)pfile->size()) {
+		return NULL; // requested range exceeds the file
+	}
+	return pfile->data() + (size_t)upos;
+}
+
+int merlin_data_map::advise(int ifile, std::streampos pos, size_t nbytes, int nadvice)
+{
+	if (ifile < 0 || ifile >= (int)v_files.size() || (std::streamoff)pos < 0) {
+		return 1; // invalid file index or position
+	}
+	return v_files[ifile]->advise((size_t)(std::streamoff)pos, nbytes, nadvice);
+}
+
+
+int merlin_file_advice_open(std::string str_file)
+{
+#ifdef _WIN32
+	return -1; // no advice for file streams
+#else
+	return ::open(str_file.c_str(), O_RDONLY); // advice applies to the file, not the descriptor
+#endif
+}
+
+void merlin_file_advice_close(int nfd)
+{
+#ifndef _WIN32
+	if (nfd >= 0) {
+		::close(nfd);
+	}
+#endif
+}
+
+int merlin_file_advise(int nfd, __int64 pos, size_t nbytes, int nadvice)
+{
+#ifdef _WIN32
+	return 0; // no advice for file streams
+#else
+	int nerr = 0;
+	size_t npage = (size_t)sysconf(_SC_PAGESIZE);
+	size_t p0 = 0, p1 = 0;
+	if (pos < 0) {
+		return 1; // invalid position
+	}
+	if (nfd < 0) {
+		return 2; // file not open
+	}
+	if (nadvice == MERLIN_ADVISE_WILLNEED) {
+		p0 = (size_t)pos;
+		p1 = (size_t)pos + nbytes;
+		nerr = posix_fadvise(nfd, (off_t)p0, (off_t)(p1 - p0), POSIX_FADV_WILLNEED);
+	}
+	else if (nadvice == MERLIN_ADVISE_DONTNEED) { // pages inside the range
+		p0 = ((size_t)pos + npage - 1) & ~(npage - 1);
+		p1 = ((size_t)pos + nbytes) & ~(npage - 1);
+		if (p1 > p0) {
+			nerr = posix_fadvise(nfd, (off_t)p0, (off_t)(p1 - p0), POSIX_FADV_DONTNEED);
+		}
+	}
+	else {
+		nerr = 4; // unknown advice
+	}
+	return (nerr == 0 ? 0 : 3);
+#endif
+}
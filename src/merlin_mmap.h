@@ -0,0 +1,138 @@
+// file : "merlin_mmap.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares read-only memory mapped file access used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+
+constexpr int MERLIN_ADVISE_WILLNEED = 1; // data will be read soon, start reading ahead
+constexpr int MERLIN_ADVISE_DONTNEED = 2; // data was consumed, release it from the page cache
+
+// a single file mapped read-only to memory
+class merlin_mmap_file
+{
+public:
+	// constructor
+	merlin_mmap_file();
+	// destructor
+	~merlin_mmap_file();
+	// no copies, the object owns the mapping
+	merlin_mmap_file(const merlin_mmap_file &) = delete;
+	merlin_mmap_file & operator=(const merlin_mmap_file &) = delete;
+
+protected:
+	const char * pdata; // begin of the mapped file content
+	size_t nsize; // size of the mapped file in bytes
+#ifdef _WIN32
+	void * hfile; // file handle
+	void * hmap; // file mapping handle
+#else
+	int nfd; // file descriptor
+#endif
+
+	// member functions
+public:
+	// maps the file (str_file) read-only to memory
+	// - return value = error code (0: success)
+	int open(std::string str_file);
+
+	// unmaps the file
+	void close(void);
+
+	// returns true if a file is mapped
+	bool is_open(void);
+
+	// returns the begin of the mapped file content
+	const char * data(void);
+
+	// returns the size of the mapped file in bytes
+	size_t size(void);
+
+	// gives the operating system advice on the use of nbytes at
+	// position pos, nadvice = MERLIN_ADVISE_WILLNEED or
+	// MERLIN_ADVISE_DONTNEED (only pages fully inside the range)
+	// - return value = error code (0: success)
+	int advise(size_t pos, size_t nbytes, int nadvice);
+};
+
+
+// the sequence of merlin data files "<input-file-name><index>.mib"
+// mapped read-only to memory
+class merlin_data_map
+{
+public:
+	// constructor
+	merlin_data_map();
+	// destructor
+	~merlin_data_map();
+	// no copies, the object owns the mappings
+	merlin_data_map(const merlin_data_map &) = delete;
+	merlin_data_map & operator=(const merlin_data_map &) = delete;
+
+protected:
+	std::vector<merlin_mmap_file*> v_files; // mapped files, index 0 = first file
+
+	// member functions
+public:
+	// maps the files str_file_input + <1 ... n_files> + ".mib"
+	// - return value = error code (0: success)
+	int open(std::string str_file_input, int n_files);
+
+	// unmaps all files
+	void close(void);
+
+	// returns true if all data files are mapped
+	bool is_open(void);
+
+	// returns the number of mapped files
+	int get_num_files(void);
+
+	// returns the size of file ifile in bytes (0 if not mapped)
+	size_t get_file_size(int ifile);
+
+	// returns a pointer to nbytes of data at position pos in file ifile
+	// - returns NULL if the requested range is not in the mapped file
+	const char * get_data(int ifile, std::streampos pos, size_t nbytes);
+
+	// gives advice on the use of nbytes at position pos in file ifile
+	// (see merlin_mmap_file::advise)
+	// - return value = error code (0: success)
+	int advise(int ifile, std::streampos pos, size_t nbytes, int nadvice);
+};
+
+
+// opens the file str_file read with file streams for giving advice
+// - return value = file descriptor (-1: failure or no advice on this system)
+int merlin_file_advice_open(std::string str_file);
+
+// closes a file descriptor of merlin_file_advice_open (ignores -1)
+void merlin_file_advice_close(int nfd);
+
+// gives the operating system advice on the use of nbytes at position pos
+// of the file opened with merlin_file_advice_open as descriptor nfd, see
+// merlin_mmap_file::advise
+// - return value = error code (0: success)
+int merlin_file_advise(int nfd, __int64 pos, size_t nbytes, int nadvice);
@@ -0,0 +1,2413 @@
+// file : "merlin_ops.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the frame processing operations.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_ops.h"
+#include "merlin_decode.h"
+#include "merlin_watch.h"
+#include <chrono>
+#include <algorithm>
+#include <thread>
+
+
+// -----------------------------------------------------------------------------
+//
+// DATA I/O and detector functions
+//
+// -----------------------------------------------------------------------------
+
+
+int write_data(char* buf, size_t nbytes, std::string str_file)
+{
+	int nerr = 0;
+	std::ofstream fout;
+	fout.open(str_file, std::ios::trunc | std::ios::binary);
+	if (fout.is_open()) {
+		fout.write(buf, nbytes);
+		if (fout.fail()) {
+			std::cerr << "Error: failed to write data to file " << str_file << ".\n";
+			nerr = 2;
+		}
+		fout.close();
+	}
+	else {
+		std::cerr << "Error: failed to open output file " << str_file << ".\n";
+		nerr = 1;
+	}
+	return nerr;
+}
+
+
+int prepare_annular_detector(merlin_params * pprm, size_t nlen, double * detbuf, int * dethash, size_t * nhash, merlin_frame_hdr * pfhdr)
+{
+	size_t i = 0, j = 0;
+	double qm = 0., qx = 0., qy = 0.;
+	merlin_pix p;
+	merlin_pos q;
+	bool bhash = false;
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	if (nlen == 0) {
+		return 1; // invalid parameter 1
+	}
+	if (NULL == detbuf) {
+		return 2; // missing parameter 2
+	}
+	if (NULL == pfhdr) {
+		return 5; // missing parameter 5
+	}
+	if (dethash != NULL && nhash != NULL) {
+		*nhash = 0;
+		bhash = true;
+	}
+	for (i = 0; i < nlen; i++) { // loop through array
+		if (0 != pprm->get_frame_pixel((__int64)i, p.x, p.y)) {
+			return 10; // failed to get scan position
+		}
+		if (0 != pprm->get_calib_pos(p, &q)) {
+			return 20; // failed to get calibrated position
+		}
+		// hard mask // replace by detector transfer function later
+		qx = q.x - pprm->offset_annular.x;
+		qy = q.y - pprm->offset_annular.y;
+		qm = sqrt(qx*qx + qy*qy);
+		if (qm >= pprm->range_annular.min && qm < pprm->range_annular.max) {
+			detbuf[i] = 1.;
+			if (bhash) {
+				j = *nhash;
+				dethash[j] = (int)i;
+				*nhash = j + 1;
+			}
+		}
+		else {
+			detbuf[i] = 0.;
+		}
+	}
+	return 0;
+}
+
+int prepare_frame_coordinates(merlin_params * pprm, size_t nlen, double * x, double * y, merlin_frame_hdr * pfhdr)
+{
+	size_t i = 0;
+	merlin_pix p;
+	merlin_pos q;
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	if (nlen == 0) {
+		return 1; // invalid parameter 1
+	}
+	if (NULL == x) {
+		return 2; // missing parameter 2
+	}
+	if (NULL == y) {
+		return 3; // missing parameter 3
+	}
+	if (NULL == pfhdr) {
+		return 4; // missing parameter 4
+	}
+	for (i = 0; i < nlen; i++) { // loop through array
+		if (0 != pprm->get_frame_pixel((__int64)i, p.x, p.y)) {
+			return 10; // failed to get scan position
+		}
+		if (0 != pprm->get_calib_pos(p, &q)) {
+			return 20; // failed to get calibrated position
+		}
+		// store positions
+		x[i] = q.x;
+		y[i] = q.y;
+	}
+	return 0;
+}
+
+int sum_annular_range(size_t nlen, const double * buf, double * detbuf, int * dethash, size_t nhash, double * res)
+{
+	double lres = 0.0;
+	size_t i = 0, j=0;
+	if (NULL == buf) {
+		return 2; // invalid input pointer, parameter 2
+	}
+	if (NULL == detbuf) {
+		return 3; // invalid input pointer, parameter 3
+	}
+	if (NULL == res) {
+		return 6; // invalid input pointer, parameter 6
+	}
+	*res = 0.;
+	if (nlen > 0) {
+		if (dethash != NULL && nhash > 0) { // hash-based summation
+			for (i = 0; i < nhash; i++) {
+				j = (size_t)dethash[i];
+				lres += buf[j] * detbuf[j];
+			}
+		}
+		else { // standard summation
+			for (i = 0; i < nlen; i++) {
+				lres += buf[i] * detbuf[i];
+			}
+		}
+		*res = lres;
+	}
+	return 0;
+}
+
+int com_annular_range(size_t nlen, const double * buf, double * detbuf, double * x, double * y, int * dethash, size_t nhash, double ref0, double * resx, double * resy)
+{
+	double lresx = 0.0;
+	double lresy = 0.0;
+	size_t i = 0, j = 0;
+	if (NULL == buf) {
+		return 2; // invalid input pointer, parameter 2
+	}
+	if (NULL == detbuf) {
+		return 3; // invalid input pointer, parameter 3
+	}
+	if (NULL == x) {
+		return 4; // invalid input pointer, parameter 4
+	}
+	if (NULL == y) {
+		return 5; // invalid input pointer, parameter 5
+	}
+	if (NULL == resx) {
+		return 9; // invalid input pointer, parameter 9
+	}
+	if (NULL == resy) {
+		return 10; // invalid input pointer, parameter 10
+	}
+	*resx = 0.;
+	*resy = 0.;
+	if (nlen > 0 && ref0 > 0.) {
+		if (dethash != NULL && nhash > 0) { // hash-based summation
+			for (i = 0; i < nhash; i++) {
+				j = (size_t)dethash[i];
+				lresx += (x[j] * buf[j] * detbuf[j]);
+				lresy += (y[j] * buf[j] * detbuf[j]);
+			}
+		}
+		else { // standard summation
+			for (i = 0; i < nlen; i++) {
+				lresx += (x[i] * buf[i] * detbuf[i]);
+				lresy += (y[i] * buf[i] * detbuf[i]);
+			}
+		}
+		*resx = lresx / ref0;
+		*resy = lresy / ref0;
+	}
+	return 0;
+}
+
+int fold_annular_detector(merlin_params * pprm, size_t nlen, double * detbuf, int * dethash, size_t * nhash)
+{
+	int nerr = 0;
+	size_t i = 0, j = 0;
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	if (NULL == detbuf) {
+		return 3; // invalid input pointer, parameter 3
+	}
+	nerr = pprm->fold_corrections(detbuf);
+	if (nerr != 0) {
+		return 10 + nerr; // failed to fold corrections
+	}
+	if (dethash != NULL && nhash != NULL) { // pixels may have been added or removed
+		for (i = 0; i < nlen; i++) {
+			if (detbuf[i] != 0.) {
+				dethash[j] = (int)i;
+				j++;
+			}
+		}
+		*nhash = j;
+	}
+	return 0;
+}
+
+int prepare_detector_spans(size_t nlen, size_t nrow, const double * detbuf, std::vector<size_t> & v_span)
+{
+	size_t i = 0, i0 = 0;
+	bool bin = false; // inside a span
+	if (NULL == detbuf) {
+		return 3; // invalid input pointer, parameter 3
+	}
+	if (nrow == 0) {
+		return 2; // invalid parameter 2
+	}
+	v_span.clear();
+	for (i = 0; i < nlen; i++) {
+		if (bin && (detbuf[i] == 0. || i % nrow == 0)) { // span ends at zero weights and at row ends
+			v_span.push_back(i0);
+			v_span.push_back(i);
+			bin = false;
+		}
+		if (!bin && detbuf[i] != 0.) {
+			i0 = i;
+			bin = true;
+		}
+	}
+	if (bin) {
+		v_span.push_back(i0);
+		v_span.push_back(nlen);
+	}
+	return 0;
+}
+
+// checks the parameters required by operations on an annular range
+// - return value = error code (0: success)
+static int check_annular_range(merlin_params * pprm, size_t frm_pix)
+{
+	int nerr = 0;
+	if (frm_pix == 0) {
+		std::cerr << "Error: insuffient number of frame pixels.\n";
+		nerr = 1;
+	}
+	if (pprm->hdr.n_frames <= 0) {
+		std::cerr << "Error: insuffient number of frames.\n";
+		nerr = 2;
+	}
+	if (pprm->range_annular.max <= pprm->range_annular.min) {
+		std::cerr << "Error: invalid annular range (" << pprm->range_annular.min << "," << pprm->range_annular.max << ").\n";
+		nerr = 3;
+	}
+	return nerr;
+}
+
+// writes the text output common to all scan roi result files
+static void report_scan_output(merlin_params * pprm)
+{
+	std::cout << "  data type: floating point, 64 bit\n";
+	std::cout << "  scan sampling: " << 1 + pprm->scan_rect_roi.x1 - pprm->scan_rect_roi.x0 << " x " << 1 + pprm->scan_rect_roi.y1 - pprm->scan_rect_roi.y0 << " scan points\n";
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_operation
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_operation::merlin_operation()
+{
+	pprm = NULL;
+	bcorrected = true;
+	braw = false;
+	frm_pix = 0;
+	n_items = 0;
+	n_frames = 0;
+	nthreads = 1;
+}
+
+merlin_operation::~merlin_operation()
+{
+}
+
+const std::string & merlin_operation::get_command(void) const
+{
+	return str_cmd;
+}
+
+const std::string & merlin_operation::get_message(void) const
+{
+	return str_msg;
+}
+
+bool merlin_operation::uses_corrected_frames(void) const
+{
+	return bcorrected;
+}
+
+bool merlin_operation::uses_raw_frames(void) const
+{
+	return braw;
+}
+
+int merlin_operation::process_raw(int /*ithread*/, const merlin_frame_item & /*item*/, const char * /*pdata*/)
+{
+	return 1; // not supported by the operation
+}
+
+int merlin_operation::publish(merlin_engine & /*eng*/, size_t /*n_frames_done*/)
+{
+	return 0; // no intermediate results
+}
+
+void merlin_operation::truncate(size_t n_frames_done)
+{
+	if (n_frames_done < n_frames) {
+		n_frames = n_frames_done;
+	}
+}
+
+int merlin_operation::init(merlin_params * pprm_in)
+{
+	if (NULL == pprm_in) {
+		return 100; // missing parameters
+	}
+	pprm = pprm_in;
+	str_file_output = pprm->str_file_output;
+	frm_pix = (size_t)pprm->hdr_frm.n_columns * pprm->hdr_frm.n_rows;
+	return 0;
+}
+
+int merlin_operation::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	n_items = n_items_in;
+	n_frames = n_frames_in;
+	nthreads = (nthreads_in > 1 ? nthreads_in : 1);
+	return 0;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_op_average
+//
+// -----------------------------------------------------------------------------
+
+
+// adds the 128-bit numbers (bhi, blo) to (hi, lo)
+static inline void u128_add(unsigned __int64 & hi, unsigned __int64 & lo, unsigned __int64 bhi, unsigned __int64 blo)
+{
+	lo += blo;
+	hi += bhi + (lo < blo ? 1 : 0);
+}
+
+// subtracts the 128-bit numbers (bhi, blo) from (hi, lo)
+static inline void u128_sub(unsigned __int64 & hi, unsigned __int64 & lo, unsigned __int64 bhi, unsigned __int64 blo)
+{
+	hi -= bhi + (lo < blo ? 1 : 0);
+	lo -= blo;
+}
+
+// multiplies a and b to the 128-bit number (hi, lo)
+static inline void u128_mul(unsigned __int64 a, unsigned __int64 b, unsigned __int64 & hi, unsigned __int64 & lo)
+{
+	unsigned __int64 a0 = a & 0xFFFFFFFF, a1 = a >> 32, b0 = b & 0xFFFFFFFF, b1 = b >> 32;
+	unsigned __int64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	unsigned __int64 mid = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+	lo = (mid << 32) | (p00 & 0xFFFFFFFF);
+	hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+// returns the 128-bit number (hi, lo) as floating point value
+static inline double u128_double(unsigned __int64 hi, unsigned __int64 lo)
+{
+	return (double)hi * 18446744073709551616. + (double)lo;
+}
+
+int integer_moment_words(merlin_params * pprm, size_t n)
+{
+	unsigned __int64 vmax = 0xFFFFFFFF; // max. value of a pixel
+	if (pprm->hdr_frm.n_bpi == 8) vmax = 0xFF;
+	if (pprm->hdr_frm.n_bpi == 16) vmax = 0xFFFF;
+	if ((unsigned __int64)n <= ~(unsigned __int64)0 / (vmax * vmax)) {
+		return 1;
+	}
+	return 2;
+}
+
+void add_integer_moments(size_t nlen, int nw, unsigned __int64 * isum, unsigned __int64 * isqr, const double * buf)
+{
+	size_t i = 0;
+	unsigned __int64 u = 0, u2 = 0;
+	if (nw == 1) {
+		for (i = 0; i < nlen; i++) {
+			u = (unsigned __int64)buf[i];
+			isum[i] += u; // accumulate values
+			isqr[i] += u * u; // accumulate squares
+		}
+		return;
+	}
+	for (i = 0; i < nlen; i++) { // low and high words
+		u = (unsigned __int64)buf[i];
+		u2 = u * u;
+		isum[2 * i] += u;
+		isum[2 * i + 1] += (isum[2 * i] < u ? 1 : 0);
+		isqr[2 * i] += u2;
+		isqr[2 * i + 1] += (isqr[2 * i] < u2 ? 1 : 0);
+	}
+}
+
+void merge_integer_moments(size_t nlen, int nw, unsigned __int64 * isum_a, unsigned __int64 * isqr_a, const unsigned __int64 * isum_b, const unsigned __int64 * isqr_b)
+{
+	size_t i = 0;
+	if (nw == 1) {
+		for (i = 0; i < nlen; i++) {
+			isum_a[i] += isum_b[i];
+			isqr_a[i] += isqr_b[i];
+		}
+		return;
+	}
+	for (i = 0; i < nlen; i++) {
+		u128_add(isum_a[2 * i + 1], isum_a[2 * i], isum_b[2 * i + 1], isum_b[2 * i]);
+		u128_add(isqr_a[2 * i + 1], isqr_a[2 * i], isqr_b[2 * i + 1], isqr_b[2 * i]);
+	}
+}
+
+void integer_moments(unsigned __int64 n, unsigned __int64 shi, unsigned __int64 slo, unsigned __int64 qhi, unsigned __int64 qlo, double & mean, double & var)
+{
+	unsigned __int64 q = 0, r = 0, phi = 0, plo = 0, dhi = 0, dlo = 0;
+	mean = 0.;
+	var = 0.;
+	if (n == 0) return;
+	mean = u128_double(shi, slo) / (double)n;
+	// sum of squared deviations (qhi, qlo) - s^2 / n with s = q * n + r,
+	// the integer part is exact, q is the integer mean below 2^32
+	q = (unsigned __int64)mean;
+	u128_mul(q, n, phi, plo);
+	while (phi > shi || (phi == shi && plo > slo)) { // rounding of the mean
+		q--;
+		u128_sub(phi, plo, 0, n);
+	}
+	dhi = shi;
+	dlo = slo;
+	u128_sub(dhi, dlo, phi, plo);
+	while (dhi > 0 || dlo >= n) {
+		q++;
+		u128_sub(dhi, dlo, 0, n);
+	}
+	r = dlo;
+	u128_mul(q * q, n, phi, plo);
+	u128_sub(qhi, qlo, phi, plo);
+	u128_mul(2 * q, r, phi, plo);
+	u128_sub(qhi, qlo, phi, plo);
+	var = (u128_double(qhi, qlo) - (double)r * (double)r / (double)n) / (double)n;
+}
+
+int correct_moments(merlin_params * pprm, size_t nlen, double * meanbuf, double * varbuf)
+{
+	int nerr = 0;
+	size_t i_pix = 0; // pixel index
+	if (NULL == pprm || NULL == meanbuf || NULL == varbuf) {
+		return 100; // missing parameters or buffers
+	}
+	nerr = pprm->gain_correction(meanbuf); // apply gain correction if present
+	if (nerr != 0) { // gain correction failed
+		std::cerr << "Error: gain correction failed on accumulated data (code " << nerr << ").\n";
+		return 110;
+	}
+	nerr = pprm->defect_correction(meanbuf); // apply defect pixel correction if present
+	if (nerr != 0) { // defect correction failed
+		std::cerr << "Error: defect correction failed on accumulated data (code " << nerr << ").\n";
+		return 111;
+	}
+	nerr = pprm->gain_correction(varbuf); // apply gain correction twice to the variance
+	nerr = pprm->gain_correction(varbuf); // ...
+	for (i_pix = 0; i_pix < nlen; i_pix++) {
+		varbuf[i_pix] = sqrt(varbuf[i_pix]); // calculate std. deviation
+	}
+	return pprm->defect_correction(varbuf); // apply defect pixel correction on the devation image
+}
+
+merlin_op_average::merlin_op_average()
+{
+	str_cmd = "average_frames";
+	str_msg = "averaging frames";
+	bcorrected = false; // corrections are applied to the accumulated data
+	nw = 1;
+}
+
+merlin_op_average::~merlin_op_average()
+{
+	free_buffers();
+}
+
+void merlin_op_average::free_buffers(void)
+{
+	size_t i = 0;
+	for (i = 0; i < v_isumbuf.size(); i++) {
+		if (v_isumbuf[i]) free(v_isumbuf[i]);
+	}
+	for (i = 0; i < v_isqrbuf.size(); i++) {
+		if (v_isqrbuf[i]) free(v_isqrbuf[i]);
+	}
+	v_isumbuf.clear();
+	v_isqrbuf.clear();
+}
+
+int merlin_op_average::init(merlin_params * pprm_in)
+{
+	int nerr = merlin_operation::init(pprm_in);
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (frm_pix == 0) {
+		std::cerr << "Error: insuffient number of frame pixels.\n";
+		return 1;
+	}
+	if (pprm->hdr.n_frames <= 0) {
+		std::cerr << "Error: insuffient number of frames.\n";
+		return 2;
+	}
+	return 0;
+}
+
+int merlin_op_average::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	int ithread = 0;
+	merlin_operation::begin(n_items_in, n_frames_in, nthreads_in);
+	free_buffers();
+	// 64-bit accumulation if n_frames squares of the largest value fit,
+	// raw 8- and 16-bit data is then accumulated without decoding
+	nw = integer_moment_words(pprm, n_frames);
+	braw = (nw == 1 && (pprm->hdr_frm.n_bpi == 8 || pprm->hdr_frm.n_bpi == 16));
+	if (pprm->btalk && pprm->ndebug > 0) {
+		std::cout << "- averaging " << (int)pprm->hdr_frm.n_bpi << "-bit data with " << 64 * nw << "-bit integer accumulation.\n";
+	}
+	for (ithread = 0; ithread < nthreads; ithread++) { // per-thread accumulators
+		v_isumbuf.push_back((unsigned __int64*)calloc(frm_pix * nw, sizeof(unsigned __int64)));
+		v_isqrbuf.push_back((unsigned __int64*)calloc(frm_pix * nw, sizeof(unsigned __int64)));
+		if (NULL == v_isumbuf[ithread] || NULL == v_isqrbuf[ithread]) {
+			std::cerr << "Error: failed to allocate accumulation buffers.\n";
+			return 101;
+		}
+	}
+	return 0;
+}
+
+int merlin_op_average::process_frame(int ithread, const merlin_frame_item & /*item*/, const double * buf)
+{
+	add_integer_moments(frm_pix, nw, v_isumbuf[ithread], v_isqrbuf[ithread], buf); // decoded values are exact integers
+	return 0;
+}
+
+int merlin_op_average::process_raw(int ithread, const merlin_frame_item & /*item*/, const char * pdata)
+{
+	if (nw != 1) {
+		return 1; // raw data is only accumulated in 64-bit integers
+	}
+	switch (pprm->hdr_frm.n_bpi) {
+	case 8:
+		merlin_accumulate_u8(v_isumbuf[ithread], v_isqrbuf[ithread], (const unsigned char*)pdata, frm_pix);
+		break;
+	case 16:
+		merlin_accumulate_u16(v_isumbuf[ithread], v_isqrbuf[ithread], (const unsigned char*)pdata, frm_pix, pprm->swapbytes);
+		break;
+	default:
+		return 200; // unsupported data type
+	}
+	return 0;
+}
+
+void merlin_op_average::reduce(merlin_engine & eng, size_t nres, double * resbuf, double * devbuf)
+{
+	eng.parallel_for(frm_pix, [&](size_t i0, size_t i1) {
+		size_t i = 0;
+		size_t ith = 0;
+		unsigned __int64 shi = 0, slo = 0, qhi = 0, qlo = 0;
+		if (nres == 0) return;
+		for (i = i0; i < i1; i++) { // exact integer sums, converted once
+			shi = 0; slo = 0; qhi = 0; qlo = 0;
+			for (ith = 0; ith < v_isumbuf.size(); ith++) {
+				if (nw == 1) {
+					u128_add(shi, slo, 0, v_isumbuf[ith][i]);
+					u128_add(qhi, qlo, 0, v_isqrbuf[ith][i]);
+				}
+				else {
+					u128_add(shi, slo, v_isumbuf[ith][2 * i + 1], v_isumbuf[ith][2 * i]);
+					u128_add(qhi, qlo, v_isqrbuf[ith][2 * i + 1], v_isqrbuf[ith][2 * i]);
+				}
+			}
+			integer_moments((unsigned __int64)nres, shi, slo, qhi, qlo, resbuf[i], devbuf[i]);
+		}
+	});
+}
+
+int merlin_op_average::write_results(size_t nres, double * resbuf, double * devbuf, bool btell)
+{
+	int nerr = 0;
+	std::string str_file; // file name
+	if (nres > 0) { // apply corrections to mean and variance (otherwise we have 0 in the result)
+		nerr = correct_moments(pprm, frm_pix, resbuf, devbuf);
+		if (nerr != 0) {
+			return nerr; // stop working
+		}
+		if (pprm->ndebug > 0 && btell) {
+			std::cout << "- calculated average and standard deviation of " << nres << " frames.\n";
+		}
+	}
+	else {
+		std::cerr << "Error: averaging over zero frames.\n";
+		return 110;
+	}
+	str_file = str_file_output + "_avg.dat";
+	if (0 == write_data((char*)resbuf, sizeof(double)*frm_pix, str_file)) {
+		if (btell) {
+			std::cout << "- written average frame to file " << str_file << ".\n";
+			std::cout << "  data type: floating point, 64 bit\n";
+			std::cout << "  sampling: " << pprm->hdr_frm.n_columns << " x " << pprm->hdr_frm.n_rows << " scan points\n";
+		}
+	}
+	else {
+		nerr = 200;
+	}
+	str_file = str_file_output + "_sdev.dat";
+	if (0 == write_data((char*)devbuf, sizeof(double)*frm_pix, str_file)) {
+		if (btell) {
+			std::cout << "- written standard deviation frame to file " << str_file << ".\n";
+			std::cout << "  data type: floating point, 64 bit\n";
+			std::cout << "  sampling: " << pprm->hdr_frm.n_columns << " x " << pprm->hdr_frm.n_rows << " scan points\n";
+		}
+	}
+	else {
+		nerr = 210;
+	}
+	return nerr;
+}
+
+int merlin_op_average::publish(merlin_engine & eng, size_t n_frames_done)
+{
+	int nerr = 0;
+	double * resbuf = NULL; // result buffer
+	double * devbuf = NULL; // deviation buffer
+	if (n_frames_done == 0) {
+		return 0; // nothing to publish
+	}
+	resbuf = (double*)calloc(frm_pix, sizeof(double));
+	devbuf = (double*)calloc(frm_pix, sizeof(double));
+	if (NULL == resbuf || NULL == devbuf) {
+		std::cerr << "Error: failed to allocate result buffers.\n";
+		nerr = 101;
+		goto _cancel_point;
+	}
+	reduce(eng, n_frames_done, resbuf, devbuf);
+	nerr = write_results(n_frames_done, resbuf, devbuf, false);
+_cancel_point:
+	if (resbuf) free(resbuf);
+	if (devbuf) free(devbuf);
+	return nerr;
+}
+
+int merlin_op_average::finish(merlin_engine & eng)
+{
+	int nerr = 0;
+	size_t nres = n_frames; // number of averaged frames
+	double * resbuf = NULL; // result buffer
+	double * devbuf = NULL; // deviation buffer
+	resbuf = (double*)calloc(frm_pix, sizeof(double));
+	devbuf = (double*)calloc(frm_pix, sizeof(double));
+	if (NULL == resbuf || NULL == devbuf) {
+		std::cerr << "Error: failed to allocate result buffers.\n";
+		nerr = 101;
+		goto _cancel_point;
+	}
+	// reduce the per-thread accumulators to the mean (resbuf) and the
+	// variance (devbuf)
+	reduce(eng, nres, resbuf, devbuf);
+	free_buffers();
+	nerr = write_results(nres, resbuf, devbuf, pprm->btalk);
+_cancel_point:
+	if (resbuf) free(resbuf);
+	if (devbuf) free(devbuf);
+	return nerr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_op_tiles
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_op_tiles::merlin_op_tiles()
+{
+	str_cmd = "average_tiles";
+	str_msg = "averaging frames of scan tiles";
+	bcorrected = false; // corrections are applied to the accumulated data
+	nw = 1;
+	nslot = 2;
+	bgrid = false;
+	grid_ntx = 0;
+	row_y0 = 0;
+	batch_t0 = 0;
+	batch_t1 = 0;
+	batch_size = 0;
+}
+
+merlin_op_tiles::~merlin_op_tiles()
+{
+	free_buffers();
+}
+
+void merlin_op_tiles::free_buffers(void)
+{
+	size_t i = 0;
+	for (i = 0; i < v_isumbuf.size(); i++) {
+		if (v_isumbuf[i]) free(v_isumbuf[i]);
+	}
+	for (i = 0; i < v_isqrbuf.size(); i++) {
+		if (v_isqrbuf[i]) free(v_isqrbuf[i]);
+	}
+	for (i = 0; i < v_slot.size(); i++) {
+		if (v_slot[i].isumbuf) free(v_slot[i].isumbuf);
+		if (v_slot[i].isqrbuf) free(v_slot[i].isqrbuf);
+	}
+	if (fout_avg.is_open()) fout_avg.close();
+	if (fout_sdev.is_open()) fout_sdev.close();
+	v_total.clear();
+	v_count.clear();
+	v_isumbuf.clear();
+	v_isqrbuf.clear();
+	std::vector<std::mutex>().swap(v_lock);
+	v_slot.clear();
+	v_thr_nuse.clear();
+	v_thr_tiles.clear();
+}
+
+int merlin_op_tiles::init(merlin_params * pprm_in)
+{
+	int nerr = merlin_operation::init(pprm_in);
+	int itile = 0, ntiles = 0, y = 0, y0 = 0, y1 = 0;
+	std::vector<size_t> v_fill; // next free entry of each row
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (frm_pix == 0) {
+		std::cerr << "Error: insuffient number of frame pixels.\n";
+		return 1;
+	}
+	if (pprm->hdr.n_frames <= 0) {
+		std::cerr << "Error: insuffient number of frames.\n";
+		return 2;
+	}
+	if (0 != pprm->get_scan_tiles(v_tile)) {
+		std::cerr << "Error: no scan tiles set (see set_scan_tiles and set_scan_tile_list).\n";
+		return 3;
+	}
+	ntiles = (int)v_tile.size();
+	bgrid = (pprm->scan_tile_size.x >= 1 && pprm->scan_tile_size.y >= 1);
+	v_row_ofs.clear();
+	v_row_tile.clear();
+	if (bgrid) { // tiles of a grid row by row, see merlin_params::get_scan_tiles
+		grid_size = pprm->scan_tile_size;
+		grid_roi.x0 = v_tile[0].x0;
+		grid_roi.y0 = v_tile[0].y0;
+		grid_roi.x1 = v_tile[ntiles - 1].x1;
+		grid_roi.y1 = v_tile[ntiles - 1].y1;
+		grid_ntx = (grid_roi.x1 - grid_roi.x0) / grid_size.x + 1;
+		return 0;
+	}
+	// tile list: tiles touching each scan row, limited to the scan rows
+	row_y0 = pprm->hdr.n_rows;
+	y1 = -1;
+	for (itile = 0; itile < ntiles; itile++) {
+		row_y0 = std::min(row_y0, std::max(v_tile[itile].y0, 0));
+		y1 = std::max(y1, std::min(v_tile[itile].y1, pprm->hdr.n_rows - 1));
+	}
+	if (y1 < row_y0) {
+		return 0; // no tile in the scan
+	}
+	v_row_ofs.assign((size_t)(y1 - row_y0 + 2), 0);
+	for (itile = 0; itile < ntiles; itile++) { // count the tiles of each row
+		y0 = std::max(v_tile[itile].y0, row_y0);
+		for (y = y0; y <= std::min(v_tile[itile].y1, y1); y++) {
+			v_row_ofs[(size_t)(y - row_y0) + 1]++;
+		}
+	}
+	for (y = row_y0; y <= y1; y++) {
+		v_row_ofs[(size_t)(y - row_y0) + 1] += v_row_ofs[(size_t)(y - row_y0)];
+	}
+	v_row_tile.resize(v_row_ofs.back());
+	v_fill.assign(v_row_ofs.begin(), v_row_ofs.end() - 1);
+	for (itile = 0; itile < ntiles; itile++) { // tiles of each row in list order
+		y0 = std::max(v_tile[itile].y0, row_y0);
+		for (y = y0; y <= std::min(v_tile[itile].y1, y1); y++) {
+			v_row_tile[v_fill[(size_t)(y - row_y0)]++] = itile;
+		}
+	}
+	return 0;
+}
+
+void merlin_op_tiles::get_tiles(const merlin_pix & pos, std::vector<int> & v_idx)
+{
+	size_t i = 0, irow = 0;
+	int itile = 0;
+	v_idx.clear();
+	if (bgrid) { // one tile of the grid
+		if (pos.x >= grid_roi.x0 && pos.x <= grid_roi.x1 && pos.y >= grid_roi.y0 && pos.y <= grid_roi.y1) {
+			v_idx.push_back((pos.y - grid_roi.y0) / grid_size.y * grid_ntx + (pos.x - grid_roi.x0) / grid_size.x);
+		}
+		return;
+	}
+	if (pos.y < row_y0 || (size_t)(pos.y - row_y0) + 1 >= v_row_ofs.size()) {
+		return; // row without tiles
+	}
+	irow = (size_t)(pos.y - row_y0);
+	for (i = v_row_ofs[irow]; i < v_row_ofs[irow + 1]; i++) { // tiles of the row may overlap
+		itile = v_row_tile[i];
+		if (pos.x >= v_tile[itile].x0 && pos.x <= v_tile[itile].x1) {
+			v_idx.push_back(itile);
+		}
+	}
+}
+
+int merlin_op_tiles::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	int nerr = 0, itile = 0;
+	size_t i = 0, j = 0, nmax = 0, nidx = 0;
+	size_t ntiles = v_tile.size();
+	size_t ntile_bytes = 0, nslot_bytes = 0; // bytes of the accumulation buffers of a tile and of all slots
+	std::streamoff nbytes = (std::streamoff)(sizeof(double) * frm_pix * ntiles);
+	std::vector<merlin_frame_item> v_items; // frames of the pass
+	std::vector<int> v_idx; // tiles of a frame
+	std::string str_file; // file name
+	merlin_pix pos;
+	merlin_operation::begin(n_items_in, n_frames_in, nthreads_in);
+	free_buffers();
+	// number of frames of each tile, a tile is complete when all are added
+	v_total.assign(ntiles, 0);
+	nerr = pprm->get_scan_roi_frames(v_items);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to determine frames in the scan roi (code " << nerr << ").\n";
+		return 100;
+	}
+	for (i = 0; i < v_items.size(); i++) {
+		if (0 != pprm->get_scan_pixel(v_items[i].idx, pos.x, pos.y)) {
+			return 1; // failed to determine the scan position
+		}
+		get_tiles(pos, v_idx);
+		for (j = 0; j < v_idx.size(); j++) {
+			itile = v_idx[j];
+			v_total[itile]++;
+			nmax = std::max(nmax, v_total[itile]);
+		}
+		nidx = std::max(nidx, v_idx.size());
+	}
+	nw = integer_moment_words(pprm, nmax);
+	// a slot for each tile of a frame and one for the next tile along the scan
+	nslot = (int)std::max(nidx + 1, (size_t)2);
+	// tiles per batch in the remaining memory, all tiles in one pass
+	// when the frames cannot be read again
+	ntile_bytes = frm_pix * 2 * nw * sizeof(unsigned __int64);
+	nslot_bytes = (size_t)nthreads * nslot * ntile_bytes;
+	batch_size = ntiles;
+	if (!pprm->blive && !pprm->stream.is_open()) {
+		batch_size = (pprm->ntilememory > nslot_bytes ? (pprm->ntilememory - nslot_bytes) / ntile_bytes : 0);
+		batch_size = std::min(std::max(batch_size, (size_t)1), ntiles);
+	}
+	batch_t0 = 0;
+	batch_t1 = batch_size;
+	if (pprm->btalk && pprm->ndebug > 0) {
+		std::cout << "- averaging " << ntiles << " scan tiles in batches of " << batch_size << " tiles with " << (double)(nslot_bytes + batch_size * ntile_bytes) / 1048576. << " MB of accumulation buffers.\n";
+	}
+	v_count.assign(ntiles, 0);
+	v_isumbuf.assign(ntiles, NULL); // allocated when a thread drops its first sums of a tile
+	v_isqrbuf.assign(ntiles, NULL);
+	std::vector<std::mutex>(ntiles).swap(v_lock);
+	v_slot.resize((size_t)nthreads * nslot);
+	v_thr_nuse.assign(nthreads, 0);
+	v_thr_tiles.resize(nthreads);
+	// stacked output files, tiles are written when complete, empty tiles stay zero
+	str_file = str_file_output + "_avg.dat";
+	fout_avg.open(str_file, std::ios::trunc | std::ios::binary);
+	if (!fout_avg.is_open()) {
+		std::cerr << "Error: failed to open output file " << str_file << ".\n";
+		return 200;
+	}
+	str_file = str_file_output + "_sdev.dat";
+	fout_sdev.open(str_file, std::ios::trunc | std::ios::binary);
+	if (!fout_sdev.is_open()) {
+		std::cerr << "Error: failed to open output file " << str_file << ".\n";
+		return 210;
+	}
+	if (nbytes > 0) {
+		fout_avg.seekp(nbytes - 1);
+		fout_avg.put(0);
+		fout_sdev.seekp(nbytes - 1);
+		fout_sdev.put(0);
+	}
+	if (fout_avg.fail() || fout_sdev.fail()) {
+		std::cerr << "Error: failed to write data to file " << str_file_output << "_avg.dat or _sdev.dat.\n";
+		return 200;
+	}
+	return 0;
+}
+
+int merlin_op_tiles::write_tile(int itile)
+{
+	int nerr = 0;
+	size_t i = 0;
+	std::streamoff ofs = (std::streamoff)(sizeof(double) * frm_pix * (size_t)itile);
+	double * resbuf = (double*)calloc(frm_pix, sizeof(double)); // average frame
+	double * devbuf = (double*)calloc(frm_pix, sizeof(double)); // standard deviation frame
+	if (NULL == resbuf || NULL == devbuf) {
+		std::cerr << "Error: failed to allocate result buffers.\n";
+		nerr = 101;
+		goto _cancel_point;
+	}
+	for (i = 0; i < frm_pix; i++) {
+		if (nw == 1) {
+			integer_moments((unsigned __int64)v_count[itile], 0, v_isumbuf[itile][i], 0, v_isqrbuf[itile][i], resbuf[i], devbuf[i]);
+		}
+		else {
+			integer_moments((unsigned __int64)v_count[itile], v_isumbuf[itile][2 * i + 1], v_isumbuf[itile][2 * i], v_isqrbuf[itile][2 * i + 1], v_isqrbuf[itile][2 * i], resbuf[i], devbuf[i]);
+		}
+	}
+	nerr = correct_moments(pprm, frm_pix, resbuf, devbuf);
+	if (nerr != 0) {
+		goto _cancel_point;
+	}
+	{
+		std::lock_guard<std::mutex> lock(lock_out);
+		fout_avg.seekp(ofs);
+		fout_avg.write((char*)resbuf, sizeof(double) * frm_pix);
+		if (fout_avg.fail()) {
+			std::cerr << "Error: failed to write data to file " << str_file_output << "_avg.dat.\n";
+			nerr = 200;
+			goto _cancel_point;
+		}
+		fout_sdev.seekp(ofs);
+		fout_sdev.write((char*)devbuf, sizeof(double) * frm_pix);
+		if (fout_sdev.fail()) {
+			std::cerr << "Error: failed to write data to file " << str_file_output << "_sdev.dat.\n";
+			nerr = 210;
+			goto _cancel_point;
+		}
+	}
+_cancel_point:
+	free(v_isumbuf[itile]); // release the tile
+	free(v_isqrbuf[itile]);
+	v_isumbuf[itile] = NULL;
+	v_isqrbuf[itile] = NULL;
+	if (resbuf) free(resbuf);
+	if (devbuf) free(devbuf);
+	return nerr;
+}
+
+int merlin_op_tiles::drop_slot(merlin_tile_slot & slot)
+{
+	int nerr = 0;
+	int itile = slot.itile;
+	if (itile >= 0 && slot.count > 0) {
+		std::lock_guard<std::mutex> lock(v_lock[itile]);
+		if (NULL == v_isumbuf[itile]) { // first sums of the tile, hand over the slot buffers
+			v_isumbuf[itile] = slot.isumbuf;
+			v_isqrbuf[itile] = slot.isqrbuf;
+			slot.isumbuf = NULL;
+			slot.isqrbuf = NULL;
+		}
+		else {
+			merge_integer_moments(frm_pix, nw, v_isumbuf[itile], v_isqrbuf[itile], slot.isumbuf, slot.isqrbuf);
+		}
+		v_count[itile] += slot.count;
+		if (v_count[itile] == v_total[itile]) { // all frames added
+			nerr = write_tile(itile);
+		}
+	}
+	slot.itile = -1;
+	slot.count = 0;
+	return nerr;
+}
+
+int merlin_op_tiles::add_frame(int ithread, int itile, const double * buf)
+{
+	int nerr = 0, islot = 0, iuse = 0;
+	merlin_tile_slot * pslot = &v_slot[(size_t)ithread * nslot]; // slots of the thread
+	merlin_tile_slot * ps = NULL; // slot receiving the frame
+	for (islot = 0; islot < nslot; islot++) { // slot of the tile or least recently used slot
+		if (pslot[islot].itile == itile) {
+			iuse = islot;
+			break;
+		}
+		if (pslot[islot].nuse < pslot[iuse].nuse) iuse = islot;
+	}
+	ps = pslot + iuse;
+	if (ps->itile != itile) { // start sums of another tile in this slot
+		nerr = drop_slot(*ps);
+		if (nerr != 0) {
+			return nerr;
+		}
+		if (NULL == ps->isumbuf) {
+			ps->isumbuf = (unsigned __int64*)calloc(frm_pix * nw, sizeof(unsigned __int64));
+			ps->isqrbuf = (unsigned __int64*)calloc(frm_pix * nw, sizeof(unsigned __int64));
+			if (NULL == ps->isumbuf || NULL == ps->isqrbuf) {
+				std::cerr << "Error: failed to allocate accumulation buffers.\n";
+				return 101;
+			}
+		}
+		else {
+			memset(ps->isumbuf, 0, sizeof(unsigned __int64) * frm_pix * nw);
+			memset(ps->isqrbuf, 0, sizeof(unsigned __int64) * frm_pix * nw);
+		}
+		ps->itile = itile;
+	}
+	ps->nuse = ++v_thr_nuse[ithread];
+	ps->count++;
+	add_integer_moments(frm_pix, nw, ps->isumbuf, ps->isqrbuf, buf);
+	return 0;
+}
+
+int merlin_op_tiles::process_frame(int ithread, const merlin_frame_item & item, const double * buf)
+{
+	int nerr = 0;
+	size_t i = 0;
+	merlin_pix pos;
+	std::vector<int> & v_idx = v_thr_tiles[ithread];
+	if (0 != pprm->get_scan_pixel(item.idx, pos.x, pos.y)) {
+		return 1; // failed to determine the scan position
+	}
+	get_tiles(pos, v_idx);
+	for (i = 0; i < v_idx.size(); i++) { // frames may belong to several tiles
+		if ((size_t)v_idx[i] < batch_t0 || (size_t)v_idx[i] >= batch_t1) continue; // tile of another batch
+		nerr = add_frame(ithread, v_idx[i], buf);
+		if (nerr != 0) {
+			return nerr;
+		}
+	}
+	return 0;
+}
+
+int merlin_op_tiles::finish_batch(void)
+{
+	int nerr = 0, nerr_tile = 0;
+	size_t i = 0, itile = 0;
+	for (i = 0; i < v_slot.size(); i++) { // add the remaining sums of all threads
+		nerr_tile = drop_slot(v_slot[i]);
+		if (nerr == 0) nerr = nerr_tile;
+	}
+	for (itile = batch_t0; itile < batch_t1; itile++) {
+		if (v_isumbuf[itile]) { // incomplete tile of a pass stopped early
+			nerr_tile = write_tile((int)itile);
+			if (nerr == 0) nerr = nerr_tile;
+		}
+	}
+	return nerr;
+}
+
+int merlin_op_tiles::finish(merlin_engine & eng)
+{
+	int nerr = 0;
+	size_t itile = 0, i = 0, j = 0, nempty = 0;
+	size_t ntiles = v_tile.size();
+	std::vector<merlin_frame_item> v_items; // frames in the scan roi
+	std::vector<merlin_frame_item> v_part; // frames of the current batch
+	std::vector<int> v_idx; // tiles of a frame
+	merlin_pix pos;
+	std::string str_file; // file name
+	std::ofstream fout;
+	nerr = finish_batch(); // first batch from the pass of the operation
+	if (nerr != 0) {
+		goto _cancel_point; // stop working
+	}
+	if (batch_t1 < ntiles) {
+		nerr = pprm->get_scan_roi_frames(v_items);
+		if (nerr != 0) {
+			std::cerr << "Error: failed to determine frames in the scan roi (code " << nerr << ").\n";
+			nerr = 100;
+			goto _cancel_point;
+		}
+	}
+	while (batch_t1 < ntiles) { // further batches, each in its own pass
+		batch_t0 = batch_t1;
+		batch_t1 = std::min(batch_t0 + batch_size, ntiles);
+		v_part.clear();
+		for (i = 0; i < v_items.size(); i++) {
+			if (0 != pprm->get_scan_pixel(v_items[i].idx, pos.x, pos.y)) {
+				nerr = 1; // failed to determine the scan position
+				goto _cancel_point;
+			}
+			get_tiles(pos, v_idx);
+			for (j = 0; j < v_idx.size(); j++) {
+				if ((size_t)v_idx[j] >= batch_t0 && (size_t)v_idx[j] < batch_t1) {
+					v_part.push_back(v_items[i]);
+					break;
+				}
+			}
+		}
+		if (pprm->btalk) {
+			std::cout << "- averaging frames of scan tiles " << batch_t0 << " to " << batch_t1 - 1 << " ...\n";
+		}
+		nerr = eng.run(&v_part, [&](int ithread, const merlin_frame_item & item, double * buf) -> int {
+			return process_frame(ithread, item, buf);
+		});
+		if (nerr != 0) {
+			goto _cancel_point;
+		}
+		nerr = finish_batch();
+		if (nerr != 0) {
+			goto _cancel_point;
+		}
+	}
+	fout_avg.close();
+	fout_sdev.close();
+	for (itile = 0; itile < ntiles; itile++) {
+		if (v_count[itile] == 0) { // no frames, zero result
+			nempty++;
+		}
+	}
+	if (nempty > 0) {
+		std::cerr << "Warning: " << nempty << " scan tiles contain no frames of the scan roi.\n";
+	}
+	if (pprm->ndebug > 0 && pprm->btalk) {
+		std::cout << "- calculated average and standard deviation of " << ntiles << " scan tiles.\n";
+	}
+	if (pprm->btalk) {
+		std::cout << "- written average frames of " << ntiles << " scan tiles to file " << str_file_output << "_avg.dat.\n";
+		std::cout << "  data type: floating point, 64 bit\n";
+		std::cout << "  sampling: " << pprm->hdr_frm.n_columns << " x " << pprm->hdr_frm.n_rows << " x " << ntiles << " pixels\n";
+		std::cout << "- written standard deviation frames of " << ntiles << " scan tiles to file " << str_file_output << "_sdev.dat.\n";
+		std::cout << "  data type: floating point, 64 bit\n";
+		std::cout << "  sampling: " << pprm->hdr_frm.n_columns << " x " << pprm->hdr_frm.n_rows << " x " << ntiles << " pixels\n";
+	}
+	str_file = str_file_output + "_tiles.txt";
+	fout.open(str_file);
+	if (fout.is_open()) {
+		fout << "# x0,y0,x1,y1,frames\n";
+		for (itile = 0; itile < ntiles; itile++) {
+			fout << v_tile[itile].x0 << "," << v_tile[itile].y0 << "," << v_tile[itile].x1 << "," << v_tile[itile].y1 << "," << v_count[itile] << "\n";
+		}
+		fout.close();
+		if (pprm->btalk) {
+			std::cout << "- written scan tile list to file " << str_file << ".\n";
+		}
+	}
+	else {
+		std::cerr << "Error: failed to open output file " << str_file << " for writing.\n";
+		nerr = 220;
+	}
+_cancel_point:
+	free_buffers();
+	return nerr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_op_annular
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_op_annular::merlin_op_annular()
+{
+	str_cmd = "integrate_annular_range";
+	str_msg = "integration over annular range";
+	bcorrected = false; // corrections are folded into the detector function
+	detbuf = NULL;
+	resbuf = NULL;
+}
+
+merlin_op_annular::~merlin_op_annular()
+{
+	if (detbuf) free(detbuf);
+	if (resbuf) free(resbuf);
+}
+
+int merlin_op_annular::init(merlin_params * pprm_in)
+{
+	int nerr = merlin_operation::init(pprm_in);
+	if (nerr != 0) {
+		return nerr;
+	}
+	nerr = check_annular_range(pprm, frm_pix);
+	if (nerr != 0) {
+		return nerr;
+	}
+	detbuf = (double*)calloc(frm_pix, sizeof(double));
+	if (NULL == detbuf) {
+		std::cerr << "Error: failed to allocate detector function.\n";
+		return 101;
+	}
+	nerr = prepare_annular_detector(pprm, frm_pix, detbuf, NULL, NULL, &pprm->hdr_frm);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to prepare annular detector.\n";
+		return 10;
+	}
+	nerr = fold_annular_detector(pprm, frm_pix, detbuf, NULL, NULL);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to apply corrections to the annular detector.\n";
+		return 11;
+	}
+	prepare_detector_spans(frm_pix, (size_t)pprm->hdr_frm.n_columns, detbuf, v_span);
+	if (pprm->ndebug > 0) {
+		if (0 == write_data((char*)detbuf, sizeof(double)*frm_pix, str_file_output + ".det")) {
+			std::cout << "- written detector function to file " << str_file_output + ".det" << ".\n";
+		}
+	}
+	return 0;
+}
+
+int merlin_op_annular::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	merlin_operation::begin(n_items_in, n_frames_in, nthreads_in);
+	if (resbuf) free(resbuf);
+	resbuf = (double*)calloc(n_items + 1, sizeof(double)); // one result per frame in the scan roi
+	if (NULL == resbuf) {
+		std::cerr << "Error: failed to allocate result buffer.\n";
+		return 101;
+	}
+	return 0;
+}
+
+int merlin_op_annular::process_frame(int /*ithread*/, const merlin_frame_item & item, const double * buf)
+{
+	resbuf[item.ires] = merlin_dot_spans(buf, detbuf, v_span.data(), v_span.size() / 2);
+	return 0;
+}
+
+int merlin_op_annular::publish(merlin_engine & /*eng*/, size_t /*n_frames_done*/)
+{
+	return write_results(false);
+}
+
+int merlin_op_annular::finish(merlin_engine & /*eng*/)
+{
+	return write_results(pprm->btalk);
+}
+
+int merlin_op_annular::write_results(bool btell)
+{
+	int nerr = 0;
+	size_t nres = n_items; // number of result items
+	if (nres == 0) {
+		if (btell) {
+			std::cout << "No results calculated, output skipped.\n";
+		}
+		return 0;
+	}
+	if (0 == write_data((char*)resbuf, sizeof(double)*nres, str_file_output)) {
+		if (btell) {
+			std::cout << "- written integrated annular range data to file " << str_file_output << ".\n";
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 200;
+	}
+	return nerr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_op_com
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_op_com::merlin_op_com()
+{
+	str_cmd = "center_of_mass";
+	str_msg = "center of mass in annular range";
+	bcorrected = false; // corrections are folded into the detector functions
+	detbuf = NULL;
+	xbuf = NULL;
+	ybuf = NULL;
+	resbuf00 = NULL;
+	resbuf10 = NULL;
+	resbuf11 = NULL;
+}
+
+merlin_op_com::~merlin_op_com()
+{
+	if (detbuf) free(detbuf);
+	if (xbuf) free(xbuf);
+	if (ybuf) free(ybuf);
+	if (resbuf00) free(resbuf00);
+	if (resbuf10) free(resbuf10);
+	if (resbuf11) free(resbuf11);
+}
+
+int merlin_op_com::init(merlin_params * pprm_in)
+{
+	size_t i = 0;
+	int nerr = merlin_operation::init(pprm_in);
+	if (nerr != 0) {
+		return nerr;
+	}
+	nerr = check_annular_range(pprm, frm_pix);
+	if (nerr != 0) {
+		return nerr;
+	}
+	detbuf = (double*)calloc(frm_pix, sizeof(double));
+	xbuf = (double*)calloc(frm_pix, sizeof(double));
+	ybuf = (double*)calloc(frm_pix, sizeof(double));
+	if (NULL == detbuf || NULL == xbuf || NULL == ybuf) {
+		std::cerr << "Error: failed to allocate detector functions.\n";
+		return 101;
+	}
+	nerr = prepare_annular_detector(pprm, frm_pix, detbuf, NULL, NULL, &pprm->hdr_frm);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to prepare annular detector.\n";
+		return 10;
+	}
+	nerr = prepare_frame_coordinates(pprm, frm_pix, xbuf, ybuf, &pprm->hdr_frm);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to prepare frame coordinates.\n";
+		return 12;
+	}
+	for (i = 0; i < frm_pix; i++) { // coordinate weighted detector functions
+		xbuf[i] *= detbuf[i];
+		ybuf[i] *= detbuf[i];
+	}
+	nerr = fold_annular_detector(pprm, frm_pix, xbuf, NULL, NULL);
+	if (nerr == 0) nerr = fold_annular_detector(pprm, frm_pix, ybuf, NULL, NULL);
+	if (nerr == 0) nerr = fold_annular_detector(pprm, frm_pix, detbuf, NULL, NULL);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to apply corrections to the annular detector.\n";
+		return 11;
+	}
+	prepare_detector_spans(frm_pix, (size_t)pprm->hdr_frm.n_columns, detbuf, v_span);
+	if (pprm->ndebug > 0) {
+		if (0 == write_data((char*)detbuf, sizeof(double)*frm_pix, str_file_output + ".det")) {
+			std::cout << "- written detector function to file " << str_file_output + ".det" << ".\n";
+		}
+	}
+	return 0;
+}
+
+int merlin_op_com::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	merlin_operation::begin(n_items_in, n_frames_in, nthreads_in);
+	if (resbuf00) free(resbuf00);
+	if (resbuf10) free(resbuf10);
+	if (resbuf11) free(resbuf11);
+	resbuf00 = (double*)calloc(n_items + 1, sizeof(double)); // one result per frame in the scan roi
+	resbuf10 = (double*)calloc(n_items + 1, sizeof(double));
+	resbuf11 = (double*)calloc(n_items + 1, sizeof(double));
+	if (NULL == resbuf00 || NULL == resbuf10 || NULL == resbuf11) {
+		std::cerr << "Error: failed to allocate result buffers.\n";
+		return 101;
+	}
+	return 0;
+}
+
+int merlin_op_com::process_frame(int /*ithread*/, const merlin_frame_item & item, const double * buf)
+{
+	size_t ires = item.ires; // result index
+	double sums[3]; // reference integral, x and y moments
+	merlin_dot3_spans(buf, detbuf, xbuf, ybuf, v_span.data(), v_span.size() / 2, sums);
+	resbuf00[ires] = sums[0];
+	if (sums[0] > 0.) {
+		resbuf10[ires] = sums[1] / sums[0];
+		resbuf11[ires] = sums[2] / sums[0];
+	}
+	return 0;
+}
+
+int merlin_op_com::publish(merlin_engine & /*eng*/, size_t /*n_frames_done*/)
+{
+	return write_results(false);
+}
+
+int merlin_op_com::finish(merlin_engine & /*eng*/)
+{
+	return write_results(pprm->btalk);
+}
+
+int merlin_op_com::write_results(bool btell)
+{
+	int nerr = 0;
+	size_t nres = n_items; // number of result items
+	std::string str_file_out; // file names for output
+	if (nres == 0) {
+		if (btell) {
+			std::cout << "No results calculated, output skipped.\n";
+		}
+		return 0;
+	}
+	// - reference integrals 0-0
+	str_file_out = str_file_output + "_0-0.dat";
+	if (0 == write_data((char*)resbuf00, sizeof(double)*nres, str_file_out)) {
+		if (btell) {
+			std::cout << "- written reference integrals to file " << str_file_out << ".\n";
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 200;
+	}
+	// - center-of-mass x 1-0
+	str_file_out = str_file_output + "_1-0.dat";
+	if (0 == write_data((char*)resbuf10, sizeof(double)*nres, str_file_out)) {
+		if (btell) {
+			std::cout << "- written center-of-mass x to file " << str_file_out << ".\n";
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 210;
+	}
+	// - center-of-mass x 1-1
+	str_file_out = str_file_output + "_1-1.dat";
+	if (0 == write_data((char*)resbuf11, sizeof(double)*nres, str_file_out)) {
+		if (btell) {
+			std::cout << "- written center-of-mass y to file " << str_file_out << ".\n";
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 220;
+	}
+	return nerr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_radial_profile
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_radial_profile::merlin_radial_profile()
+{
+	cube = NULL;
+	bvalid = false;
+	bfull = false;
+	bin_width = 1.;
+	n_bins = 0;
+	n_phi = 1;
+	phi0 = 0.;
+	n_items = 0;
+}
+
+merlin_radial_profile::~merlin_radial_profile()
+{
+	clear();
+}
+
+void merlin_radial_profile::clear(void)
+{
+	if (cube) free(cube);
+	cube = NULL;
+	bvalid = false;
+	n_bins = 0;
+	n_items = 0;
+}
+
+bool merlin_radial_profile::is_valid(void) const
+{
+	return bvalid;
+}
+
+void merlin_radial_profile::set(double * cube_in, size_t n_items_in, int n_bins_in, int n_phi_in, double bin_width_in, double phi0_in, bool bfull_in,
+	const merlin_roi & roi, const merlin_frame_calib & calib, const merlin_pos & offset)
+{
+	clear();
+	cube = cube_in;
+	n_items = n_items_in;
+	n_bins = n_bins_in;
+	n_phi = (n_phi_in > 1 ? n_phi_in : 1);
+	bin_width = bin_width_in;
+	phi0 = phi0_in;
+	bfull = bfull_in;
+	scan_roi = roi;
+	frame_calib = calib;
+	offset_annular = offset;
+	bvalid = (NULL != cube && n_bins > 0);
+}
+
+bool merlin_radial_profile::covers(merlin_params * pprm, int & ibin0, int & ibin1) const
+{
+	double b0 = 0., b1 = 0.;
+	const double tol = 1.e-6; // tolerance of bin boundaries relative to the bin width
+	if (!bvalid || NULL == pprm) {
+		return false;
+	}
+	if (scan_roi.x0 != pprm->scan_rect_roi.x0 || scan_roi.x1 != pprm->scan_rect_roi.x1 ||
+		scan_roi.y0 != pprm->scan_rect_roi.y0 || scan_roi.y1 != pprm->scan_rect_roi.y1) {
+		return false; // different scan roi
+	}
+	if (frame_calib.offset.x != pprm->frame_calib.offset.x || frame_calib.offset.y != pprm->frame_calib.offset.y ||
+		frame_calib.a0.x != pprm->frame_calib.a0.x || frame_calib.a0.y != pprm->frame_calib.a0.y ||
+		frame_calib.a1.x != pprm->frame_calib.a1.x || frame_calib.a1.y != pprm->frame_calib.a1.y) {
+		return false; // different frame calibration
+	}
+	if (offset_annular.x != pprm->offset_annular.x || offset_annular.y != pprm->offset_annular.y) {
+		return false; // different center
+	}
+	if (pprm->range_annular.min < 0. || pprm->range_annular.max <= pprm->range_annular.min) {
+		return false; // leave invalid ranges to the regular integration
+	}
+	b0 = pprm->range_annular.min / bin_width;
+	b1 = pprm->range_annular.max / bin_width;
+	if (fabs(b0 - floor(b0 + 0.5)) > tol) {
+		return false; // inner radius not on a bin boundary
+	}
+	ibin0 = (int)floor(b0 + 0.5);
+	if (ibin0 > n_bins) {
+		return false;
+	}
+	if (b1 >= (double)n_bins) { // outer radius beyond the last bin
+		if (!bfull) {
+			return false; // pixels beyond the last bin are missing
+		}
+		ibin1 = n_bins;
+		return true;
+	}
+	if (fabs(b1 - floor(b1 + 0.5)) > tol) {
+		return false; // outer radius not on a bin boundary
+	}
+	ibin1 = (int)floor(b1 + 0.5);
+	return true;
+}
+
+int merlin_radial_profile::integrate(int ibin0, int ibin1, double * res) const
+{
+	size_t i = 0;
+	int k = 0, k0 = ibin0 * n_phi, k1 = ibin1 * n_phi;
+	double lres = 0.;
+	const double * row = NULL;
+	if (!bvalid) {
+		return 1; // no profiles
+	}
+	if (NULL == res) {
+		return 3; // invalid input pointer, parameter 3
+	}
+	if (ibin0 < 0 || ibin1 > n_bins) {
+		return 2; // invalid bin range
+	}
+	for (i = 0; i < n_items; i++) {
+		row = cube + i * (size_t)n_bins * n_phi;
+		lres = 0.;
+		for (k = k0; k < k1; k++) { // sectors of a radial bin are contiguous
+			lres += row[k];
+		}
+		res[i] = lres;
+	}
+	return 0;
+}
+
+int merlin_radial_profile::integrate_segments(int ibin0, int ibin1, double * seg, double * dpcx, double * dpcy, double * comx, double * comy) const
+{
+	size_t i = 0;
+	int k = 0, l = 0;
+	double dphi = 0., r = 0., v = 0., vsum = 0., vseg = 0.;
+	double ldpcx = 0., ldpcy = 0., lcomx = 0., lcomy = 0.;
+	const double * row = NULL;
+	std::vector<double> v_cos, v_sin; // sector center directions
+	if (!bvalid) {
+		return 1; // no profiles
+	}
+	if (ibin0 < 0 || ibin1 > n_bins) {
+		return 2; // invalid bin range
+	}
+	dphi = 2. * MERLIN_PI / (double)n_phi;
+	for (l = 0; l < n_phi; l++) {
+		v_cos.push_back(cos(phi0 + ((double)l + 0.5) * dphi));
+		v_sin.push_back(sin(phi0 + ((double)l + 0.5) * dphi));
+	}
+	for (i = 0; i < n_items; i++) {
+		row = cube + i * (size_t)n_bins * n_phi;
+		ldpcx = 0.; ldpcy = 0.; lcomx = 0.; lcomy = 0.; vsum = 0.;
+		for (l = 0; l < n_phi; l++) {
+			vseg = 0.;
+			for (k = ibin0; k < ibin1; k++) {
+				r = ((double)k + 0.5) * bin_width; // radius of the bin center
+				v = row[k * n_phi + l];
+				vseg += v;
+				lcomx += r * v_cos[l] * v;
+				lcomy += r * v_sin[l] * v;
+			}
+			if (seg) seg[i * n_phi + l] = vseg;
+			ldpcx += vseg * v_cos[l];
+			ldpcy += vseg * v_sin[l];
+			vsum += vseg;
+		}
+		if (dpcx) dpcx[i] = ldpcx;
+		if (dpcy) dpcy[i] = ldpcy;
+		if (comx) comx[i] = (vsum > 0. ? lcomx / vsum : 0.);
+		if (comy) comy[i] = (vsum > 0. ? lcomy / vsum : 0.);
+	}
+	return 0;
+}
+
+size_t merlin_radial_profile::get_num_items(void) const
+{
+	return n_items;
+}
+
+int merlin_radial_profile::get_num_phi(void) const
+{
+	return n_phi;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_op_radial
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_op_radial::merlin_op_radial(merlin_radial_profile * pprof_in, bool bpolar_in)
+{
+	bpolar = bpolar_in;
+	str_cmd = (bpolar ? "polar_profile" : "radial_profile");
+	str_msg = (bpolar ? "polar profiles" : "radial profiles");
+	pprof = pprof_in;
+	binidx = NULL;
+	cube = NULL;
+	bin_width = 1.;
+	n_bins = 0;
+	n_phi = 1;
+	phi0 = 0.;
+	bfull = false;
+}
+
+merlin_op_radial::~merlin_op_radial()
+{
+	if (binidx) free(binidx);
+	if (cube) free(cube);
+}
+
+int merlin_op_radial::init(merlin_params * pprm_in)
+{
+	int nerr = merlin_operation::init(pprm_in);
+	size_t i = 0;
+	int l = 0;
+	double qm = 0., qx = 0., qy = 0., qmax = 0., phi = 0., dphi = 0.;
+	merlin_pix p;
+	merlin_pos q;
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (frm_pix == 0) {
+		std::cerr << "Error: insuffient number of frame pixels.\n";
+		return 1;
+	}
+	if (pprm->hdr.n_frames <= 0) {
+		std::cerr << "Error: insuffient number of frames.\n";
+		return 2;
+	}
+	if (pprm->radial_bin_width <= 0.) {
+		std::cerr << "Error: invalid radial bin width (" << pprm->radial_bin_width << ").\n";
+		return 3;
+	}
+	bin_width = pprm->radial_bin_width;
+	if (bpolar) {
+		if (pprm->polar_phi_num <= 0) {
+			std::cerr << "Error: invalid number of azimuthal sectors (" << pprm->polar_phi_num << ").\n";
+			return 4;
+		}
+		n_phi = pprm->polar_phi_num;
+		phi0 = pprm->polar_phi_offset * MERLIN_PI / 180.;
+	}
+	scan_roi = pprm->scan_rect_roi;
+	frame_calib = pprm->frame_calib;
+	offset_annular = pprm->offset_annular;
+	binidx = (int*)calloc(frm_pix, sizeof(int));
+	if (NULL == binidx) {
+		std::cerr << "Error: failed to allocate radial bin table.\n";
+		return 101;
+	}
+	// radius of each frame pixel, calibrated like the annular detector
+	for (i = 0; i < frm_pix; i++) {
+		if (0 != pprm->get_frame_pixel((__int64)i, p.x, p.y) || 0 != pprm->get_calib_pos(p, &q)) {
+			std::cerr << "Error: failed to prepare radial bins.\n";
+			return 10;
+		}
+		qx = q.x - offset_annular.x;
+		qy = q.y - offset_annular.y;
+		qm = sqrt(qx*qx + qy*qy);
+		binidx[i] = (int)floor(qm / bin_width);
+		if (qm > qmax) qmax = qm;
+	}
+	n_bins = pprm->radial_bin_num;
+	if (n_bins <= 0) { // cover the whole frame
+		n_bins = (int)floor(qmax / bin_width) + 1;
+	}
+	bfull = true;
+	for (i = 0; i < frm_pix; i++) {
+		if (binidx[i] >= n_bins) {
+			binidx[i] = -1; // beyond the last bin
+			bfull = false;
+		}
+	}
+	if (n_phi > 1) { // azimuthal sector of each binned pixel
+		dphi = 2. * MERLIN_PI / (double)n_phi;
+		for (i = 0; i < frm_pix; i++) {
+			if (binidx[i] < 0) continue;
+			pprm->get_frame_pixel((__int64)i, p.x, p.y);
+			pprm->get_calib_pos(p, &q);
+			qx = q.x - offset_annular.x;
+			qy = q.y - offset_annular.y;
+			phi = atan2(qy, qx) - phi0; // angle relative to the first sector
+			phi -= 2. * MERLIN_PI * floor(phi / (2. * MERLIN_PI)); // to [0, 2 pi)
+			l = (int)floor(phi / dphi);
+			if (l >= n_phi) l = n_phi - 1; // rounding at 2 pi
+			binidx[i] = binidx[i] * n_phi + l;
+		}
+	}
+	return 0;
+}
+
+int merlin_op_radial::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	merlin_operation::begin(n_items_in, n_frames_in, nthreads_in);
+	if (cube) free(cube);
+	cube = (double*)calloc((n_items + 1) * (size_t)n_bins * n_phi, sizeof(double)); // one profile per frame in the scan roi
+	if (NULL == cube) {
+		std::cerr << "Error: failed to allocate radial profile buffer.\n";
+		return 101;
+	}
+	return 0;
+}
+
+int merlin_op_radial::process_frame(int /*ithread*/, const merlin_frame_item & item, const double * buf)
+{
+	size_t i = 0;
+	int k = 0;
+	double * row = cube + item.ires * (size_t)n_bins * n_phi;
+	for (i = 0; i < frm_pix; i++) {
+		k = binidx[i];
+		if (k >= 0) row[k] += buf[i];
+	}
+	return 0;
+}
+
+int merlin_op_radial::finish(merlin_engine & /*eng*/)
+{
+	int nerr = 0;
+	size_t nres = n_items; // number of result items
+	if (nres == 0) {
+		if (pprm->btalk) {
+			std::cout << "No results calculated, output skipped.\n";
+		}
+		return 0;
+	}
+	if (0 == write_data((char*)cube, sizeof(double)*nres*(size_t)n_bins*n_phi, str_file_output)) {
+		if (pprm->btalk) {
+			std::cout << "- written " << str_msg << " to file " << str_file_output << ".\n";
+			std::cout << "  data type: floating point, 64 bit\n";
+			std::cout << "  radial bins: " << n_bins << " x " << bin_width << " per scan point\n";
+			if (bpolar) std::cout << "  azimuthal sectors: " << n_phi << " per radial bin, from " << pprm->polar_phi_offset << " deg\n";
+			std::cout << "  scan sampling: " << 1 + pprm->scan_rect_roi.x1 - pprm->scan_rect_roi.x0 << " x " << 1 + pprm->scan_rect_roi.y1 - pprm->scan_rect_roi.y0 << " scan points\n";
+		}
+	}
+	else {
+		nerr = 200;
+	}
+	if (NULL != pprof) { // keep the profiles for later integrations
+		pprof->set(cube, nres, n_bins, n_phi, bin_width, phi0, bfull, scan_roi, frame_calib, offset_annular);
+		cube = NULL; // now owned by *pprof
+	}
+	return nerr;
+}
+
+
+int merlin_integrate_radial_profile(merlin_params * pprm, merlin_radial_profile * pprof)
+{
+	int nerr = 0;
+	int ibin0 = 0, ibin1 = 0;
+	size_t nres = 0;
+	double * resbuf = NULL; // result buffer
+	if (NULL == pprm || NULL == pprof) {
+		return 100; // missing parameters
+	}
+	if (!pprof->covers(pprm, ibin0, ibin1)) {
+		return 1; // the profiles do not cover the current annular range
+	}
+	nres = pprof->get_num_items();
+	if (pprm->btalk) {
+		std::cout << "- integration over annular range from radial profiles (bins " << ibin0 << " to " << ibin1 - 1 << ") ...\n";
+	}
+	if (nres == 0) {
+		if (pprm->btalk) {
+			std::cout << "No results calculated, output skipped.\n";
+		}
+		return 0;
+	}
+	resbuf = (double*)calloc(nres, sizeof(double));
+	if (NULL == resbuf) {
+		std::cerr << "Error: failed to allocate result buffer.\n";
+		return 101;
+	}
+	nerr = pprof->integrate(ibin0, ibin1, resbuf);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to integrate radial profiles (code " << nerr << ").\n";
+		nerr = 112;
+		goto _cancel_point;
+	}
+	if (0 == write_data((char*)resbuf, sizeof(double)*nres, pprm->str_file_output)) {
+		if (pprm->btalk) {
+			std::cout << "- written integrated annular range data to file " << pprm->str_file_output << ".\n";
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 200;
+	}
+_cancel_point:
+	if (resbuf) free(resbuf);
+	return nerr;
+}
+
+
+int merlin_polar_segments(merlin_params * pprm, merlin_radial_profile * pprof)
+{
+	int nerr = 0;
+	int ibin0 = 0, ibin1 = 0, n_phi = 0;
+	size_t nres = 0;
+	double * segbuf = NULL; // segment integrals
+	double * dpcbuf = NULL; // differential signals x and y
+	double * combuf = NULL; // center of mass x and y
+	std::string str_file_out; // file names for output
+	if (NULL == pprm || NULL == pprof) {
+		return 100; // missing parameters
+	}
+	if (!pprof->is_valid() || pprof->get_num_phi() < 2) {
+		std::cerr << "Error: no polar profiles present, use polar_profile first.\n";
+		return 1;
+	}
+	if (!pprof->covers(pprm, ibin0, ibin1)) {
+		std::cerr << "Error: the polar profiles do not match the current annular range, scan roi, or calibration.\n";
+		return 2;
+	}
+	nres = pprof->get_num_items();
+	n_phi = pprof->get_num_phi();
+	if (pprm->btalk) {
+		std::cout << "- segment integration from polar profiles (bins " << ibin0 << " to " << ibin1 - 1 << ", " << n_phi << " segments) ...\n";
+	}
+	if (nres == 0) {
+		if (pprm->btalk) {
+			std::cout << "No results calculated, output skipped.\n";
+		}
+		return 0;
+	}
+	segbuf = (double*)calloc(nres * n_phi, sizeof(double));
+	dpcbuf = (double*)calloc(nres * 2, sizeof(double));
+	combuf = (double*)calloc(nres * 2, sizeof(double));
+	if (NULL == segbuf || NULL == dpcbuf || NULL == combuf) {
+		std::cerr << "Error: failed to allocate result buffers.\n";
+		nerr = 101;
+		goto _cancel_point;
+	}
+	nerr = pprof->integrate_segments(ibin0, ibin1, segbuf, dpcbuf, dpcbuf + nres, combuf, combuf + nres);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to integrate polar profiles (code " << nerr << ").\n";
+		nerr = 112;
+		goto _cancel_point;
+	}
+	// - segment integrals
+	str_file_out = pprm->str_file_output + "_seg.dat";
+	if (0 == write_data((char*)segbuf, sizeof(double)*nres*n_phi, str_file_out)) {
+		if (pprm->btalk) {
+			std::cout << "- written " << n_phi << " segment integrals per scan point to file " << str_file_out << ".\n";
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 200;
+	}
+	// - differential signals x and y
+	str_file_out = pprm->str_file_output + "_dpc_1-0.dat";
+	if (0 == write_data((char*)dpcbuf, sizeof(double)*nres, str_file_out)) {
+		if (pprm->btalk) {
+			std::cout << "- written differential signal x to file " << str_file_out << ".\n";
+		}
+	}
+	else {
+		nerr = 210;
+	}
+	str_file_out = pprm->str_file_output + "_dpc_1-1.dat";
+	if (0 == write_data((char*)(dpcbuf + nres), sizeof(double)*nres, str_file_out)) {
+		if (pprm->btalk) {
+			std::cout << "- written differential signal y to file " << str_file_out << ".\n";
+		}
+	}
+	else {
+		nerr = 220;
+	}
+	// - center of mass x and y from the bin centers
+	str_file_out = pprm->str_file_output + "_com_1-0.dat";
+	if (0 == write_data((char*)combuf, sizeof(double)*nres, str_file_out)) {
+		if (pprm->btalk) {
+			std::cout << "- written approximate center-of-mass x to file " << str_file_out << ".\n";
+		}
+	}
+	else {
+		nerr = 230;
+	}
+	str_file_out = pprm->str_file_output + "_com_1-1.dat";
+	if (0 == write_data((char*)(combuf + nres), sizeof(double)*nres, str_file_out)) {
+		if (pprm->btalk) {
+			std::cout << "- written approximate center-of-mass y to file " << str_file_out << ".\n";
+		}
+	}
+	else {
+		nerr = 240;
+	}
+_cancel_point:
+	if (segbuf) free(segbuf);
+	if (dpcbuf) free(dpcbuf);
+	if (combuf) free(combuf);
+	return nerr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_op_detectors
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_op_detectors::merlin_op_detectors(const merlin_detector_matrix * pdet_in)
+{
+	str_cmd = "integrate_detectors";
+	str_msg = "integration of virtual detectors";
+	pdet = pdet_in;
+	resbuf = NULL;
+}
+
+merlin_op_detectors::~merlin_op_detectors()
+{
+	free_buffers();
+	if (resbuf) free(resbuf);
+}
+
+void merlin_op_detectors::free_buffers(void)
+{
+	size_t i = 0;
+	for (i = 0; i < v_blk.size(); i++) {
+		if (v_blk[i]) free(v_blk[i]);
+	}
+	for (i = 0; i < v_blkires.size(); i++) {
+		if (v_blkires[i]) free(v_blkires[i]);
+	}
+	v_blk.clear();
+	v_blkires.clear();
+	v_blkn.clear();
+}
+
+int merlin_op_detectors::init(merlin_params * pprm_in)
+{
+	int nerr = merlin_operation::init(pprm_in);
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (NULL == pdet || pdet->get_num_detectors() == 0) {
+		std::cerr << "Error: no virtual detectors defined (see set_detectors).\n";
+		return 1;
+	}
+	if (pdet->get_num_pixels() != frm_pix) {
+		std::cerr << "Error: virtual detectors do not match the frame size.\n";
+		return 2;
+	}
+	det = *pdet; // snapshot, later set_detectors commands do not affect this operation
+	return 0;
+}
+
+int merlin_op_detectors::begin(size_t n_items_in, size_t n_frames_in, int nthreads_in)
+{
+	int i = 0;
+	merlin_operation::begin(n_items_in, n_frames_in, nthreads_in);
+	free_buffers();
+	if (resbuf) free(resbuf);
+	resbuf = (double*)calloc((size_t)det.get_num_detectors() * n_items + 1, sizeof(double)); // one image per detector
+	if (NULL == resbuf) {
+		std::cerr << "Error: failed to allocate result buffer.\n";
+		return 101;
+	}
+	v_blk.resize(nthreads, NULL);
+	v_blkires.resize(nthreads, NULL);
+	v_blkn.resize(nthreads, 0);
+	for (i = 0; i < nthreads; i++) {
+		v_blk[i] = (double*)calloc(frm_pix * MERLIN_DETECTOR_BLOCK, sizeof(double));
+		v_blkires[i] = (size_t*)calloc(MERLIN_DETECTOR_BLOCK, sizeof(size_t));
+		if (NULL == v_blk[i] || NULL == v_blkires[i]) {
+			std::cerr << "Error: failed to allocate frame block buffers.\n";
+			return 102;
+		}
+	}
+	return 0;
+}
+
+int merlin_op_detectors::process_frame(int ithread, const merlin_frame_item & item, const double * buf)
+{
+	size_t i = 0;
+	size_t f = v_blkn[ithread]; // slot of this frame in the block
+	double * blk = v_blk[ithread];
+	for (i = 0; i < frm_pix; i++) { // interleave, pixel-major
+		blk[i * MERLIN_DETECTOR_BLOCK + f] = buf[i];
+	}
+	v_blkires[ithread][f] = item.ires;
+	f++;
+	if (f == MERLIN_DETECTOR_BLOCK) { // block complete
+		det.apply_block(blk, MERLIN_DETECTOR_BLOCK, f, v_blkires[ithread], resbuf, n_items);
+		f = 0;
+	}
+	v_blkn[ithread] = f;
+	return 0;
+}
+
+void merlin_op_detectors::flush_blocks(void)
+{
+	int i = 0;
+	for (i = 0; i < (int)v_blk.size(); i++) { // remaining partial blocks
+		if (v_blkn[i] > 0) {
+			det.apply_block(v_blk[i], MERLIN_DETECTOR_BLOCK, v_blkn[i], v_blkires[i], resbuf, n_items);
+			v_blkn[i] = 0;
+		}
+	}
+}
+
+int merlin_op_detectors::publish(merlin_engine & /*eng*/, size_t /*n_frames_done*/)
+{
+	flush_blocks(); // workers are idle between parts of the frames
+	return write_results(false);
+}
+
+int merlin_op_detectors::finish(merlin_engine & /*eng*/)
+{
+	flush_blocks();
+	free_buffers();
+	return write_results(pprm->btalk);
+}
+
+int merlin_op_detectors::write_results(bool btell)
+{
+	int nerr = 0;
+	int i = 0, ndet = det.get_num_detectors();
+	size_t nres = n_items; // number of result items
+	if (nres == 0) {
+		if (btell) {
+			std::cout << "No results calculated, output skipped.\n";
+		}
+		return 0;
+	}
+	if (0 == write_data((char*)resbuf, sizeof(double)*nres*ndet, str_file_output)) {
+		if (btell) {
+			std::cout << "- written " << ndet << " virtual detector images to file " << str_file_output << ".\n";
+			for (i = 0; i < ndet; i++) {
+				std::cout << "  image " << i << ": " << det.get_name(i) << "\n";
+			}
+			report_scan_output(pprm);
+		}
+	}
+	else {
+		nerr = 200;
+	}
+	return nerr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// single pass execution of operations
+//
+// -----------------------------------------------------------------------------
+
+
+// publishes intermediate results of the operations v_ops from the first
+// n_done frames of a pass, when the next frame idx_next is in a scan row
+// after nrow, nrow is then set to the scan row of idx_next
+// - return value = error code (0: success)
+static int merlin_publish_rows(merlin_params * pprm, std::vector<merlin_operation*> & v_ops, merlin_engine & eng,
+	__int64 idx_next, size_t n_done, size_t n, int & nrow, std::string str_mode)
+{
+	int nerr = 0;
+	int x = 0, y = 0;
+	size_t iop = 0;
+	pprm->get_scan_pixel(idx_next, x, y);
+	if (y <= nrow) {
+		return 0; // scan row not complete
+	}
+	nrow = y;
+	for (iop = 0; iop < v_ops.size(); iop++) {
+		nerr = v_ops[iop]->publish(eng, n_done);
+		if (nerr != 0) {
+			return nerr;
+		}
+	}
+	if (pprm->btalk) {
+		std::cout << "- " << str_mode << ": " << n_done << " of " << n << " frames processed, published results up to scan row " << nrow - 1 << ".\n";
+	}
+	return 0;
+}
+
+// processes the frames v_items in acquisition order as they are written
+// to the data files by a running acquisition, with the kernel proc_raw
+// (braw) or proc_frame, and publishes intermediate results of the
+// operations v_ops whenever a scan row is complete
+// - output n_done = number of frames processed
+// - return value = error code (0: success), 120 = no new frames within
+//   the live timeout, only n_done frames are processed
+static int merlin_run_live(merlin_params * pprm, std::vector<merlin_operation*> & v_ops, merlin_engine & eng, std::vector<merlin_frame_item> & v_items,
+	bool braw, merlin_raw_kernel proc_raw, merlin_frame_kernel proc_frame, size_t & n_done)
+{
+	int nerr = 0;
+	int x = 0, nrow = 0; // next scan row to be completed
+	size_t i0 = 0, i1 = 0, n = v_items.size();
+	__int64 n_ready = 0; // number of frames written completely
+	std::vector<merlin_frame_item> v_part; // frames written since the last part
+	std::chrono::steady_clock::time_point t_new; // time of the last new frames
+	merlin_file_watch watch;
+	n_done = 0;
+	if (n == 0) {
+		return 0; // nothing to do
+	}
+	std::stable_sort(v_items.begin(), v_items.end(), [](const merlin_frame_item & a, const merlin_frame_item & b) {
+		return a.idx < b.idx; // acquisition order
+	});
+	pprm->get_scan_pixel(v_items[0].idx, x, nrow);
+	watch.open(pprm->str_file_input);
+	t_new = std::chrono::steady_clock::now();
+	while (i0 < n) {
+		nerr = pprm->update_frame_index(n_ready);
+		if (nerr != 0) {
+			std::cerr << "Error: failed to update the frame index (code " << nerr << ").\n";
+			return 121;
+		}
+		i1 = i0;
+		while (i1 < n && v_items[i1].idx < n_ready) i1++;
+		if (i1 == i0) { // wait for new frames
+			if (std::chrono::steady_clock::now() - t_new > std::chrono::seconds(pprm->nlivetimeout)) {
+				break; // acquisition stopped
+			}
+			watch.wait();
+			continue;
+		}
+		t_new = std::chrono::steady_clock::now();
+		v_part.assign(v_items.begin() + i0, v_items.begin() + i1);
+		if (braw) {
+			nerr = eng.run_raw(&v_part, proc_raw);
+		}
+		else {
+			nerr = eng.run(&v_part, proc_frame);
+		}
+		if (nerr != 0) {
+			return nerr; // stop working
+		}
+		i0 = i1;
+		n_done = i0;
+		if (i0 == n) {
+			break; // all frames processed, results are written by finish
+		}
+		nerr = merlin_publish_rows(pprm, v_ops, eng, v_items[i0].idx, i0, n, nrow, "live"); // scan rows before the next frame are complete
+		if (nerr != 0) {
+			return nerr;
+		}
+	}
+	if (i0 < n) { // results of the frames received so far are written by finish
+		std::cerr << "Warning: no new frames for " << pprm->nlivetimeout << " s, writing results of " << i0 << " of " << n << " frames.\n";
+		return 120;
+	}
+	return 0;
+}
+
+// processes the frames v_items as they are received from the data stream
+// of *pprm with the kernel proc_raw (braw) or proc_frame, the next part of
+// frames is received while the current part is processed, intermediate
+// results of the operations v_ops are published whenever a scan row is
+// complete
+// - output n_done = number of frames processed
+// - return value = error code (0: success), 120 = frames missing in the
+//   stream, only n_done frames are processed
+static int merlin_run_stream(merlin_params * pprm, std::vector<merlin_operation*> & v_ops, merlin_engine & eng, std::vector<merlin_frame_item> & v_items,
+	bool braw, merlin_raw_kernel proc_raw, merlin_frame_kernel proc_frame, size_t & n_done)
+{
+	int nerr = 0, nerr_recv = 0;
+	int x = 0, nrow = 0; // next scan row to be completed
+	int ipart = 0; // part of frames processed
+	size_t i = 0, j = 0, i0 = 0, inext = 0, nnext = 0, n = v_items.size();
+	bool bmore = false; // more frames are received
+	std::vector<__int64> v_idx; // frame indices of the items in acquisition order
+	std::vector<merlin_frame_item> v_part; // items of the frames received in a part
+	std::thread th_recv; // receives the next part
+	n_done = 0;
+	if (n == 0) {
+		return 0; // nothing to do
+	}
+	std::stable_sort(v_items.begin(), v_items.end(), [](const merlin_frame_item & a, const merlin_frame_item & b) {
+		return a.idx < b.idx; // acquisition order
+	});
+	v_idx.resize(n);
+	for (i = 0; i < n; i++) {
+		v_idx[i] = v_items[i].idx;
+	}
+	pprm->get_scan_pixel(v_items[0].idx, x, nrow);
+	nerr = pprm->stream.receive_part(ipart, v_idx.data(), n, inext, (__int64)pprm->hdr.n_columns);
+	if (nerr != 0) {
+		nerr = 123; // failed to receive frames
+	}
+	while (nerr == 0) {
+		const std::vector<__int64> & v_frm = pprm->stream.get_part_frames(ipart);
+		v_part.clear();
+		for (i = i0, j = 0; i < inext; i++) { // items of the frames in the part
+			while (j < v_frm.size() && v_frm[j] < v_items[i].idx) j++;
+			if (j < v_frm.size() && v_frm[j] == v_items[i].idx) v_part.push_back(v_items[i]);
+		}
+		i0 = inext;
+		bmore = (i0 < n && !pprm->stream.at_end());
+		if (bmore) { // receive the next part while processing this part
+			th_recv = std::thread([&]() {
+				nerr_recv = pprm->stream.receive_part(1 - ipart, v_idx.data() + i0, n - i0, nnext, (__int64)pprm->hdr.n_columns);
+			});
+		}
+		pprm->stream.set_current_part(ipart);
+		if (braw) {
+			nerr = eng.run_raw(&v_part, proc_raw);
+		}
+		else {
+			nerr = eng.run(&v_part, proc_frame);
+		}
+		if (th_recv.joinable()) {
+			th_recv.join();
+		}
+		if (nerr != 0) {
+			break; // stop working
+		}
+		n_done += v_part.size();
+		if (!bmore) {
+			break; // end of the items or of the stream
+		}
+		if (nerr_recv != 0) {
+			nerr = 123; // failed to receive frames
+			break;
+		}
+		inext = i0 + nnext;
+		ipart = 1 - ipart;
+		nerr = merlin_publish_rows(pprm, v_ops, eng, v_items[i0].idx, n_done, n, nrow, "stream"); // scan rows before the next frame are complete
+	}
+	pprm->stream.set_consumed();
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (n_done < n) { // results of the frames received are written by finish
+		std::cerr << "Warning: data stream ended after " << n_done << " of " << n << " frames, writing results of these frames.\n";
+		return 120;
+	}
+	return 0;
+}
+
+int merlin_run_operations(merlin_params * pprm, std::vector<merlin_operation*> & v_ops)
+{
+	int nerr = 0, nerr_op = 0;
+	size_t iop = 0, nops = v_ops.size();
+	bool bcorrect = false; // at least one operation expects corrected frames
+	bool braw = true; // all operations process raw frames
+	std::vector<merlin_frame_item> v_items; // frames in the scan roi
+	size_t n_res = 0; // number of result items
+	size_t n_done = 0; // number of frames processed in live and stream mode
+	merlin_engine eng; // multi-threaded frame processing
+	merlin_frame_kernel proc_frame; // per-frame processing
+	merlin_raw_kernel proc_raw; // per-frame processing of raw data
+	if (NULL == pprm) {
+		return 100; // missing parameters
+	}
+	if (nops == 0) {
+		return 0; // nothing to do
+	}
+	if (pprm->stream.is_open() && pprm->stream.is_consumed()) {
+		std::cerr << "Error: frames of the data stream were used by a previous pass of operations.\n";
+		return 122;
+	}
+	// check for required update of the defect correction list
+	if (pprm->is_defect_list_modified()) pprm->update_defect_correction_list();
+	//
+	nerr = pprm->get_scan_roi_frames(v_items, &n_res);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to determine frames in the scan roi (code " << nerr << ").\n";
+		return 100;
+	}
+	eng.init(pprm);
+	for (iop = 0; iop < nops; iop++) {
+		nerr = v_ops[iop]->begin(n_res, v_items.size(), eng.get_num_threads());
+		if (nerr != 0) {
+			return nerr;
+		}
+		bcorrect |= v_ops[iop]->uses_corrected_frames();
+		braw &= v_ops[iop]->uses_raw_frames();
+	}
+	proc_raw = [&](int ith, const merlin_frame_item & item, const char * pdata) -> int {
+		int nerr = 0;
+		size_t iop = 0;
+		for (iop = 0; iop < nops; iop++) {
+			nerr = v_ops[iop]->process_raw(ith, item, pdata);
+			if (nerr != 0) return nerr;
+		}
+		return 0;
+	};
+	proc_frame = [&](int ith, const merlin_frame_item & item, double * datbuf) -> int {
+		int nerr = 0;
+		size_t iop = 0;
+		for (iop = 0; iop < nops; iop++) { // operations on the frame data as read
+			if (v_ops[iop]->uses_corrected_frames()) continue;
+			nerr = v_ops[iop]->process_frame(ith, item, datbuf);
+			if (nerr != 0) return nerr;
+		}
+		if (!bcorrect) return 0;
+		nerr = pprm->gain_correction(datbuf); // apply gain correction if present
+		if (nerr != 0) { // gain correction failed
+			std::cerr << "Error: gain correction failed for frame # " << item.idx << " (code " << nerr << ").\n";
+			return 110;
+		}
+		nerr = pprm->defect_correction(datbuf); // apply defect pixel correction if present
+		if (nerr != 0) { // defect correction failed
+			std::cerr << "Error: defect correction failed for frame # " << item.idx << " (code " << nerr << ").\n";
+			return 111;
+		}
+		for (iop = 0; iop < nops; iop++) { // operations on the corrected frame data
+			if (!v_ops[iop]->uses_corrected_frames()) continue;
+			nerr = v_ops[iop]->process_frame(ith, item, datbuf);
+			if (nerr != 0) return nerr;
+		}
+		return 0;
+	};
+	if (pprm->btalk) {
+		if (nops > 1) {
+			std::cout << "- single pass over the current scan roi for " << nops << " operations:\n";
+		}
+		for (iop = 0; iop < nops; iop++) {
+			std::cout << "- " << v_ops[iop]->get_message() << " in current scan roi ...\n";
+		}
+	}
+	if (pprm->blive) { // process frames while they are written
+		nerr = merlin_run_live(pprm, v_ops, eng, v_items, braw, proc_raw, proc_frame, n_done);
+	}
+	else if (pprm->stream.is_open()) { // process frames while they are received
+		nerr = merlin_run_stream(pprm, v_ops, eng, v_items, braw, proc_raw, proc_frame, n_done);
+	}
+	else if (braw) { // no decoding needed
+		nerr = eng.run_raw(&v_items, proc_raw);
+	}
+	else {
+		nerr = eng.run(&v_items, proc_frame);
+	}
+	if (nerr == 120) { // pass stopped early, finish with the processed frames
+		for (iop = 0; iop < nops; iop++) {
+			v_ops[iop]->truncate(n_done);
+		}
+	}
+	else if (nerr != 0) {
+		return nerr; // stop working
+	}
+	for (iop = 0; iop < nops; iop++) {
+		nerr_op = v_ops[iop]->finish(eng);
+		if (nerr_op != 0) {
+			if (nops > 1) {
+				std::cerr << "Error while finishing operation: " << v_ops[iop]->get_command() << " (code: " << nerr_op << ")\n";
+			}
+			if (nerr == 0 || nerr == 120) nerr = nerr_op;
+		}
+	}
+	return nerr;
+}
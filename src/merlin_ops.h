@@ -0,0 +1,455 @@
+// file : "merlin_ops.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the frame processing operations used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include "merlin_engine.h"
+#include "merlin_detectors.h"
+
+constexpr double MERLIN_PI = 3.14159265358979323846;
+
+// writes nbytes from buf to the binary file str_file
+// - return value = error code (0: success)
+int write_data(char* buf, size_t nbytes, std::string str_file);
+
+// sets the annular detector function detbuf and the list of detector
+// pixels dethash for the current annular range and offset of *pprm
+int prepare_annular_detector(merlin_params * pprm, size_t nlen, double * detbuf, int * dethash, size_t * nhash, merlin_frame_hdr * pfhdr);
+
+// sets calibrated coordinates x, y for all frame pixels
+int prepare_frame_coordinates(merlin_params * pprm, size_t nlen, double * x, double * y, merlin_frame_hdr * pfhdr);
+
+// integrates frame data buf weighted by the detector function detbuf
+int sum_annular_range(size_t nlen, const double * buf, double * detbuf, int * dethash, size_t nhash, double * res);
+
+// calculates the center of mass of frame data buf weighted by the detector
+// function detbuf with respect to the reference integral ref0
+int com_annular_range(size_t nlen, const double * buf, double * detbuf, double * x, double * y, int * dethash, size_t nhash, double ref0, double * resx, double * resy);
+
+// folds the gain and defect corrections of *pprm into the detector
+// function detbuf and updates the list of detector pixels dethash
+int fold_annular_detector(merlin_params * pprm, size_t nlen, double * detbuf, int * dethash, size_t * nhash);
+
+// sets the ranges of contiguous non-zero pixels of the detector function
+// detbuf as pairs [v_span[2*k], v_span[2*k+1]), split at the ends of rows
+// of nrow pixels
+int prepare_detector_spans(size_t nlen, size_t nrow, const double * detbuf, std::vector<size_t> & v_span);
+
+
+// Base class of operations processing all frames of the scan roi.
+// An operation takes a snapshot of the parameters it depends on
+// (detector functions, output file name) when the control command is
+// given, so that several operations can consume the same decoded frames
+// in a single pass over the data (see merlin_run_operations).
+class merlin_operation
+{
+public:
+	// constructor
+	merlin_operation();
+	// destructor
+	virtual ~merlin_operation();
+
+protected:
+	merlin_params * pprm; // parameters
+	std::string str_cmd; // control command of the operation
+	std::string str_msg; // description of the operation for text output
+	std::string str_file_output; // output file name at the time of the command
+	bool bcorrected; // operation expects gain and defect corrected frame data
+	bool braw; // operation can process raw frame data (see process_raw)
+	size_t frm_pix; // number of frame pixels
+	size_t n_items; // number of result items (scan roi positions)
+	size_t n_frames; // number of frames processed
+	int nthreads; // number of threads calling process_frame
+
+	// member functions
+public:
+	// returns the control command of the operation
+	const std::string & get_command(void) const;
+
+	// returns a description of the operation for text output
+	const std::string & get_message(void) const;
+
+	// returns true if the operation expects corrected frame data
+	bool uses_corrected_frames(void) const;
+
+	// returns true if the operation can process raw frame data
+	bool uses_raw_frames(void) const;
+
+	// takes a snapshot of the current parameters *pprm_in
+	// - return value = error code (0: success)
+	virtual int init(merlin_params * pprm_in);
+
+	// prepares result buffers for n_items_in result items, of which
+	// n_frames_in frames are processed by nthreads_in threads, result
+	// items of frames excluded by the scan mask remain zero
+	// - return value = error code (0: success)
+	virtual int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+
+	// processes the data buf of one frame, called concurrently from
+	// threads 0 ... nthreads-1
+	// - return value = error code (0: success)
+	virtual int process_frame(int ithread, const merlin_frame_item & item, const double * buf) = 0;
+
+	// processes the raw data pdata of one frame as stored in the data
+	// file, called concurrently from threads 0 ... nthreads-1 when all
+	// operations of a pass use raw frames
+	// - return value = error code (0: success)
+	virtual int process_raw(int ithread, const merlin_frame_item & item, const char * pdata);
+
+	// writes intermediate results of the first n_frames_done frames
+	// while frames are processed in parts (see merlin_params::blive),
+	// result items of frames not yet processed are zero, operations
+	// without intermediate results do nothing
+	// - return value = error code (0: success)
+	virtual int publish(merlin_engine & eng, size_t n_frames_done);
+
+	// limits the results to the first n_frames_done frames when a pass
+	// stops before all frames are processed, finish then writes the
+	// results of these frames
+	void truncate(size_t n_frames_done);
+
+	// reduces the results and writes them to the output files
+	// - return value = error code (0: success)
+	virtual int finish(merlin_engine & eng) = 0;
+};
+
+
+// returns the number of 64-bit words per pixel needed to sum up the
+// squared values of n frames of *pprm exactly (1: 64 bit, 2: 128 bit)
+int integer_moment_words(merlin_params * pprm, size_t n);
+
+// adds the values of frame buf (integer counts) to the sums isum and
+// the squares to the sums isqr of nlen pixels, with nw words per pixel,
+// 128-bit sums are stored as low and high word
+void add_integer_moments(size_t nlen, int nw, unsigned __int64 * isum, unsigned __int64 * isqr, const double * buf);
+
+// adds the sums isum_b and isqr_b to isum_a and isqr_a of nlen pixels
+// with nw words per pixel, the result does not depend on the order of
+// additions
+void merge_integer_moments(size_t nlen, int nw, unsigned __int64 * isum_a, unsigned __int64 * isqr_a, const unsigned __int64 * isum_b, const unsigned __int64 * isqr_b);
+
+// calculates the mean and the variance of n samples from the 128-bit
+// sum of values (shi, slo) and sum of squares (qhi, qlo)
+void integer_moments(unsigned __int64 n, unsigned __int64 shi, unsigned __int64 slo, unsigned __int64 qhi, unsigned __int64 qlo, double & mean, double & var);
+
+// averages frames, writes "_avg.dat" and "_sdev.dat", the frame values
+// are accumulated exactly in 64-bit integers, or in 128-bit integers
+// when the sums of squares could overflow, so that the result does not
+// depend on the distribution of frames over threads
+class merlin_op_average : public merlin_operation
+{
+public:
+	merlin_op_average();
+	~merlin_op_average();
+protected:
+	int nw; // 64-bit words per pixel of the accumulation buffers
+	std::vector<unsigned __int64*> v_isumbuf; // per-thread integer accumulation buffers of values
+	std::vector<unsigned __int64*> v_isqrbuf; // per-thread integer accumulation buffers of squares
+	void free_buffers(void);
+	// reduces the per-thread accumulators of nres frames to the mean
+	// resbuf and the variance devbuf, the accumulators are kept
+	void reduce(merlin_engine & eng, size_t nres, double * resbuf, double * devbuf);
+	// applies the corrections and writes the average and standard
+	// deviation of nres frames, with text output if btell
+	int write_results(size_t nres, double * resbuf, double * devbuf, bool btell);
+public:
+	int init(merlin_params * pprm_in);
+	int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+	int process_frame(int ithread, const merlin_frame_item & item, const double * buf);
+	int process_raw(int ithread, const merlin_frame_item & item, const char * pdata);
+	int publish(merlin_engine & eng, size_t n_frames_done);
+	int finish(merlin_engine & eng);
+};
+
+
+// applies the gain and defect corrections of *pprm to the mean frame
+// meanbuf and to the variance frame varbuf, which is turned into the
+// standard deviation
+// - return value = error code (0: success)
+int correct_moments(merlin_params * pprm, size_t nlen, double * meanbuf, double * varbuf);
+
+// running sums of one thread for one scan tile
+struct merlin_tile_slot {
+	int itile = -1; // tile index (-1: unused)
+	size_t count = 0; // number of accumulated frames
+	size_t nuse = 0; // last use, the least recently used slot is dropped first
+	unsigned __int64 * isumbuf = NULL; // sums of values
+	unsigned __int64 * isqrbuf = NULL; // sums of squares
+};
+
+// averages frames in several scan rois (tiles), writes the average and
+// standard deviation frames of all tiles stacked to "_avg.dat" and
+// "_sdev.dat" and the tile rois to "_tiles.txt"; each thread keeps the
+// integer sums (see merlin_op_average) of the last few tiles it worked
+// on, a tile receives sums only when a thread drops it, and it is
+// written and released as soon as all its frames are added; tiles
+// exceeding merlin_params::ntilememory are averaged in batches, the
+// first batch in the pass of the operation and each further batch in
+// another pass over its frames from finish
+class merlin_op_tiles : public merlin_operation
+{
+public:
+	merlin_op_tiles();
+	~merlin_op_tiles();
+protected:
+	int nw; // 64-bit words per pixel of the accumulation buffers
+	int nslot; // number of slots per thread, more than tiles per frame
+	bool bgrid; // regular tile grid, tile index from the scan position
+	merlin_roi grid_roi; // scan roi covered by the tile grid
+	merlin_pix grid_size; // tile size of the grid
+	int grid_ntx; // number of tiles per grid row
+	int row_y0; // first scan row of the tile list
+	std::vector<size_t> v_row_ofs; // offsets of each scan row in v_row_tile
+	std::vector<int> v_row_tile; // tiles of the tile list touching each scan row
+	std::vector<merlin_roi> v_tile; // scan rois of the tiles at the time of the command
+	std::vector<size_t> v_total; // number of frames of each tile in the pass
+	std::vector<size_t> v_count; // number of frames added to each tile
+	std::vector<unsigned __int64*> v_isumbuf; // sums of values of each tile, while incomplete
+	std::vector<unsigned __int64*> v_isqrbuf; // sums of squares of each tile, while incomplete
+	std::vector<std::mutex> v_lock; // lock of each tile
+	size_t batch_t0; // first tile of the current batch
+	size_t batch_t1; // end of the tiles of the current batch
+	size_t batch_size; // number of tiles per batch
+	std::vector<merlin_tile_slot> v_slot; // nslot slots of each thread
+	std::vector<size_t> v_thr_nuse; // per-thread use counter of the slots
+	std::vector<std::vector<int>> v_thr_tiles; // per-thread list of tiles of the current frame
+	std::mutex lock_out; // lock of the output files
+	std::ofstream fout_avg; // stacked average frames
+	std::ofstream fout_sdev; // stacked standard deviation frames
+	void free_buffers(void);
+	// collects the indices of the tiles containing scan pixel pos in v_idx
+	void get_tiles(const merlin_pix & pos, std::vector<int> & v_idx);
+	// adds frame buf to the slot of thread ithread for tile itile
+	int add_frame(int ithread, int itile, const double * buf);
+	// adds the sums of a slot to its tile and writes the tile when complete
+	int drop_slot(merlin_tile_slot & slot);
+	// writes the average and standard deviation of tile itile, call with
+	// the tile locked
+	int write_tile(int itile);
+	// adds the remaining sums of all threads to their tiles and writes
+	// the tiles of the current batch
+	int finish_batch(void);
+public:
+	int init(merlin_params * pprm_in);
+	int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+	int process_frame(int ithread, const merlin_frame_item & item, const double * buf);
+	int finish(merlin_engine & eng);
+};
+
+
+// integrates an annular range, writes one value per frame
+class merlin_op_annular : public merlin_operation
+{
+public:
+	merlin_op_annular();
+	~merlin_op_annular();
+protected:
+	std::vector<size_t> v_span; // pixel ranges of the detector function
+	double * detbuf; // detector function buffer
+	double * resbuf; // result buffer
+	// writes the result buffer, with text output if btell
+	int write_results(bool btell);
+public:
+	int init(merlin_params * pprm_in);
+	int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+	int process_frame(int ithread, const merlin_frame_item & item, const double * buf);
+	int publish(merlin_engine & eng, size_t n_frames_done);
+	int finish(merlin_engine & eng);
+};
+
+
+// calculates the center of mass in an annular range, writes the
+// reference integral and the two center of mass components per frame
+class merlin_op_com : public merlin_operation
+{
+public:
+	merlin_op_com();
+	~merlin_op_com();
+protected:
+	std::vector<size_t> v_span; // pixel ranges of the detector function
+	double * detbuf; // detector function buffer
+	double * xbuf; // x-coordinates of the data frame times the detector function
+	double * ybuf; // y-coordinates of the data frame times the detector function
+	double * resbuf00; // result buffer - integral
+	double * resbuf10; // result buffer - com.x
+	double * resbuf11; // result buffer - com.y
+	// writes the result buffers, with text output if btell
+	int write_results(bool btell);
+public:
+	int init(merlin_params * pprm_in);
+	int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+	int process_frame(int ithread, const merlin_frame_item & item, const double * buf);
+	int publish(merlin_engine & eng, size_t n_frames_done);
+	int finish(merlin_engine & eng);
+};
+
+
+// radial profiles of all frames in a scan roi, sums over radial bins
+// [k * bin_width, (k + 1) * bin_width) around the annular offset, each
+// optionally split into n_phi azimuthal sectors of equal size starting
+// at angle phi0
+class merlin_radial_profile
+{
+public:
+	// constructor
+	merlin_radial_profile();
+	// destructor
+	~merlin_radial_profile();
+
+protected:
+	double * cube; // n_items x n_bins x n_phi sums, bins of a frame are contiguous
+	bool bvalid; // flags that the cube is complete and may be used
+	bool bfull; // flags that the bins cover all pixels of the frame
+	double bin_width; // width of the bins in calibrated units
+	int n_bins; // number of radial bins per frame
+	int n_phi; // number of azimuthal sectors per radial bin
+	double phi0; // start angle of the first sector in radians
+	size_t n_items; // number of frames in the scan roi
+	merlin_roi scan_roi; // scan roi of the profiles
+	merlin_frame_calib frame_calib; // frame calibration of the profiles
+	merlin_pos offset_annular; // center of the profiles
+
+	// member functions
+public:
+	// removes the profiles
+	void clear(void);
+
+	// returns true if profiles are present
+	bool is_valid(void) const;
+
+	// takes the cube buffer (n_items_in x n_bins_in x n_phi_in values
+	// allocated with calloc) and the parameters used to calculate it
+	void set(double * cube_in, size_t n_items_in, int n_bins_in, int n_phi_in, double bin_width_in, double phi0_in, bool bfull_in,
+		const merlin_roi & roi, const merlin_frame_calib & calib, const merlin_pos & offset);
+
+	// checks if the current annular range of *pprm can be integrated
+	// from the profiles, which requires the same scan roi, frame
+	// calibration, and offset and range limits on bin boundaries
+	// - output ibin0, ibin1 = bins [ibin0, ibin1) covering the range
+	bool covers(merlin_params * pprm, int & ibin0, int & ibin1) const;
+
+	// integrates bins [ibin0, ibin1) for all frames to res (n_items values)
+	// - return value = error code (0: success)
+	int integrate(int ibin0, int ibin1, double * res) const;
+
+	// integrates bins [ibin0, ibin1) of each azimuthal sector for all
+	// frames to seg (n_items x n_phi values) and calculates the
+	// differential signals dpcx, dpcy = sum_k seg_k * (cos, sin)(phi_k)
+	// and the center of mass comx, comy from the bin centers
+	// (n_items values each, output arrays may be NULL)
+	// - return value = error code (0: success)
+	int integrate_segments(int ibin0, int ibin1, double * seg, double * dpcx, double * dpcy, double * comx, double * comy) const;
+
+	// returns the number of frames
+	size_t get_num_items(void) const;
+
+	// returns the number of azimuthal sectors
+	int get_num_phi(void) const;
+};
+
+
+// calculates radial profiles for all frames, writes n_bins values per
+// frame, or n_bins x n_phi values in polar mode, and keeps the profiles
+// in *pprof for later annular integrations and segment images
+class merlin_op_radial : public merlin_operation
+{
+public:
+	merlin_op_radial(merlin_radial_profile * pprof_in, bool bpolar_in = false);
+	~merlin_op_radial();
+protected:
+	merlin_radial_profile * pprof; // receives the profiles after the pass
+	int * binidx; // bin index of each frame pixel (-1: not binned)
+	double * cube; // result buffer
+	bool bpolar; // flags azimuthal sectors
+	double bin_width; // width of the bins in calibrated units
+	int n_bins; // number of radial bins
+	int n_phi; // number of azimuthal sectors
+	double phi0; // start angle of the first sector in radians
+	bool bfull; // all frame pixels are binned
+	merlin_roi scan_roi; // scan roi at the time of the command
+	merlin_frame_calib frame_calib; // frame calibration at the time of the command
+	merlin_pos offset_annular; // center of the profiles
+public:
+	int init(merlin_params * pprm_in);
+	int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+	int process_frame(int ithread, const merlin_frame_item & item, const double * buf);
+	int finish(merlin_engine & eng);
+};
+
+
+// integrates the current annular range from the radial profiles *pprof
+// and writes the result like integrate_annular_range
+// - return value = error code (0: success)
+int merlin_integrate_radial_profile(merlin_params * pprm, merlin_radial_profile * pprof);
+
+// integrates the current annular range from the polar profiles *pprof
+// per azimuthal sector and writes segment images, differential phase
+// contrast, and center of mass images
+// - return value = error code (0: success)
+int merlin_polar_segments(merlin_params * pprm, merlin_radial_profile * pprof);
+
+
+// integrates all virtual detectors of a detector matrix, frames are
+// collected per thread in blocks of MERLIN_DETECTOR_BLOCK and multiplied
+// with the sparse matrix together, writes one image per detector
+class merlin_op_detectors : public merlin_operation
+{
+public:
+	merlin_op_detectors(const merlin_detector_matrix * pdet_in);
+	~merlin_op_detectors();
+protected:
+	const merlin_detector_matrix * pdet; // detectors at the time of construction
+	merlin_detector_matrix det; // copy of the detectors taken by init
+	std::vector<double*> v_blk; // per-thread frame blocks, pixel-major
+	std::vector<size_t*> v_blkires; // per-thread result index of the frames in the block
+	std::vector<size_t> v_blkn; // per-thread number of frames in the block
+	double * resbuf; // result buffer, n_det x n_items
+	void free_buffers(void);
+	// applies the detectors to the frames of partial blocks
+	void flush_blocks(void);
+	// writes the result buffer, with text output if btell
+	int write_results(bool btell);
+public:
+	int init(merlin_params * pprm_in);
+	int begin(size_t n_items_in, size_t n_frames_in, int nthreads_in);
+	int process_frame(int ithread, const merlin_frame_item & item, const double * buf);
+	int publish(merlin_engine & eng, size_t n_frames_done);
+	int finish(merlin_engine & eng);
+};
+
+
+// runs the operations v_ops on all frames of the current scan roi in
+// a single pass, frames are read, decoded, and corrected once and then
+// handed to each operation. In live mode (merlin_params::blive) frames
+// are processed in acquisition order as they are written to the data
+// files, intermediate results are published whenever scan rows of the
+// roi are complete. With an open data stream (merlin_params::stream)
+// frames are processed in parts as they are received, the stream
+// passes only once.
+// - return value = error code (0: success), first error of the pass or
+//   of the operations, 120 = live processing stopped before all frames
+//   were written or frames were missing in the data stream
+//   (intermediate results are published), 122 = the data stream was
+//   used by a previous pass, 123 = failed to receive frames
+int merlin_run_operations(merlin_params * pprm, std::vector<merlin_operation*> & v_ops);
@@ -0,0 +1,234 @@
+// file : "merlin_prefetch.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the asynchronous frame prefetching pipeline.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_prefetch.h"
+#include <chrono>
+
+
+merlin_prefetch::merlin_prefetch()
+{
+	pprm = NULL;
+	pv_items = NULL;
+	ndepth = 0;
+	nfrm_pix = 0;
+	nitem_read = 0;
+	nitem_sync = 0;
+	nitem_run = 0;
+	nerr_read = 0;
+	bstop = false;
+	bdone = false;
+	nwait_reader = 0;
+	nwait_proc = 0;
+	twait_reader = 0.;
+	twait_proc = 0.;
+}
+
+merlin_prefetch::~merlin_prefetch()
+{
+	stop();
+}
+
+int merlin_prefetch::start(merlin_params * pprm_in, const std::vector<merlin_frame_item> * pv_items_in, int ndepth_in)
+{
+	int nerr = 0;
+	int i = 0;
+	int nbuf = 0;
+	stop();
+	if (NULL == pprm_in) {
+		return 1; // missing parameter 1
+	}
+	if (NULL == pv_items_in) {
+		return 2; // missing parameter 2
+	}
+	pprm = pprm_in;
+	pv_items = pv_items_in;
+	ndepth = (ndepth_in > 0 ? ndepth_in : 0);
+	nfrm_pix = (size_t)pprm->hdr_frm.n_columns * pprm->hdr_frm.n_rows;
+	nitem_read = 0;
+	nitem_sync = 0;
+	nitem_run = 0;
+	nerr_read = 0;
+	bstop = false;
+	bdone = false;
+	nwait_reader = 0;
+	nwait_proc = 0;
+	twait_reader = 0.;
+	twait_proc = 0.;
+	if (nfrm_pix == 0) {
+		return 3; // invalid frame size
+	}
+	nerr = reader.init(pprm);
+	if (nerr != 0) {
+		return 10 + nerr; // reader initialization failed
+	}
+	nbuf = (ndepth > 0 ? ndepth : 1);
+	v_buf.assign(nbuf, NULL);
+	v_slot_item.assign(nbuf, merlin_frame_item());
+	v_slot_err.assign(nbuf, 0);
+	q_free.clear();
+	q_filled.clear();
+	for (i = 0; i < nbuf; i++) {
+		v_buf[i] = (double*)calloc(nfrm_pix, sizeof(double));
+		if (NULL == v_buf[i]) {
+			stop();
+			return 100; // buffer allocation failed
+		}
+		q_free.push_back(i);
+	}
+	if (ndepth > 0) { // start reading ahead
+		th_reader = std::thread(&merlin_prefetch::run_reader, this);
+	}
+	return 0;
+}
+
+void merlin_prefetch::stop(void)
+{
+	size_t i = 0;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bstop = true;
+	}
+	cv_free.notify_all();
+	if (th_reader.joinable()) {
+		th_reader.join();
+	}
+	for (i = 0; i < v_buf.size(); i++) {
+		if (NULL != v_buf[i]) free(v_buf[i]);
+	}
+	v_buf.clear();
+	v_slot_item.clear();
+	v_slot_err.clear();
+	q_free.clear();
+	q_filled.clear();
+	reader.close();
+}
+
+void merlin_prefetch::run_reader(void)
+{
+	int islot = -1;
+	int nerr = 0;
+	size_t i = 0;
+	size_t irun = 0; // end of the current run of consecutive frames
+	size_t n = pv_items->size();
+	std::chrono::steady_clock::time_point t0;
+	for (i = 0; i < n; i++) {
+		{ // get a free buffer
+			std::unique_lock<std::mutex> lock(mtx);
+			if (q_free.empty() && !bstop) { // back-pressure from processing
+				nwait_reader++;
+				t0 = std::chrono::steady_clock::now();
+				cv_free.wait(lock, [this] { return bstop || !q_free.empty(); });
+				twait_reader += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			}
+			if (bstop) break;
+			islot = q_free.front();
+			q_free.pop_front();
+		}
+		// read outside of the lock
+		if (i >= irun) { // frames which can be read together
+			irun = i + merlin_frame_run(*pv_items, i, n);
+		}
+		nerr = reader.read_frame((*pv_items)[i].idx, v_buf[islot], irun - i);
+		{ // hand the buffer over to processing
+			std::lock_guard<std::mutex> lock(mtx);
+			v_slot_item[islot] = (*pv_items)[i];
+			v_slot_err[islot] = nerr;
+			q_filled.push_back(islot);
+			nitem_read++;
+			if (nerr != 0) nerr_read = nerr;
+		}
+		cv_filled.notify_one();
+		if (nerr != 0) break; // stop reading after errors
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bdone = true;
+	}
+	cv_filled.notify_all();
+}
+
+int merlin_prefetch::acquire(int & islot, merlin_frame_item & item, double ** pbuf)
+{
+	int nerr = 0;
+	std::chrono::steady_clock::time_point t0;
+	islot = -1;
+	if (NULL == pprm || NULL == pbuf || v_buf.size() == 0) {
+		return 1; // not started or missing parameter
+	}
+	if (ndepth == 0) { // synchronous reading
+		if (nitem_sync >= pv_items->size()) {
+			return -1; // end of list
+		}
+		if (nitem_sync >= nitem_run) { // frames which can be read together
+			nitem_run = nitem_sync + merlin_frame_run(*pv_items, nitem_sync, pv_items->size());
+		}
+		item = (*pv_items)[nitem_sync];
+		nitem_sync++;
+		islot = 0;
+		*pbuf = v_buf[0];
+		return reader.read_frame(item.idx, v_buf[0], nitem_run - nitem_sync + 1);
+	}
+	std::unique_lock<std::mutex> lock(mtx);
+	if (q_filled.empty() && !bdone) { // processing waits for data
+		nwait_proc++;
+		t0 = std::chrono::steady_clock::now();
+		cv_filled.wait(lock, [this] { return bdone || !q_filled.empty(); });
+		twait_proc += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}
+	if (q_filled.empty()) {
+		return -1; // end of list
+	}
+	islot = q_filled.front();
+	q_filled.pop_front();
+	item = v_slot_item[islot];
+	*pbuf = v_buf[islot];
+	nerr = v_slot_err[islot];
+	return nerr;
+}
+
+void merlin_prefetch::release(int islot)
+{
+	if (ndepth == 0 || islot < 0 || islot >= (int)v_buf.size()) {
+		return; // nothing to do
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		q_free.push_back(islot);
+	}
+	cv_free.notify_one();
+}
+
+void merlin_prefetch::print_stats(void)
+{
+	if (ndepth == 0) {
+		return; // no statistics in synchronous mode
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	std::cout << "- prefetch depth " << ndepth << ", " << nitem_read << " frames read ahead\n";
+	std::cout << "  reader waited " << nwait_reader << " times for free buffers (" << twait_reader << " s)\n";
+	std::cout << "  processing waited " << nwait_proc << " times for frame data (" << twait_proc << " s)\n";
+}
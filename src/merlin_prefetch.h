@@ -0,0 +1,102 @@
+// file : "merlin_prefetch.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the asynchronous frame prefetching pipeline used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include "merlin_reader.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Reads and decodes the frames of a list into a bounded ring of frame
+// buffers ahead of processing. A reader thread fills free buffers while
+// the processing side takes filled buffers, works on them and releases
+// them again. With a depth of 0 frames are read synchronously in the
+// calling thread when they are acquired.
+class merlin_prefetch
+{
+public:
+	// constructor
+	merlin_prefetch();
+	// destructor
+	~merlin_prefetch();
+
+protected:
+	merlin_params * pprm; // parameters with the frame file positions
+	const std::vector<merlin_frame_item> * pv_items; // frames to deliver in this order
+	merlin_frame_reader reader; // frame data input
+	int ndepth; // number of frame buffers in the ring
+	size_t nfrm_pix; // number of pixels per frame
+	size_t nitem_read; // number of items read by the reader thread
+	size_t nitem_sync; // number of items delivered in synchronous mode
+	size_t nitem_run; // end of the run of consecutive frames in synchronous mode
+	int nerr_read; // error code of the reader thread
+	bool bstop; // flags the reader thread to stop
+	bool bdone; // flags that the reader thread finished
+	std::vector<double*> v_buf; // frame buffers of the ring
+	std::vector<merlin_frame_item> v_slot_item; // frame items held by the buffers
+	std::vector<int> v_slot_err; // read error codes of the buffers
+	std::deque<int> q_free; // buffers free for reading
+	std::deque<int> q_filled; // buffers filled with frame data in list order
+	std::thread th_reader; // reader thread
+	std::mutex mtx; // protects the queues and the state
+	std::condition_variable cv_free; // signals free buffers
+	std::condition_variable cv_filled; // signals filled buffers
+
+	// back-pressure statistics
+	size_t nwait_reader; // number of times the reader waited for a free buffer
+	size_t nwait_proc; // number of times processing waited for data
+	double twait_reader; // time in seconds the reader waited for free buffers
+	double twait_proc; // time in seconds processing waited for data
+
+	// member functions
+protected:
+	// reader thread function
+	void run_reader(void);
+
+public:
+	// starts delivering frames of the list *pv_items_in
+	// - input pprm_in = parameters with the frame file positions
+	// - input pv_items_in = frames to read (must persist until stop)
+	// - input ndepth_in = number of frames read ahead (0: synchronous)
+	// - return value = error code (0: success)
+	int start(merlin_params * pprm_in, const std::vector<merlin_frame_item> * pv_items_in, int ndepth_in);
+
+	// stops reading, waits for the reader thread and frees all buffers
+	void stop(void);
+
+	// waits for the next frame in list order
+	// - output islot = buffer index to be given to release
+	// - output item = frame item of the delivered data
+	// - output pbuf = decoded frame data
+	// - return value = error code (0: success, -1: end of list)
+	int acquire(int & islot, merlin_frame_item & item, double ** pbuf);
+
+	// returns a buffer obtained by acquire to the ring
+	void release(int islot);
+
+	// writes back-pressure statistics to std::cout
+	void print_stats(void);
+};
@@ -26,6 +26,9 @@ This file is part of Merlinio.
 
 #include "pch.h"
 #include "merlin_prm.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 merlin_params::merlin_params()
 {
@@ -33,10 +36,24 @@ merlin_params::merlin_params()
 	binteractive = false;
 	bscanframeheaders = false;
 	swapbytes = false;
+	bmemorymap = true;
+	bframeindex = true;
+	bfuse = false;
+	bdirect = false;
+	bdropbehind = false;
+	bshard = false;
+	blive = false;
 	gaincorrect = false;
 	defects_modified = false;
 
 	ndebug = 0;
+	nprefetch = 4;
+	nthreads = 0;
+	nqdepth = 8;
+	nhotwindow = 0;
+	ntilememory = (size_t)1024 * 1048576;
+	nlivetimeout = 60;
+	nserveport = 0;
 
 	frame_calib.offset = { 0.,0. };
 	frame_calib.a0 = { 1., 0. };
@@ -44,21 +61,32 @@ merlin_params::merlin_params()
 
 	range_annular = { 0., 0. };
 	offset_annular = { 0., 0. };
+	radial_bin_width = 1.;
+	radial_bin_num = 0;
+	polar_phi_num = 4;
+	polar_phi_offset = 0.;
 
 	scan_rect_roi = { 0, 0, 0, 0 };
+	scan_tile_size = { 0, 0 };
+	v_scan_tile_roi.clear();
 
 	str_file_input = "input";
+	str_stream = "";
 	str_file_output = "output";
 	str_file_ctrl = "merlinio_control";
 
 	v_defect_corr.clear();
+	v_defect_map.clear();
+	v_defect_ofs.clear();
+	v_defect_nbr.clear();
+	v_defect_wgt.clear();
 	img_gaincorrect = NULL;
 }
 
 merlin_params::~merlin_params()
 {
-	v_frm_file.clear();
-	v_frm_pos.clear();
+	frm_index.clear();
+	data_map.close();
 	v_str_ctrl.clear();
 	v_defect_corr.clear();
 	if (NULL != img_gaincorrect) { free(img_gaincorrect); }
@@ -91,6 +119,30 @@ int merlin_params::read_header(void)
 	return 0;
 }
 
+int merlin_params::open_stream(void)
+{
+	int nerr = 0;
+	if (btalk) {
+		std::cout << std::endl;
+		std::cout << "Receiving the acquisition header from the data stream at " << str_stream << std::endl;
+	}
+	nerr = stream.open(str_stream, &hdr, &hdr_frm);
+	if (nerr != 0) {
+		return nerr;
+	}
+	if (btalk) { // tell infos
+		std::cout << "- timestamp: " << hdr.s_timestamp << std::endl;
+		std::cout << "- # frames: " << hdr.n_frames << std::endl;
+		std::cout << "- # columns: " << hdr.n_columns << std::endl;
+		std::cout << "- # rows: " << hdr.n_rows << std::endl;
+		if (ndebug > 0) {
+			std::cout << "- # frame header bytes: " << hdr.n_fhdr_bytes << std::endl;
+			std::cout << "- # frame data bytes: " << hdr.n_data_bytes << std::endl;
+		}
+	}
+	return 0;
+}
+
 int merlin_params::read_frame_headers(void)
 {
 	int nerr = 0; // error code
@@ -98,8 +150,10 @@ int merlin_params::read_frame_headers(void)
 	bool bread = true; // header reading flag
 	bool bconsistent = true;
 	int ierr = 0;
-	int i = 0, lfile = 0, nextfrm = 0;
-	int n_frm = 0; // count number of input frames
+	int lfile = 0;
+	__int64 nextfrm = 0;
+	__int64 n_frm = 0; // count number of input frames
+	__int64 n_frm_file0 = 0; // number of frames before the current file
 	size_t i_pos = 0; // read position
 	struct stat statbuf;
 	std::string str_file = "";
@@ -109,9 +163,19 @@ int merlin_params::read_frame_headers(void)
 	merlin_frame_hdr fhdr;
 	size_t nhsize = 0, ndsize = 0;
 
+	if (bframeindex && !blive && 0 == load_frame_index()) { // frame positions known from a previous scan
+		goto _exit_point;
+	}
+
+	if (bscanframeheaders && bmemorymap) { // careful scan of all headers in the mapped data files
+		nerr = scan_frame_headers_mapped();
+		if (nerr == 0) goto _save_index;
+		if (nerr < 100) return nerr;
+		nerr = 0; // mapping failed, scan with file streams
+	}
+
 	hdr.n_files = 0; // reset number of files
-	v_frm_file.clear(); // clear list of frame to file indices
-	v_frm_pos.clear(); // clear list of frame to file positions
+	frm_index.clear(); // clear list of frame file indices and positions
 	hdr.n_fhdr_bytes = 0; // reset header size
 	hdr.n_data_bytes = 0; // reset data size
 	// get information from the first frame header -> frame size and number of bytes per item
@@ -121,6 +185,7 @@ int merlin_params::read_frame_headers(void)
 		if (bfilefound) { // file exists
 			fin.open(str_file); // open the file
 			if (fin.is_open()) { // ...
+				n_frm_file0 = n_frm;
 				bread = true; // always read the first header of a file
 				while (bread) { // loop in case of header scanning request
 					
@@ -134,6 +199,7 @@ int merlin_params::read_frame_headers(void)
 							hdr.n_fhdr_bytes = (size_t)hdr_frm.n_size;
 							hdr.n_data_bytes = ((size_t)hdr_frm.n_columns*hdr_frm.n_rows*hdr_frm.n_bpi >> 3);
 							dpos = (std::streampos)(hdr.n_fhdr_bytes + hdr.n_data_bytes); // remember the expected frame shift in the file
+							frm_index.clear((__int64)(hdr.n_fhdr_bytes + hdr.n_data_bytes)); // regular frame distance
 						}
 						fpos = fin.tellg(); // position in file after the header
 						if (bscanframeheaders) { // scan all headers individually ...
@@ -147,8 +213,7 @@ int merlin_params::read_frame_headers(void)
 								);
 							bconsistent &= (fhdr.i_seq == n_frm); // include the sequence consistency
 							if (bconsistent) { // we conclude that this frame belongs to the sequence
-								v_frm_pos.push_back(fpos); // store data offset for this frame
-								v_frm_file.push_back(hdr.n_files); // store file index for this frame
+								frm_index.push_back(hdr.n_files, fpos); // store data offset for this frame
 								n_frm++; // increment the frame counter
 								fpos += (std::streampos)hdr.n_data_bytes; // next header position
 								fin.seekg(fpos); // try stepping to the next data position in the file
@@ -164,26 +229,19 @@ int merlin_params::read_frame_headers(void)
 						else { // no full scan - assuming regular (same header) file content
 							if (n_frm == 0) { // this is the first item
 								// add fhdr right away
-								v_frm_pos.push_back(fpos); // store data offset for this frame
-								v_frm_file.push_back(hdr.n_files); // store file index for this frame
+								frm_index.push_back(hdr.n_files, fpos); // store data offset for this frame
 								n_frm++; // increment the frame counter
 							}
 							else { // this is a second file ...
-								lfpos = v_frm_pos[n_frm-1]; // get last added frame position in previous file
-								lfile = v_frm_file[n_frm - 1]; // get last added file index (previous file)
+								frm_index.get(n_frm - 1, lfile, lfpos); // get last added frame position and file index in previous file
 								nextfrm = n_frm; // this is the next frame index expected in the sequence
 								if (fhdr.i_seq > n_frm) { // frames are missing in the sequence between the last added and the new fhdr
-									for (i = nextfrm; i < fhdr.i_seq; i++) {
-										// add frames
-										lfpos += dpos; // shift to the next frame in the file
-										v_frm_pos.push_back(lfpos); // store the position
-										v_frm_file.push_back(lfile); // store the file index
-										n_frm++;
-									}
+									// add frames at regular positions following the last added frame
+									frm_index.push_back_regular(lfile, lfpos + dpos, fhdr.i_seq - nextfrm);
+									n_frm += (fhdr.i_seq - nextfrm);
 								}
 								// add fhdr
-								v_frm_pos.push_back(fpos); // store data offset for this frame
-								v_frm_file.push_back(hdr.n_files); // store file index for this frame
+								frm_index.push_back(hdr.n_files, fpos); // store data offset for this frame
 								n_frm++; // increment the frame counter
 							} // ... if (n_frm == 0) ...
 							bread = false; // stop reading headers from this file
@@ -213,6 +271,9 @@ int merlin_params::read_frame_headers(void)
 			if (nerr != 0) { // return in case of errors
 				return nerr;
 			}
+			if (blive && n_frm == n_frm_file0) { // first header not yet written, see update_frame_index
+				break;
+			}
 			hdr.n_files++; // count number of files
 		}
 	} // while (bfilefound)
@@ -222,27 +283,29 @@ int merlin_params::read_frame_headers(void)
 		return 4;
 	}
 
-	if (hdr.n_files > 0 && n_frm < hdr.n_frames) { // expected frames are missing
+	if (hdr.n_files > 0 && n_frm < hdr.n_frames && !blive) { // expected frames are missing
 		if (bscanframeheaders) { // ... errro in case of scan mode
 			std::cerr << "Error: frame header scan is missing frames.\n";
 			return 5;
 		}
 		else { // add missing frames in case of fast mode
-			lfpos = v_frm_pos[n_frm - 1]; // get last added frame position in last file
-			lfile = v_frm_file[n_frm - 1]; // get last added file index (previous file)
+			frm_index.get(n_frm - 1, lfile, lfpos); // get last added frame position and file index in last file
 			nextfrm = n_frm; // this is the next frame index expected in the sequence
-			for (i = nextfrm; i < hdr.n_frames; i++) {
-				// add frames
-				lfpos += dpos; // shift to the next frame in the file
-				v_frm_pos.push_back(lfpos); // store the position
-				v_frm_file.push_back(lfile); // store the file index
-				n_frm++;
-			}
+			// add frames at regular positions following the last added frame
+			frm_index.push_back_regular(lfile, lfpos + dpos, hdr.n_frames - nextfrm);
+			n_frm += (hdr.n_frames - nextfrm);
 		}
 	}
 
+_save_index:
+	if (bframeindex && !blive) { // keep the scan result for later runs
+		save_frame_index();
+	}
+
+_exit_point:
 	if (nerr == 0 && btalk && ndebug > 0) {
 		std::cout << "- # files: " << hdr.n_files << std::endl;
+		std::cout << "- frame index: " << frm_index.get_segments().size() << " segments, " << frm_index.get_exceptions().size() << " exceptions (" << frm_index.get_memory_size() << " bytes)" << std::endl;
 		std::cout << "- # frame header bytes: " << hdr.n_fhdr_bytes << std::endl;
 		std::cout << "- # frame data bytes: " << hdr.n_data_bytes << std::endl;
 	}
@@ -250,6 +313,322 @@ int merlin_params::read_frame_headers(void)
 	return nerr;
 }
 
+int merlin_params::update_frame_index(__int64 & n_ready)
+{
+	int nerr = 0; // error code
+	int lfile = 0;
+	__int64 n_frm = frm_index.size(); // number of frames in the index
+	__int64 nadd = 0; // number of frames added
+	__int64 stride = (__int64)(hdr.n_fhdr_bytes + hdr.n_data_bytes); // regular frame distance
+	__int64 ndata = (__int64)hdr.n_data_bytes;
+	__int64 lpos = 0;
+	std::streampos fpos = 0, lfpos = 0;
+	std::string str_file = "";
+	std::ifstream fin;
+	merlin_file_stamp stamp;
+	merlin_frame_hdr fhdr;
+	n_ready = 0;
+	if (n_frm == 0 || ndata == 0) {
+		return 1; // no frame index, see read_frame_headers
+	}
+	while (n_frm < hdr.n_frames) {
+		// complete frames following the last frame of the index in its file
+		frm_index.get(n_frm - 1, lfile, lfpos);
+		lpos = (__int64)(std::streamoff)lfpos;
+		str_file = str_file_input + std::to_string(lfile + 1) + ".mib";
+		if (0 != merlin_get_file_stamp(str_file, stamp)) {
+			std::cerr << "Error: data file " << str_file << " disappeared.\n";
+			return 2;
+		}
+		nadd = 0;
+		if (stamp.n_size >= lpos + stride + ndata) {
+			nadd = std::min((stamp.n_size - lpos - stride - ndata) / stride + 1, hdr.n_frames - n_frm);
+		}
+		if (nadd > 0) {
+			frm_index.push_back_regular(lfile, lfpos + (std::streamoff)stride, nadd);
+			n_frm += nadd;
+			continue;
+		}
+		// first frame of the next data file
+		str_file = str_file_input + std::to_string(hdr.n_files + 1) + ".mib";
+		if (0 != merlin_get_file_stamp(str_file, stamp)) {
+			break; // the next file is not yet created
+		}
+		fin.open(str_file);
+		if (!fin.is_open()) {
+			break; // try again later
+		}
+		nerr = merlin_read_frame_header(&fin, &fhdr);
+		fpos = fin.tellg();
+		fin.close();
+		if (nerr != 0) {
+			nerr = 0;
+			break; // the header is not yet written completely
+		}
+		if (fhdr.n_size != hdr_frm.n_size || fhdr.n_bpi != hdr_frm.n_bpi || fhdr.n_columns != hdr_frm.n_columns || fhdr.n_rows != hdr_frm.n_rows) {
+			std::cerr << "Error: inconsistent frame header data in file " << str_file << ".\n";
+			return 3;
+		}
+		if (fhdr.i_seq > n_frm) { // frames are missing in the sequence, assume regular positions in the previous file
+			nadd = std::min((__int64)fhdr.i_seq, hdr.n_frames) - n_frm;
+			frm_index.push_back_regular(lfile, lfpos + (std::streamoff)stride, nadd);
+			n_frm += nadd;
+		}
+		if (n_frm >= hdr.n_frames) {
+			break;
+		}
+		frm_index.push_back(hdr.n_files, fpos); // store data offset for this frame
+		n_frm++;
+		hdr.n_files++; // count the new file
+	}
+	// only the last frame of the index may not be written completely
+	n_ready = n_frm;
+	frm_index.get(n_frm - 1, lfile, lfpos);
+	str_file = str_file_input + std::to_string(lfile + 1) + ".mib";
+	if (0 != merlin_get_file_stamp(str_file, stamp) || stamp.n_size < (__int64)(std::streamoff)lfpos + ndata) {
+		n_ready--;
+	}
+	return nerr;
+}
+
+// frame positions found in one data file by a careful header scan
+struct merlin_scan_file_result {
+	int nerr = 0; // parsing error code
+	bool bconsistent = true; // flags consistent headers in the file
+	__int64 iseq0 = 0; // sequence index of the first frame in the file
+	__int64 n_frames = 0; // number of frames in the file
+};
+
+// scans all frame headers of a data file mapped to memory (pdata, nsize)
+// and checks them against the header template *ptmpl
+static void scan_mapped_file(const char * pdata, size_t nsize, const merlin_frame_hdr * ptmpl, size_t ndata, merlin_scan_file_result * pres)
+{
+	int nerr = 0;
+	size_t pos = 0; // header position in the file
+	merlin_frame_hdr fhdr;
+	while (pos + 128 <= nsize) { // a header can start here
+		nerr = merlin_parse_frame_header(pdata + pos, nsize - pos, &fhdr, false);
+		if (nerr == 6) break; // truncated header at the end of the file
+		if (nerr != 0) {
+			pres->nerr = nerr;
+			return;
+		}
+		if (pres->n_frames == 0) {
+			pres->iseq0 = fhdr.i_seq;
+		}
+		// check consistency of the current header to the header template
+		// ... only the numbers which matter for the header and data size
+		pres->bconsistent = (
+			ptmpl->n_size == fhdr.n_size &&
+			ptmpl->n_bpi == fhdr.n_bpi &&
+			ptmpl->n_columns == fhdr.n_columns &&
+			ptmpl->n_rows == fhdr.n_rows &&
+			fhdr.i_seq == pres->iseq0 + pres->n_frames
+			);
+		if (!pres->bconsistent) {
+			return;
+		}
+		pres->n_frames++; // count the frame
+		pos += (size_t)fhdr.n_size + ndata; // next header position
+	}
+}
+
+int merlin_params::scan_frame_headers_mapped(void)
+{
+	int nerr = 0;
+	int nfiles = 0, ifile = 0, ithread = 0, nthr = 0;
+	__int64 n_frm = 0; // count number of input frames
+	struct stat statbuf;
+	std::string str_file = "";
+	std::vector<merlin_scan_file_result> v_res; // scan results per file
+	std::vector<std::thread> v_threads;
+	std::atomic<int> inext(0); // next file to scan
+	const char * pdata = NULL;
+	// find all files and map them
+	while (true) {
+		str_file = str_file_input + std::to_string(nfiles + 1) + ".mib"; // file name construction
+		if (stat(str_file.c_str(), &statbuf) != 0) break; // file does not exist
+		nfiles++;
+	}
+	if (nfiles == 0) {
+		std::cerr << "Error: found no frame headers.\n";
+		return 4;
+	}
+	nerr = data_map.open(str_file_input, nfiles);
+	if (nerr != 0) {
+		return 100 + nerr; // mapping failed
+	}
+	// the first header is the template for all headers
+	pdata = data_map.get_data(0, 0, 128);
+	if (NULL == pdata) {
+		std::cerr << "Error: found no frame headers.\n";
+		return 4;
+	}
+	nerr = merlin_parse_frame_header(pdata, data_map.get_file_size(0), &hdr_frm, true);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to read a frame header (code " << nerr << ")." << std::endl;
+		std::cerr << "Error: unknown format of file " << str_file_input + "1.mib" << " " << std::endl;
+		return 2;
+	}
+	hdr.n_fhdr_bytes = (size_t)hdr_frm.n_size;
+	hdr.n_data_bytes = ((size_t)hdr_frm.n_columns*hdr_frm.n_rows*hdr_frm.n_bpi >> 3);
+	// scan the files concurrently
+	nthr = (nthreads > 0 ? nthreads : (int)std::thread::hardware_concurrency());
+	if (nthr > nfiles) nthr = nfiles;
+	if (nthr < 1) nthr = 1;
+	v_res.resize(nfiles);
+	for (ithread = 0; ithread < nthr; ithread++) {
+		v_threads.push_back(std::thread([&]() {
+			int jfile = 0;
+			while ((jfile = inext++) < nfiles) {
+				scan_mapped_file(data_map.get_data(jfile, 0, 0), data_map.get_file_size(jfile), &hdr_frm, hdr.n_data_bytes, &v_res[jfile]);
+			}
+		}));
+	}
+	for (ithread = 0; ithread < nthr; ithread++) {
+		v_threads[ithread].join();
+	}
+	// merge the file results in sequence order
+	hdr.n_files = 0;
+	frm_index.clear((__int64)(hdr.n_fhdr_bytes + hdr.n_data_bytes));
+	for (ifile = 0; ifile < nfiles; ifile++) {
+		str_file = str_file_input + std::to_string(ifile + 1) + ".mib";
+		if (v_res[ifile].nerr != 0) {
+			std::cerr << "Error: failed to read a frame header (code " << v_res[ifile].nerr << ")." << std::endl;
+			std::cerr << "Error: unknown format of file " << str_file << " " << std::endl;
+			return 2;
+		}
+		if (!v_res[ifile].bconsistent || (v_res[ifile].n_frames > 0 && v_res[ifile].iseq0 != n_frm)) {
+			std::cerr << "Error: inconsistent frame header data.\n";
+			return 3;
+		}
+		// consistent headers are at regular positions, the first data follows the first header
+		frm_index.push_back_regular(ifile, (std::streampos)hdr.n_fhdr_bytes, v_res[ifile].n_frames);
+		n_frm += v_res[ifile].n_frames;
+		hdr.n_files++;
+	}
+	if (n_frm == 0) {
+		std::cerr << "Error: found no frame headers.\n";
+		return 4;
+	}
+	if (n_frm < hdr.n_frames) {
+		std::cerr << "Error: frame header scan is missing frames.\n";
+		return 5;
+	}
+	if (btalk && ndebug > 0) {
+		std::cout << "- scanned " << n_frm << " frame headers in " << nfiles << " mapped files on " << nthr << " threads.\n";
+	}
+	return 0;
+}
+
+int merlin_params::load_frame_index(void)
+{
+	int nerr = 0;
+	int i = 0;
+	std::string str_index = str_file_input + ".idx";
+	std::string str_file = "";
+	merlin_file_stamp stamp;
+	merlin_index_data idx;
+	nerr = merlin_read_index(str_index, &idx);
+	if (nerr != 0) {
+		if (nerr != 1 && btalk && ndebug > 0) {
+			std::cout << "- ignoring unreadable frame index file " << str_index << " (code " << nerr << ").\n";
+		}
+		return nerr;
+	}
+	// check that the index fits to the header and the data files
+	if (bscanframeheaders && !idx.bscanframeheaders) {
+		nerr = 20; // careful scan requested, but index made by fast scan
+		goto _exit_point;
+	}
+	if (idx.hdr.n_frames != hdr.n_frames || idx.hdr.n_columns != hdr.n_columns || idx.hdr.n_rows != hdr.n_rows) {
+		nerr = 21; // header file changed
+		goto _exit_point;
+	}
+	if (idx.hdr.n_files <= 0 || idx.frm_index.size() == 0) {
+		nerr = 22; // no frames
+		goto _exit_point;
+	}
+	for (i = 0; i < idx.hdr.n_files; i++) {
+		str_file = str_file_input + std::to_string(i + 1) + ".mib";
+		merlin_get_file_stamp(str_file, stamp);
+		if (stamp.n_size != idx.v_stamp[i].n_size || stamp.t_modified != idx.v_stamp[i].t_modified) {
+			nerr = 23; // data file changed
+			goto _exit_point;
+		}
+	}
+	str_file = str_file_input + std::to_string(idx.hdr.n_files + 1) + ".mib";
+	if (0 == merlin_get_file_stamp(str_file, stamp)) {
+		nerr = 24; // data files were added
+		goto _exit_point;
+	}
+	// take over the frame positions
+	hdr.n_files = idx.hdr.n_files;
+	hdr.n_fhdr_bytes = idx.hdr.n_fhdr_bytes;
+	hdr.n_data_bytes = idx.hdr.n_data_bytes;
+	hdr_frm = idx.hdr_frm;
+	frm_index = idx.frm_index;
+	if (btalk) {
+		std::cout << "- loaded frame positions from index file " << str_index << std::endl;
+	}
+_exit_point:
+	if (nerr != 0 && btalk && ndebug > 0) {
+		std::cout << "- frame index file " << str_index << " is outdated (code " << nerr << "), scanning data files.\n";
+	}
+	return nerr;
+}
+
+int merlin_params::save_frame_index(void)
+{
+	int nerr = 0;
+	int i = 0;
+	std::string str_index = str_file_input + ".idx";
+	merlin_index_data idx;
+	idx.bscanframeheaders = bscanframeheaders;
+	idx.hdr = hdr;
+	idx.hdr_frm = hdr_frm;
+	idx.v_stamp.resize(hdr.n_files);
+	for (i = 0; i < hdr.n_files; i++) {
+		nerr = merlin_get_file_stamp(str_file_input + std::to_string(i + 1) + ".mib", idx.v_stamp[i]);
+		if (nerr != 0) {
+			return 1; // data file vanished
+		}
+	}
+	idx.frm_index = frm_index;
+	nerr = merlin_write_index(str_index, &idx);
+	if (btalk && ndebug > 0) {
+		if (nerr == 0) {
+			std::cout << "- written frame positions to index file " << str_index << std::endl;
+		}
+		else {
+			std::cout << "- failed to write frame index file " << str_index << " (code " << nerr << ").\n";
+		}
+	}
+	return nerr;
+}
+
+int merlin_params::map_data_files(void)
+{
+	int nerr = 0;
+	if (bmemorymap && data_map.is_open() && data_map.get_num_files() == hdr.n_files) {
+		return 0; // already mapped by the frame header scan
+	}
+	data_map.close();
+	if (!bmemorymap) {
+		return 0; // memory mapping not requested
+	}
+	nerr = data_map.open(str_file_input, hdr.n_files);
+	if (nerr != 0) {
+		bmemorymap = false;
+		std::cerr << "Warning: failed to map data files to memory (code " << nerr << "), using file streams.\n";
+		return nerr;
+	}
+	if (btalk && ndebug > 0) {
+		std::cout << "- mapped " << data_map.get_num_files() << " data files to memory.\n";
+	}
+	return 0;
+}
+
 
 int merlin_params::read_param(int ipos, std::string * pstr, std::string * prm)
 {
@@ -330,17 +709,17 @@ int merlin_params::get_calib_pos(merlin_pix xin, merlin_pos * xout)
 	return 0;
 }
 
-int merlin_params::get_scan_pixel(int idx, int &x, int &y)
+int merlin_params::get_scan_pixel(__int64 idx, int &x, int &y)
 {
-	if (hdr.n_columns <= 0) {
-		return 1; // unreasonable # columns
+	if (hdr.n_columns <= 0 || hdr.n_rows <= 0) {
+		return 1; // unreasonable # columns or rows
 	}
-	x = imod(idx, hdr.n_columns);
-	y = imod((idx - x) / hdr.n_columns, hdr.n_rows);
+	x = (int)imod64(idx, hdr.n_columns);
+	y = (int)imod64((idx - x) / hdr.n_columns, hdr.n_rows);
 	return 0;
 }
 
-int merlin_params::get_frame_idx(int x, int y)
+__int64 merlin_params::get_frame_idx(int x, int y)
 {
 	if (hdr.n_columns <= 0) {
 		return -1; // unreasonable # columns
@@ -351,16 +730,16 @@ int merlin_params::get_frame_idx(int x, int y)
 	if (y < 0 || y >= hdr.n_rows) {
 		return -3; // invalid scan y position
 	}
-	return imod(x, hdr.n_columns) + imod(y, hdr.n_rows) * hdr.n_columns;
+	return (__int64)imod(x, hdr.n_columns) + (__int64)imod(y, hdr.n_rows) * hdr.n_columns;
 }
 
-int merlin_params::get_frame_pixel(int idx, int &x, int &y)
+int merlin_params::get_frame_pixel(__int64 idx, int &x, int &y)
 {
-	if (hdr_frm.n_columns <= 0) {
-		return 1; // missing reasonable # columns
+	if (hdr_frm.n_columns <= 0 || hdr_frm.n_rows <= 0) {
+		return 1; // missing reasonable # columns or rows
 	}
-	x = imod(idx, hdr_frm.n_columns);
-	y = imod((idx - x) / hdr_frm.n_columns, hdr_frm.n_rows);
+	x = (int)imod64(idx, hdr_frm.n_columns);
+	y = (int)imod64((idx - x) / hdr_frm.n_columns, hdr_frm.n_rows);
 	return 0;
 }
 
@@ -372,14 +751,12 @@ int merlin_params::get_frame_pixel_idx(int x, int y)
 	return imod(x, hdr_frm.n_columns) + imod(y, hdr_frm.n_rows) * hdr_frm.n_columns;
 }
 
-int merlin_params::get_frame_filepos(int idx, int &ifile, std::streampos &ipos)
+int merlin_params::get_frame_filepos(__int64 idx, int &ifile, std::streampos &ipos)
 {
 	if (idx < 0 || idx >= hdr.n_frames) {
 		return 1;
 	}
-	ifile = v_frm_file[idx];
-	ipos = v_frm_pos[idx];
-	return 0;
+	return frm_index.get(idx, ifile, ipos);
 }
 
 
@@ -390,6 +767,80 @@ size_t merlin_params::get_scan_rect_roi_size(void)
 	return dx * dy;
 }
 
+int merlin_params::get_scan_roi_frames(std::vector<merlin_frame_item> &v_items, size_t * pn_res)
+{
+	__int64 i_frm = 0;
+	int x = 0, y = 0, x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+	int ifile = 0;
+	size_t i = 0, n_res = 0;
+	bool bsorted = true;
+	std::streampos ipos = 0;
+	std::vector<int> v_file; // file index of each result item
+	std::vector<__int64> v_pos; // file position of each result item
+	merlin_frame_item item;
+	v_items.clear();
+	if (pn_res) *pn_res = 0;
+	if (hdr.n_frames <= 0) {
+		return 0; // no frames
+	}
+	if (hdr.n_columns <= 0 || hdr.n_rows <= 0) {
+		return 1; // failed to determine the scan position
+	}
+	if (v_scan_mask.size() > 0 && v_scan_mask.size() != (size_t)hdr.n_columns * hdr.n_rows) {
+		return 2; // scan mask does not fit to the scan
+	}
+	// visit only the scan rows and columns of the roi, in order of
+	// increasing frame index, instead of testing all frames
+	x0 = std::max(scan_rect_roi.x0, 0);
+	x1 = std::min(scan_rect_roi.x1, hdr.n_columns - 1);
+	y0 = std::max(scan_rect_roi.y0, 0);
+	y1 = std::min(scan_rect_roi.y1, hdr.n_rows - 1);
+	if (x1 >= x0 && y1 >= y0) {
+		v_items.reserve((size_t)(x1 - x0 + 1) * (size_t)(y1 - y0 + 1));
+	}
+	for (y = y0; y <= y1; y++) {
+		for (x = x0; x <= x1; x++) {
+			i_frm = (__int64)y * hdr.n_columns + x;
+			if (i_frm >= hdr.n_frames) {
+				y = y1; // end of the scan reached in the last row
+				break;
+			}
+			item.idx = i_frm;
+			item.ires = n_res++;
+			if (v_scan_mask.size() > 0 && v_scan_mask[(size_t)i_frm] == 0) {
+				continue; // masked frame, keeps its result item
+			}
+			v_items.push_back(item);
+		}
+	}
+	if (pn_res) *pn_res = n_res;
+	// order the frames by data file and position in the file for
+	// sequential reading, frames are usually stored in scan order and
+	// nothing needs to be done
+	if (v_items.size() < 2) {
+		return 0;
+	}
+	v_file.resize(n_res, 0);
+	v_pos.resize(n_res, 0);
+	for (i = 0; i < v_items.size(); i++) {
+		if (0 != get_frame_filepos(v_items[i].idx, ifile, ipos)) {
+			return 0; // no frame positions, keep the scan order
+		}
+		v_file[v_items[i].ires] = ifile;
+		v_pos[v_items[i].ires] = (__int64)ipos;
+		if (i > 0 && (v_file[v_items[i - 1].ires] > ifile || (v_file[v_items[i - 1].ires] == ifile && v_pos[v_items[i - 1].ires] > (__int64)ipos))) {
+			bsorted = false;
+		}
+	}
+	if (!bsorted) {
+		std::stable_sort(v_items.begin(), v_items.end(), [&](const merlin_frame_item & a, const merlin_frame_item & b) {
+			if (v_file[a.ires] != v_file[b.ires]) return v_file[a.ires] < v_file[b.ires];
+			return v_pos[a.ires] < v_pos[b.ires];
+		});
+	}
+	return 0;
+}
+
 
 int merlin_params::set_scan_rect_roi(std::string str_roi)
 {
@@ -436,6 +887,118 @@ int merlin_params::set_scan_rect_roi(std::string str_roi)
 	return 0;
 }
 
+int merlin_params::set_scan_tiles(std::string str_size)
+{
+	int i_pos = 0;
+	int n_prm = 0;
+	std::string str_num = "";
+	merlin_pix tile = { 0, 0 };
+	if (ndebug > 3) {
+		std::cout << "merlin_params::set_scan_tiles: str_size=" << str_size << std::endl;
+	}
+	while (i_pos >= 0 && n_prm < 2) {
+		i_pos = read_param(i_pos, &str_size, &str_num);
+		if (i_pos < 0) { return 1 + n_prm; } // parsing error
+		switch (n_prm) {
+		case 0:
+			tile.x = atoi(str_num.c_str());
+			break;
+		case 1:
+			tile.y = atoi(str_num.c_str());
+			break;
+		}
+		n_prm++;
+	}
+	if (tile.x < 1 || tile.y < 1) {
+		std::cerr << "Error: scan tile size must be positive.\n";
+		return 10;
+	}
+	scan_tile_size = tile;
+	v_scan_tile_roi.clear();
+	if (ndebug > 3) {
+		std::cout << "merlin_params::set_scan_tiles: scan_tile_size=(" << scan_tile_size.x << "," << scan_tile_size.y << ")\n";
+	}
+	return 0;
+}
+
+int merlin_params::load_scan_tile_list(std::string str_file)
+{
+	int i_pos = 0;
+	int n_prm = 0;
+	size_t nlines = 0;
+	std::ifstream fin;
+	std::string str_line, str_num;
+	std::vector<merlin_roi> v_roi;
+	merlin_roi roi;
+	fin.open(str_file);
+	if (!fin.is_open()) {
+		std::cerr << "Error: failed to open scan tile list file [" << str_file << "].\n";
+		return 1;
+	}
+	while (std::getline(fin, str_line)) {
+		nlines++;
+		if (str_line.size() > 0 && str_line[str_line.size() - 1] == '\r') str_line.erase(str_line.size() - 1);
+		if (str_line.size() == 0 || str_line[0] == '#') continue;
+		i_pos = 0;
+		for (n_prm = 0; n_prm < 4 && i_pos >= 0; n_prm++) {
+			i_pos = read_param(i_pos, &str_line, &str_num);
+			switch (n_prm) {
+			case 0: roi.x0 = atoi(str_num.c_str()); break;
+			case 1: roi.y0 = atoi(str_num.c_str()); break;
+			case 2: roi.x1 = atoi(str_num.c_str()); break;
+			case 3: roi.y1 = atoi(str_num.c_str()); break;
+			}
+		}
+		if (i_pos < 0 || roi.x1 < roi.x0 || roi.y1 < roi.y0) {
+			std::cerr << "Error: invalid scan roi in line " << nlines << " of file [" << str_file << "]: " << str_line << "\n";
+			fin.close();
+			return 2;
+		}
+		v_roi.push_back(roi);
+	}
+	fin.close();
+	if (v_roi.size() == 0) {
+		std::cerr << "Error: no scan roi found in file [" << str_file << "].\n";
+		return 3;
+	}
+	v_scan_tile_roi = v_roi;
+	scan_tile_size = { 0, 0 };
+	if (btalk) {
+		std::cout << "- " << v_scan_tile_roi.size() << " scan tiles loaded.\n";
+	}
+	return 0;
+}
+
+int merlin_params::get_scan_tiles(std::vector<merlin_roi> &v_roi)
+{
+	int x = 0, y = 0, x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+	merlin_roi roi;
+	v_roi.clear();
+	if (scan_tile_size.x < 1 || scan_tile_size.y < 1) { // tile list
+		v_roi = v_scan_tile_roi;
+		return (v_roi.size() > 0 ? 0 : 1);
+	}
+	if (hdr.n_columns <= 0 || hdr.n_rows <= 0) {
+		return 2; // failed to determine the scan size
+	}
+	// tiles of the current scan roi, row by row, the last tiles of a row
+	// and column are cut at the end of the roi
+	x0 = std::max(scan_rect_roi.x0, 0);
+	x1 = std::min(scan_rect_roi.x1, hdr.n_columns - 1);
+	y0 = std::max(scan_rect_roi.y0, 0);
+	y1 = std::min(scan_rect_roi.y1, hdr.n_rows - 1);
+	for (y = y0; y <= y1; y += scan_tile_size.y) {
+		for (x = x0; x <= x1; x += scan_tile_size.x) {
+			roi.x0 = x;
+			roi.y0 = y;
+			roi.x1 = std::min(x + scan_tile_size.x - 1, x1);
+			roi.y1 = std::min(y + scan_tile_size.y - 1, y1);
+			v_roi.push_back(roi);
+		}
+	}
+	return (v_roi.size() > 0 ? 0 : 1);
+}
+
 int merlin_params::set_origin(std::string str_org)
 {
 	int i_pos = 0;
@@ -551,16 +1114,74 @@ int merlin_params::set_annular_offset(std::string str_pos)
 	return 0;
 }
 
-bool merlin_params::is_defect_pixel(size_t idx)
+int merlin_params::set_radial_bins(std::string str_bins)
 {
-	size_t ndef = v_defect_corr.size();
-	if (ndef > 0) {
-		size_t didx = 0;
-		for (didx = 0; didx < ndef; didx++) {
-			if (v_defect_corr[didx].idx == idx) return true; // found
+	int i_pos = 0;
+	int n_prm = 0;
+	std::string str_num = "";
+	if (ndebug > 3) {
+		std::cout << "merlin_params::set_radial_bins: str_bins=" << str_bins << std::endl;
+	}
+	while (i_pos >= 0 && n_prm < 2) {
+		i_pos = read_param(i_pos, &str_bins, &str_num);
+		if (i_pos < 0) { return 1 + n_prm; } // parsing error
+		switch (n_prm) {
+		case 0:
+			radial_bin_width = (double)atof(str_num.c_str());
+			if (radial_bin_width <= 0.) {
+				std::cerr << "Error: radial bin width must be positive.\n";
+				radial_bin_width = 1.;
+				return 10;
+			}
+			break;
+		case 1:
+			radial_bin_num = atoi(str_num.c_str());
+			if (radial_bin_num < 0) radial_bin_num = 0;
+			break;
 		}
+		n_prm++;
 	}
-	return false;
+	if (ndebug > 3) {
+		std::cout << "merlin_params::set_radial_bins: radial_bin_width=" << radial_bin_width << ", radial_bin_num=" << radial_bin_num << "\n";
+	}
+	return 0;
+}
+
+int merlin_params::set_polar_sectors(std::string str_sec)
+{
+	int i_pos = 0;
+	int n_prm = 0;
+	std::string str_num = "";
+	if (ndebug > 3) {
+		std::cout << "merlin_params::set_polar_sectors: str_sec=" << str_sec << std::endl;
+	}
+	while (i_pos >= 0 && n_prm < 2) {
+		i_pos = read_param(i_pos, &str_sec, &str_num);
+		if (i_pos < 0) { return 1 + n_prm; } // parsing error
+		switch (n_prm) {
+		case 0:
+			polar_phi_num = atoi(str_num.c_str());
+			if (polar_phi_num < 1) {
+				std::cerr << "Error: number of azimuthal sectors must be positive.\n";
+				polar_phi_num = 4;
+				return 10;
+			}
+			break;
+		case 1:
+			polar_phi_offset = (double)atof(str_num.c_str());
+			break;
+		}
+		n_prm++;
+	}
+	if (ndebug > 3) {
+		std::cout << "merlin_params::set_polar_sectors: polar_phi_num=" << polar_phi_num << ", polar_phi_offset=" << polar_phi_offset << "\n";
+	}
+	return 0;
+}
+
+bool merlin_params::is_defect_pixel(size_t idx)
+{
+	return (idx < v_defect_map.size() && v_defect_map[idx] != 0);
 }
 
 bool merlin_params::is_defect_pixel(int x, int y)
@@ -575,15 +1196,28 @@ bool merlin_params::is_defect_list_modified(void)
 	return defects_modified;
 }
 
+void merlin_params::set_defect_map(size_t idx, bool bdefect)
+{
+	size_t npix = (size_t)hdr_frm.n_rows * (size_t)hdr_frm.n_columns;
+	if (v_defect_map.size() < npix) v_defect_map.resize(npix, 0);
+	if (idx < v_defect_map.size()) v_defect_map[idx] = (bdefect ? 1 : 0);
+}
+
 int merlin_params::update_defect_correction_list(void)
 {
-	size_t ncorr = 0, nc = 0;
+	size_t nc = 0;
 	size_t ndef = v_defect_corr.size();
-	size_t i = 0, j = 0, idx = 0, idx2 = 0;
+	size_t i = 0, idx = 0, idx2 = 0;
 	int k = 0, l = 0, x = 0, y = 0;
-	if (ndef > 0) { // update correction lists
+	v_defect_ofs.clear();
+	v_defect_nbr.clear();
+	v_defect_wgt.clear();
+	if (ndef > 0) { // update correction tables
+		v_defect_ofs.reserve(ndef + 1);
+		v_defect_nbr.reserve(8 * ndef);
+		v_defect_wgt.reserve(ndef);
+		v_defect_ofs.push_back(0);
 		for (i = 0; i < ndef; i++) { // .. for all defects
-			v_defect_corr[i].v_idx_corr.clear(); // delete correction table
 			idx = v_defect_corr[i].idx;
 			x = v_defect_corr[i].x;
 			y = v_defect_corr[i].y;
@@ -593,13 +1227,15 @@ int merlin_params::update_defect_correction_list(void)
 					idx2 = (size_t)get_frame_pixel_idx(x + l, y + k); // get the frame stream index for (i1+l,j1+k)
 					if (idx2 < 0) continue; // invald index ?
 					if (is_defect_pixel(idx2)) continue; // is also a defect ?
-					v_defect_corr[i].v_idx_corr.push_back(idx2); // this pixel can be used for correction
-					nc++;
-				}
-				if (ndebug > 3) {
-					std::cout << "- registered " << nc << " correction pixels for defect " << i+1 << " at (" << x << "," << y << "), index = " << idx << " \n";
+					v_defect_nbr.push_back(idx2); // this pixel can be used for correction
 				}
 			}
+			nc = v_defect_nbr.size() - v_defect_ofs[i];
+			v_defect_ofs.push_back(v_defect_nbr.size());
+			v_defect_wgt.push_back(nc > 0 ? 1. / ((double)nc) : 0.);
+			if (ndebug > 3) {
+				std::cout << "- registered " << nc << " correction pixels for defect " << i+1 << " at (" << x << "," << y << "), index = " << idx << " \n";
+			}
 		}
 	}
 	defects_modified = false; // mark all defects to be fully registered with correction table
@@ -613,11 +1249,10 @@ int merlin_params::set_defect_pixel(int x, int y)
 	size_t i = get_frame_pixel_idx(x, y);
 	if (i < 0) return 1; // error
 	dpc.idx = i;
-	get_frame_pixel((int)i, dpc.x, dpc.y); // get 2d pixel indices in the grid -> (i1,j1)
-	// This is a new defect. -> Add with an empty correction list.
-	dpc.v_idx_corr.clear();
-	// Push the new defect to the list.
+	get_frame_pixel((__int64)i, dpc.x, dpc.y); // get 2d pixel indices in the grid -> (i1,j1)
+	// This is a new defect. -> Push it to the list.
 	v_defect_corr.push_back(dpc);
+	set_defect_map(i, true);
 	// Mark the defect list as modified.
 	defects_modified = true;
 	return 0;
@@ -660,8 +1295,7 @@ int merlin_params::load_defect_mask(std::string str_file)
 	size_t nbytes = sizeof(int)*npix;
 	int * img_defectmask = NULL;
 	int num_defects = 0;
-	size_t idx = 0, idx2 = 0;
-	int i = 0, j = 0, l = 0, k = 0;
+	size_t idx = 0;
 	bool bfilefound = false;
 	struct stat statbuf;
 	std::ifstream fin;
@@ -693,9 +1327,9 @@ int merlin_params::load_defect_mask(std::string str_file)
 			if (img_defectmask[idx] != 0) { // defect pixel
 				if (is_defect_pixel(idx)) continue; // this defect is already registered
 				dpc.idx = idx;
-				get_frame_pixel((int)idx, dpc.x, dpc.y);
-				dpc.v_idx_corr.clear();
+				get_frame_pixel((__int64)idx, dpc.x, dpc.y);
 				v_defect_corr.push_back(dpc); // add the defect data to the list
+				set_defect_map(idx, true);
 				num_defects++;
 			}
 		}
@@ -774,6 +1408,10 @@ int merlin_params::load_defect_list(std::string str_file)
 int merlin_params::unset_defect_list(void)
 {
 	v_defect_corr.clear();
+	v_defect_map.clear();
+	v_defect_ofs.clear();
+	v_defect_nbr.clear();
+	v_defect_wgt.clear();
 	defects_modified = false;
 	return 0;
 }
@@ -783,16 +1421,16 @@ int merlin_params::unset_defect_pixel(int x, int y)
 	size_t idx_d = get_frame_pixel_idx(x, y);
 	size_t ndef = v_defect_corr.size();
 	size_t i = 0;
-	if (idx_d >= 0 && ndef > 0) {
+	if (is_defect_pixel(idx_d) && ndef > 0) {
 		for (i = 0; i < ndef; i++) {
 			if (v_defect_corr[i].idx == idx_d) { // remove this
 				v_defect_corr.erase(v_defect_corr.begin()+i);
+				set_defect_map(idx_d, false);
 				if (v_defect_corr.size() > 0) {
 					defects_modified = true;
 				}
 				else {
-					v_defect_corr.clear();
-					defects_modified = false;
+					unset_defect_list();
 				}
 				break; // stop the loop
 			}
@@ -830,6 +1468,52 @@ int merlin_params::unset_defect_pixel(std::string str_pos)
 }
 
 
+int merlin_params::load_scan_mask(std::string str_file)
+{
+	size_t npix = (size_t)hdr.n_columns * (size_t)hdr.n_rows;
+	size_t idx = 0, nsel = 0;
+	int * img_scanmask = NULL;
+	std::ifstream fin;
+	if (hdr.n_columns <= 0 || hdr.n_rows <= 0) {
+		std::cerr << "merlin_params::load_scan_mask: failed due to invalid scan size.\n";
+		return 1;
+	}
+	fin.open(str_file, std::ios::binary);
+	if (!fin.is_open()) {
+		std::cerr << "merlin_params::load_scan_mask: failed to open file [" << str_file << "].\n";
+		return 3;
+	}
+	img_scanmask = (int*)calloc(npix, sizeof(int));
+	if (NULL == img_scanmask) {
+		fin.close();
+		return 101;
+	}
+	fin.read((char*)img_scanmask, sizeof(int)*npix);
+	if (fin.gcount() != (std::streamsize)(sizeof(int)*npix)) {
+		std::cerr << "merlin_params::load_scan_mask: file [" << str_file << "] is too short, expecting " << npix << " 32-bit integer values.\n";
+		fin.close();
+		free(img_scanmask);
+		return 4;
+	}
+	fin.close();
+	v_scan_mask.resize(npix);
+	for (idx = 0; idx < npix; idx++) {
+		v_scan_mask[idx] = (img_scanmask[idx] != 0 ? 1 : 0);
+		nsel += v_scan_mask[idx];
+	}
+	free(img_scanmask);
+	if (btalk) {
+		std::cout << "- scan mask selects " << nsel << " of " << npix << " scan pixels.\n";
+	}
+	return 0;
+}
+
+int merlin_params::unset_scan_mask(void)
+{
+	v_scan_mask.clear();
+	return 0;
+}
+
 int merlin_params::load_gain_correction(std::string str_file)
 {
 	size_t npix = (size_t)hdr_frm.n_rows*((size_t)hdr_frm.n_columns);
@@ -911,34 +1595,62 @@ int merlin_params::gain_correction(double * buf)
 int merlin_params::defect_correction(double * buf)
 {
 	size_t npix = (size_t)hdr_frm.n_rows * (size_t)hdr_frm.n_columns;
-	size_t idx = 0, idx2 = 0;
-	int idef = 0, nc = 0;
-	int icor = 0;
-	double rnc = 0.;
+	size_t ndef = (v_defect_ofs.size() > 0 ? v_defect_ofs.size() - 1 : 0);
+	size_t idef = 0, icor = 0, icor1 = 0;
 	double snc = 0.;
-	if (v_defect_corr.size() > 0) {
+	if (ndef > v_defect_corr.size()) ndef = v_defect_corr.size(); // tables not yet updated after removals
+	const size_t * pofs = v_defect_ofs.data();
+	const size_t * pnbr = v_defect_nbr.data();
+	const double * pwgt = v_defect_wgt.data();
+	const defect_pixel_corr * pdef = v_defect_corr.data();
+	if (ndef > 0) {
 		if (buf == NULL) return 1;
 		if (npix == 0) return 2;
 		if (ndebug > 3) {
-			std::cout << "- correcting " << v_defect_corr.size() << " defect pixels\n";
-		}
-		for (idef = 0; idef < v_defect_corr.size(); idef++) {
-			idx = v_defect_corr[idef].idx; // get defect pixel index
-			nc = (int)v_defect_corr[idef].v_idx_corr.size(); // get number of correction pixels
-			if (nc > 0) {
-				if (ndebug > 3) {
-					std::cout << "- defect " << idef << " (" << idx << ") from " << nc << " neighbor pixels\n";
-				}
-				rnc = 1. / ((double)nc);
+			std::cout << "- correcting " << ndef << " defect pixels\n";
+		}
+		for (idef = 0; idef < ndef; idef++) {
+			icor1 = pofs[idef + 1];
+			if (icor1 > pofs[idef]) {
 				snc = 0.;
-				for (icor = 0; icor < nc; icor++) { // loop over correction pixels
-					idx2 = v_defect_corr[idef].v_idx_corr[icor]; // get index of correction pixel
-					snc += buf[idx2]; // accumulate intensity
+				for (icor = pofs[idef]; icor < icor1; icor++) { // loop over correction pixels
+					snc += buf[pnbr[icor]]; // accumulate intensity
 				}
-				buf[idx] = snc * rnc; // set correction to defect pixel
+				buf[pdef[idef].idx] = snc * pwgt[idef]; // set correction to defect pixel
 			}
 		}
 	}
 	return 0;
 }
 
+int merlin_params::fold_corrections(double * w)
+{
+	size_t npix = (size_t)hdr_frm.n_rows * (size_t)hdr_frm.n_columns;
+	size_t i = 0, idx = 0, idef = 0, icor = 0, icor1 = 0;
+	double wdef = 0.;
+	if (w == NULL) return 1;
+	if (npix == 0) return 2;
+	if (defects_modified) update_defect_correction_list();
+	// defect corrections in reverse order: the weight of a defect pixel
+	// is handed in equal parts to its correction pixels
+	for (idef = (v_defect_ofs.size() > 0 ? v_defect_ofs.size() - 1 : 0); idef > 0; idef--) {
+		icor1 = v_defect_ofs[idef];
+		if (icor1 > v_defect_ofs[idef - 1]) {
+			idx = v_defect_corr[idef - 1].idx; // get defect pixel index
+			wdef = w[idx] * v_defect_wgt[idef - 1];
+			w[idx] = 0.;
+			for (icor = v_defect_ofs[idef - 1]; icor < icor1; icor++) { // loop over correction pixels
+				w[v_defect_nbr[icor]] += wdef;
+			}
+		}
+	}
+	// gain correction
+	if (gaincorrect) {
+		if (img_gaincorrect == NULL) return 3;
+		for (i = 0; i < npix; i++) {
+			w[i] = w[i] * img_gaincorrect[i];
+		}
+	}
+	return 0;
+}
+
@@ -25,6 +25,9 @@ This file is part of Merlinio.
 
 #pragma once
 #include "merlin_hdr.h"
+#include "merlin_mmap.h"
+#include "merlin_index.h"
+#include "merlin_stream.h"
 
 constexpr auto MERLINIO_VER = 1;
 constexpr auto MERLINIO_VER_SUB = 1;
@@ -35,7 +38,12 @@ struct defect_pixel_corr {
 	size_t idx;
 	int x;
 	int y;
-	std::vector<size_t> v_idx_corr;
+};
+
+// a frame scheduled for processing
+struct merlin_frame_item {
+	__int64 idx = 0; // global frame index
+	size_t ires = 0; // index of the result item (position in the scan roi)
 };
 
 class merlin_params
@@ -50,18 +58,41 @@ public:
 	bool binteractive; // flag interactive control mode
 	bool bscanframeheaders; // flag causing a careful frame header scan
 	bool swapbytes; // flag for swapping bytes when converting to floats
+	bool bmemorymap; // flag for using memory mapped access to the data files
+	bool bframeindex; // flag for using the frame index file "<input-file-name>.idx"
+	bool bfuse; // flag for running consecutive operations in a single pass over the data
+	bool bdirect; // flag for reading data files with O_DIRECT and io_uring instead of file streams
+	bool bshard; // flag for processing the frames of each data file with its own group of workers
+	bool bdropbehind; // flag for releasing consumed frame data from the page cache
+	bool blive; // flag for processing data files while they are written by a running acquisition
 	int ndebug; // debug level
+	int nprefetch; // number of frames read ahead of processing (0: no read-ahead)
+	int nthreads; // number of processing threads (0: all hardware threads)
+	int nqdepth; // number of read requests in flight per thread with direct reading
+	int nlivetimeout; // seconds without new frames after which live processing stops
+	int nserveport; // loopback port on which the data files are served as Merlin data stream (0: no server)
+	size_t nhotwindow; // number of bytes of consumed frame data kept in the page cache with bdropbehind
+	size_t ntilememory; // number of bytes of accumulation buffers of average_tiles per batch of tiles
 	
 	merlin_hdr hdr;
 	merlin_frame_hdr hdr_frm;
-	std::vector<int> v_frm_file;
-	std::vector<std::streampos> v_frm_pos;
+	merlin_frame_index frm_index; // file index and data position of each frame
+	merlin_data_map data_map; // memory mapped data files
+	merlin_stream_input stream; // frames received from a Merlin data stream instead of the data files
 	
 	merlin_frame_calib frame_calib;
 	merlin_range range_annular;
 	merlin_pos offset_annular;
+	double radial_bin_width; // width of radial bins in calibrated units
+	int radial_bin_num; // number of radial bins (0: cover the whole frame)
+	int polar_phi_num; // number of azimuthal sectors of polar profiles
+	double polar_phi_offset; // start angle of the first azimuthal sector in degrees
 	merlin_roi scan_rect_roi;
+	merlin_pix scan_tile_size; // tile size in scan pixels of average_tiles (0: use v_scan_tile_roi)
+	std::vector<merlin_roi> v_scan_tile_roi; // scan rois of average_tiles loaded from a file
+	std::vector<unsigned char> v_scan_mask; // flag of each scan pixel (1: frame is processed), empty: all frames
 	std::string str_file_input;
+	std::string str_stream; // address "<host>[:<port>]" of the Merlin data stream (empty: read the data files)
 	std::string str_file_output;
 	std::string str_file_ctrl;
 
@@ -70,7 +101,11 @@ public:
 protected:
 	bool gaincorrect; // indicates that a gain correction is present and used
 	bool defects_modified; // indicates that the defect list has been modified and that the correction lists need updates
-	std::vector<defect_pixel_corr> v_defect_corr; // list of registered defect pixels with correction data
+	std::vector<defect_pixel_corr> v_defect_corr; // list of registered defect pixels
+	std::vector<unsigned char> v_defect_map; // defect flag of each frame pixel (1: defect)
+	std::vector<size_t> v_defect_ofs; // start of the correction pixels of each defect in v_defect_nbr, one more entry than defects
+	std::vector<size_t> v_defect_nbr; // correction pixel indices of all defects in sequence
+	std::vector<double> v_defect_wgt; // correction weight of each defect (1 / number of correction pixels)
 	double * img_gaincorrect; // gain correction factors (size determine by hdr_frm)
 	
 	// member functions
@@ -84,6 +119,30 @@ public:
 	int read_header(void);
 	// reads information from merlin frame headers in merlin ".mib" files.
 	int read_frame_headers(void);
+	// connects to the Merlin data stream at str_stream and receives the
+	// acquisition header and the first frame header, instead of
+	// read_header and read_frame_headers
+	// - return value = error code (0: success)
+	int open_stream(void);
+	// extends the frame index by frames written to the data files since
+	// the last call, in live mode (see blive) after read_frame_headers
+	// - output n_ready = number of leading frames of the index, which
+	//   are written completely to the data files
+	// - return value = error code (0: success)
+	int update_frame_index(__int64 & n_ready);
+	// reads information from all merlin frame headers in the ".mib" files
+	// mapped to memory, scanning the files concurrently
+	// - return value = error code (0: success, >= 100: mapping failed)
+	int scan_frame_headers_mapped(void);
+	// maps all merlin ".mib" files to memory for reading frame data
+	int map_data_files(void);
+	// loads the frame positions from the index file written by a
+	// previous frame header scan, fails if the data files changed
+	// - return value = error code (0: success)
+	int load_frame_index(void);
+	// saves the frame positions to the index file
+	// - return value = error code (0: success)
+	int save_frame_index(void);
 
 	
 	// applies the given frame calibration
@@ -98,18 +157,18 @@ public:
 	// - input idx = frame index
 	// - output x, y = scan position
 	// - return value = error code (0: success)
-	int get_scan_pixel(int idx, int &x, int &y);
+	int get_scan_pixel(__int64 idx, int &x, int &y);
 
 	// determines the frame index from scan position x,y
 	// - input x, y = scan position
 	// - return value = frame index (<0 = error code)
-	int get_frame_idx(int x, int y);
+	__int64 get_frame_idx(int x, int y);
 
 	// determines the frame pixel x,y position from the frame pixel index
 	// - input idx = frame pixel index
 	// - output x, y = frame pixel position
 	// - return value = error code (0: success)
-	int get_frame_pixel(int idx, int &x, int &y);
+	int get_frame_pixel(__int64 idx, int &x, int &y);
 
 	// determines the frame pixel index from the frame pixel x,y position 
 	// - input x, y = frame pixel position
@@ -122,17 +181,39 @@ public:
 	// - output ifile = file index (0 = first file)
 	// - output ipos  = position of frame in file (0 = begin of file)
 	// - return value = error code (0: success)
-	int get_frame_filepos(int idx, int &ifile, std::streampos &ipos);
+	int get_frame_filepos(__int64 idx, int &ifile, std::streampos &ipos);
 
 	// returns the number of pixels in the current rectangular scan roi
 	size_t get_scan_rect_roi_size(void);
 
+	// lists the frames in the current scan roi which are not excluded by
+	// the scan mask, in order of their position in the data files
+	// - output v_items = frame and result indices, the result index is
+	//   the position in the scan roi including masked frames
+	// - output pn_res = number of result items (optional)
+	// - return value = error code (0: success)
+	int get_scan_roi_frames(std::vector<merlin_frame_item> &v_items, size_t * pn_res = NULL);
+
 
 	bool in_scan_roi(merlin_pix pos, merlin_roi roi);
 
 
 	int set_scan_rect_roi(std::string str_roi);
 
+	// sets the tile size "<nx>,<ny>" of average_tiles, the tiles cover
+	// the scan roi, replaces the tile list
+	int set_scan_tiles(std::string str_size);
+
+	// loads the scan rois of average_tiles from a text file with one
+	// roi "<x0>,<y0>,<x1>,<y1>" per line, replaces the tile size
+	int load_scan_tile_list(std::string str_file);
+
+	// lists the scan rois of average_tiles, either tiles of the current
+	// tile size covering the current scan roi or the loaded tile list
+	// - output v_roi = tile rois
+	// - return value = error code (0: success)
+	int get_scan_tiles(std::vector<merlin_roi> &v_roi);
+
 	int set_origin(std::string str_org);
 
 	int	set_sampling(std::string str_samp);
@@ -141,12 +222,23 @@ public:
 
 	int set_annular_offset(std::string str_pos);
 
+	// sets width and number of radial bins from a parameter string
+	// "<width>,<number>"
+	int set_radial_bins(std::string str_bins);
+
+	// sets number and start angle (degrees) of azimuthal sectors from a
+	// parameter string "<number>,<angle>"
+	int set_polar_sectors(std::string str_sec);
+
 	bool is_defect_pixel(size_t idx);
 	
 	bool is_defect_pixel(int x, int y);
 
 	bool is_defect_list_modified(void);
 
+	// sets or clears the defect flag of a frame pixel
+	void set_defect_map(size_t idx, bool bdefect);
+
 	// writes new defect correction tables
 	int update_defect_correction_list(void);
 
@@ -172,6 +264,13 @@ public:
 	// the coordinates x,y are given as parameter string (str_pos)
 	int unset_defect_pixel(std::string str_pos);
 
+	// loads a scan mask from file, 32-bit integer values, one for each
+	// scan pixel, frames are processed where the value is not 0
+	int load_scan_mask(std::string str_file);
+
+	// removes the scan mask, all frames of the scan roi are processed
+	int unset_scan_mask(void);
+
 	// loads a gain correction image from file
 	int load_gain_correction(std::string str_file);
 
@@ -183,4 +282,10 @@ public:
 
 	// applies the defect pixel correction to frame data
 	int defect_correction(double * buf);
+
+	// applies the transposed defect pixel correction and gain correction
+	// to the weights w of a linear detector, such that the sum of w times
+	// corrected frame data equals the sum of the folded w times the
+	// frame data as read
+	int fold_corrections(double * w);
 };
\ No newline at end of file
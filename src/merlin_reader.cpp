@@ -0,0 +1,305 @@
+// file : "merlin_reader.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the frame data reader.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#include "pch.h"
+#include "merlin_reader.h"
+
+
+merlin_frame_reader::merlin_frame_reader()
+{
+	pprm = NULL;
+	str_file = "";
+	ncfidx = -1;
+	inbuf = NULL;
+	nbufsize = 0;
+	blk_idx0 = -1;
+	blk_n = 0;
+	blk_stride = 0;
+	blk_data = NULL;
+	bdirect = false;
+	nconsumed = 0;
+	nwindow = 0;
+}
+
+merlin_frame_reader::~merlin_frame_reader()
+{
+	close();
+}
+
+int merlin_frame_reader::init(merlin_params * pprm_in, int nreaders)
+{
+	close();
+	if (NULL == pprm_in) {
+		return 1; // missing parameter 1
+	}
+	if (pprm_in->hdr.n_data_bytes == 0) {
+		return 2; // no frame data
+	}
+	pprm = pprm_in;
+	nwindow = pprm->nhotwindow / (size_t)(nreaders > 1 ? nreaders : 1);
+	if (!is_mapped() && !pprm->stream.is_open()) { // stream input, prepare the staging buffer for blocks of frames
+		nbufsize = std::max(pprm->hdr.n_data_bytes, MERLIN_READ_BLOCK_BYTES);
+		inbuf = (char*)malloc(nbufsize);
+		if (NULL == inbuf) {
+			nbufsize = 0;
+			pprm = NULL;
+			return 100; // buffer allocation failed
+		}
+		if (pprm->bdirect) { // direct reading, falls back to the stream
+			bdirect = (0 == direct.init(pprm->nqdepth, nbufsize));
+		}
+	}
+	return 0;
+}
+
+void merlin_frame_reader::close(void)
+{
+	size_t i = 0;
+	if (NULL != pprm) {
+		release_block();
+	}
+	q_consumed.clear();
+	nconsumed = 0;
+	for (i = 0; i < v_advfd.size(); i++) {
+		merlin_file_advice_close(v_advfd[i]);
+	}
+	v_advfd.clear();
+	if (fin.is_open()) {
+		fin.close();
+	}
+	ncfidx = -1;
+	str_file = "";
+	if (NULL != inbuf) {
+		free(inbuf);
+		inbuf = NULL;
+	}
+	nbufsize = 0;
+	blk_idx0 = -1;
+	blk_n = 0;
+	blk_stride = 0;
+	blk_data = NULL;
+	direct.close();
+	bdirect = false;
+	pprm = NULL;
+}
+
+bool merlin_frame_reader::is_mapped(void)
+{
+	if (NULL == pprm) {
+		return false;
+	}
+	return pprm->data_map.is_open();
+}
+
+void merlin_frame_reader::advise(const merlin_file_range & rng, int nadvice)
+{
+	if (rng.ifile < 0 || rng.nbytes == 0) {
+		return; // nothing to do
+	}
+	if (is_mapped()) {
+		pprm->data_map.advise(rng.ifile, (std::streampos)rng.pos, rng.nbytes, nadvice);
+	}
+	else {
+		if (rng.ifile >= (int)v_advfd.size()) {
+			v_advfd.resize((size_t)rng.ifile + 1, -1);
+		}
+		if (v_advfd[rng.ifile] < 0) { // open the file once
+			v_advfd[rng.ifile] = merlin_file_advice_open(pprm->str_file_input + std::to_string(rng.ifile + 1) + ".mib");
+		}
+		merlin_file_advise(v_advfd[rng.ifile], rng.pos, rng.nbytes, nadvice);
+	}
+}
+
+size_t merlin_frame_reader::get_block(__int64 idx, int fidx, std::streampos fpos, size_t nnext, size_t nblkmax, size_t & stride)
+{
+	int fidx2 = -1; // file index
+	std::streampos fpos2; // file position
+	size_t nblk = 1, nbytes = pprm->hdr.n_data_bytes;
+	stride = 0;
+	while (nblk < nnext) {
+		if (0 != pprm->get_frame_filepos(idx + (__int64)nblk, fidx2, fpos2) || fidx2 != fidx) break;
+		if (nblk == 1) {
+			if (fpos2 - fpos < (std::streamoff)nbytes) break; // overlapping frames
+			stride = (size_t)(fpos2 - fpos);
+		}
+		else if ((size_t)(fpos2 - fpos) != nblk * stride) break;
+		if (nblk * stride + nbytes > nblkmax) break; // block buffer full
+		nblk++;
+	}
+	if (nblk == 1) stride = 0;
+	return nblk;
+}
+
+void merlin_frame_reader::release_block(void)
+{
+	if (blk_n == 0 || blk_range.ifile < 0) {
+		return; // no block
+	}
+	if (pprm->bdropbehind && !bdirect) {
+		q_consumed.push_back(blk_range);
+		nconsumed += blk_range.nbytes;
+		while (nconsumed > nwindow && !q_consumed.empty()) { // drop behind the hot window
+			advise(q_consumed.front(), MERLIN_ADVISE_DONTNEED);
+			nconsumed -= q_consumed.front().nbytes;
+			q_consumed.pop_front();
+		}
+	}
+	blk_n = 0;
+	blk_range.ifile = -1;
+}
+
+int merlin_frame_reader::get_frame_raw(__int64 idx, const char ** pdata, size_t nnext)
+{
+	int nerr = 0;
+	int fidx = -1, fidx2 = -1; // file index
+	std::streampos fpos, fpos2; // file position
+	size_t nbytes = 0, nblk = 1, nread = 0, nahead = 0;
+	size_t stride = 0, stride2 = 0; // distance of consecutive frames in the file
+	size_t nblkmax = 0; // max. size of a block
+	std::string str_direct; // data file read directly
+	merlin_file_range rng_ahead; // next block, read ahead
+	if (NULL == pprm) {
+		return 1; // reader not initialized
+	}
+	if (NULL == pdata) {
+		return 2; // missing parameter 2
+	}
+	*pdata = NULL;
+	if (pprm->stream.is_open()) { // frame of the part received from the data stream
+		*pdata = pprm->stream.get_frame_data(idx);
+		return (NULL == *pdata ? 17 : 0); // 17: frame not in the current part
+	}
+	nbytes = pprm->hdr.n_data_bytes;
+	if (blk_n > 0 && idx >= blk_idx0 && idx < blk_idx0 + (__int64)blk_n) {
+		*pdata = blk_data + (size_t)(idx - blk_idx0) * blk_stride; // frame of the current block
+		return 0;
+	}
+	release_block();
+	if (0 != pprm->get_frame_filepos(idx, fidx, fpos) || fidx < 0) {
+		return 11; // failed to determine file index and data offset
+	}
+	if (!is_mapped() && NULL == inbuf) {
+		return 3; // missing staging buffer
+	}
+	nblkmax = (is_mapped() ? std::max(nbytes, MERLIN_READ_BLOCK_BYTES) : nbufsize);
+	nblk = get_block(idx, fidx, fpos, nnext, nblkmax, stride);
+	nread = (nblk - 1) * stride + nbytes;
+	blk_range.ifile = fidx;
+	blk_range.pos = (__int64)(std::streamoff)fpos;
+	blk_range.nbytes = nread;
+	if (nnext > nblk && 0 == pprm->get_frame_filepos(idx + (__int64)nblk, fidx2, fpos2) && fidx2 >= 0) { // next block of the sequence
+		nahead = get_block(idx + (__int64)nblk, fidx2, fpos2, nnext - nblk, nblkmax, stride2);
+		rng_ahead.ifile = fidx2;
+		rng_ahead.pos = (__int64)(std::streamoff)fpos2;
+		rng_ahead.nbytes = (nahead - 1) * stride2 + nbytes;
+	}
+	if (!bdirect) { // read the next block ahead while this block is read and processed
+		advise(rng_ahead, MERLIN_ADVISE_WILLNEED);
+	}
+	if (is_mapped()) { // direct access to the mapped file
+		blk_data = pprm->data_map.get_data(fidx, fpos, nread);
+		if (NULL == blk_data) {
+			return 15; // frame data is not in the mapped file
+		}
+		blk_idx0 = idx;
+		blk_n = nblk;
+		blk_stride = stride;
+		*pdata = blk_data;
+		return 0;
+	}
+	// stream input
+	if (bdirect) { // direct reading bypassing the page cache
+		str_direct = pprm->str_file_input + std::to_string(fidx + 1) + ".mib";
+		nerr = direct.read(str_direct, (__int64)fpos, nread, &blk_data);
+		if (nerr == 0) {
+			if (rng_ahead.ifile == fidx) { // keep the next block in flight
+				direct.read_ahead(str_direct, rng_ahead.pos, rng_ahead.nbytes);
+			}
+			blk_idx0 = idx;
+			blk_n = nblk;
+			blk_stride = stride;
+			*pdata = blk_data;
+			return 0;
+		}
+		if (nerr != 12) {
+			return 16; // failed reading data with direct access
+		}
+		direct.close(); // O_DIRECT not supported for the file, use the stream from now on
+		bdirect = false;
+	}
+	if (fidx != ncfidx) { // not the right file is open
+		if (fin.is_open()) { // close the wrong file
+			fin.close();
+		}
+		ncfidx = -1;
+		str_file = pprm->str_file_input + std::to_string(fidx + 1) + ".mib"; // file name construction
+		fin.open(str_file, std::ios::binary); // open the right file
+		if (!fin.is_open()) { // failure opening file
+			return 12;
+		}
+		ncfidx = fidx; // update current file index
+	}
+	fin.seekg(fpos);
+	if (fin.fail()) {
+		return 13; // failed to position the file pointer
+	}
+	fin.read(inbuf, nread);
+	if (fin.fail()) {
+		return 14; // failed reading data from the input file
+	}
+	blk_idx0 = idx;
+	blk_n = nblk;
+	blk_stride = stride;
+	blk_data = inbuf;
+	*pdata = inbuf;
+	return 0;
+}
+
+int merlin_frame_reader::read_frame(__int64 idx, double * buf, size_t nnext)
+{
+	int nerr = 0;
+	const char * pdata = NULL;
+	if (NULL == buf) {
+		return 2; // missing parameter 2
+	}
+	nerr = get_frame_raw(idx, &pdata, nnext);
+	if (nerr != 0) {
+		return nerr;
+	}
+	return merlin_decode_data(buf, pdata, &pprm->hdr_frm, pprm->swapbytes);
+}
+
+size_t merlin_frame_run(const std::vector<merlin_frame_item> & v_items, size_t i, size_t i1)
+{
+	size_t j = i + 1;
+	if (i >= i1) {
+		return 0;
+	}
+	while (j < i1 && v_items[j].idx == v_items[j - 1].idx + 1) {
+		j++;
+	}
+	return j - i;
+}
@@ -0,0 +1,131 @@
+// file : "merlin_reader.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the frame data reader used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+#pragma once
+#include "merlin_prm.h"
+#include "merlin_direct.h"
+#include <deque>
+
+constexpr size_t MERLIN_READ_BLOCK_BYTES = 0x800000; // max. size of a block of frames read from a file stream at once
+
+// a range of bytes in a data file
+struct merlin_file_range {
+	int ifile = -1; // file index
+	__int64 pos = 0; // position in the file
+	size_t nbytes = 0; // length in bytes
+};
+
+// Provides access to the data of frames listed in a merlin_params object.
+// Frame data is taken directly from the memory mapped data files when
+// merlin_params::data_map is open. Otherwise data is read from file
+// streams to an internal staging buffer that is allocated once. Runs of
+// consecutive frames stored back to back in a file are handled as
+// blocks, read from the stream with one read into the staging buffer,
+// the frame headers in between are skipped in memory.
+// The reader advises the operating system to read the block following
+// each block of a sequence of requested frames ahead. With
+// merlin_params::bdropbehind, blocks are released from the page cache
+// once consumed, except for the last blocks that fit into the reader's
+// share of the hot window.
+// Use one reader per thread.
+class merlin_frame_reader
+{
+public:
+	// constructor
+	merlin_frame_reader();
+	// destructor
+	~merlin_frame_reader();
+
+protected:
+	merlin_params * pprm; // parameters with the frame file positions
+	std::ifstream fin; // input stream (used when no memory map is available)
+	std::string str_file; // name of the currently opened input file
+	int ncfidx; // index of the currently opened input file
+	char * inbuf; // staging buffer for stream input
+	size_t nbufsize; // size of the staging buffer in bytes
+	__int64 blk_idx0; // index of the first frame in the staging buffer
+	size_t blk_n; // number of frames in the staging buffer
+	size_t blk_stride; // distance of frames in the staging buffer in bytes
+	const char * blk_data; // begin of the block of frames, in the staging buffer or in the direct read buffer
+	merlin_file_range blk_range; // file range of the block of frames
+	merlin_direct_reader direct; // direct reading of the data files (see merlin_params::bdirect)
+	bool bdirect; // flags direct reading of stream input
+	std::deque<merlin_file_range> q_consumed; // consumed blocks kept in the page cache (hot window)
+	size_t nconsumed; // number of bytes in q_consumed
+	size_t nwindow; // number of bytes of consumed blocks kept in the page cache
+	std::vector<int> v_advfd; // descriptor of each data file used for advice to stream input (-1: not open)
+
+	// member functions
+protected:
+	// gives advice on the use of range rng (see merlin_data_map::advise)
+	void advise(const merlin_file_range & rng, int nadvice);
+
+	// returns the number of frames in the block starting with frame idx
+	// at position fpos of file fidx, extended by the following requested
+	// frames (nnext frames in total) as long as they are stored in the
+	// same file at equal distances and the block fits into nblkmax bytes
+	// - output stride = distance of the frames in the block (0: single frame)
+	size_t get_block(__int64 idx, int fidx, std::streampos fpos, size_t nnext, size_t nblkmax, size_t & stride);
+
+	// registers the current block as consumed and releases consumed
+	// blocks beyond the hot window from the page cache
+	void release_block(void);
+
+public:
+	// prepares the reader for accessing frames of *pprm_in
+	// - input nreaders = number of readers used at the same time,
+	//   sharing the hot window merlin_params::nhotwindow
+	// - return value = error code (0: success)
+	int init(merlin_params * pprm_in, int nreaders = 1);
+
+	// closes input streams and frees the staging buffer, consumed blocks
+	// of the hot window stay in the page cache
+	void close(void);
+
+	// returns true if frame data is taken from memory mapped files
+	bool is_mapped(void);
+
+	// provides a pointer to the raw data of frame idx
+	// - input idx = global frame index
+	// - input nnext = number of frames idx, idx + 1, ... requested in
+	//   sequence, as many of them as are stored back to back in the
+	//   same file are handled as one block
+	// - output pdata = pointer to n_data_bytes of raw data, valid
+	//   until the next call of a reader function
+	// - return value = error code (0: success)
+	int get_frame_raw(__int64 idx, const char ** pdata, size_t nnext = 1);
+
+	// reads frame idx and decodes the data to double
+	// - input idx = global frame index
+	// - input nnext = number of frames requested in sequence (see
+	//   get_frame_raw)
+	// - output buf = frame data
+	// - return value = error code (0: success)
+	int read_frame(__int64 idx, double * buf, size_t nnext = 1);
+};
+
+// returns the number of items in [i, i1) of the list v_items, starting
+// at i, with consecutive frame indices
+size_t merlin_frame_run(const std::vector<merlin_frame_item> & v_items, size_t i, size_t i1);
@@ -0,0 +1,562 @@
+// file : "merlin_stream.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the Merlin TCP data stream input and replay server.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+
+#include "pch.h"
+#include "merlin_stream.h"
+#include "merlin_prm.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET merlin_sock_t;
+#define MERLIN_INVALID_SOCKET INVALID_SOCKET
+#define merlin_close_socket closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+typedef int merlin_sock_t;
+#define MERLIN_INVALID_SOCKET (-1)
+#define merlin_close_socket ::close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+constexpr int MERLIN_STREAM_RCVBUF = 0x1000000; // requested size of the receive buffer of the socket
+constexpr size_t MERLIN_STREAM_CHUNK_MAX = 0x100000; // max. number of bytes per socket call
+
+
+// prepares the socket library once (Windows)
+static int merlin_socket_startup(void)
+{
+#ifdef _WIN32
+	static bool bstarted = false;
+	WSADATA wsa;
+	if (!bstarted) {
+		if (0 != WSAStartup(MAKEWORD(2, 2), &wsa)) {
+			return 1;
+		}
+		bstarted = true;
+	}
+#endif
+	return 0;
+}
+
+void merlin_stream_prefix(char * pdata, size_t nlen)
+{
+	char cbuf[32];
+	snprintf(cbuf, sizeof(cbuf), "MPX,%010llu,", (unsigned long long)(nlen + 1));
+	memcpy(pdata, cbuf, MERLIN_STREAM_PREFIX_BYTES);
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_socket
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_socket::merlin_socket()
+{
+	nsock = -1;
+}
+
+merlin_socket::~merlin_socket()
+{
+	close();
+}
+
+int merlin_socket::connect(std::string str_addr)
+{
+	int nerr = 0;
+	int nbuf = MERLIN_STREAM_RCVBUF;
+	size_t isep = str_addr.find_last_of(':');
+	std::string str_host = (isep == std::string::npos ? str_addr : str_addr.substr(0, isep));
+	std::string str_port = (isep == std::string::npos ? std::to_string(MERLIN_STREAM_PORT) : str_addr.substr(isep + 1));
+	struct addrinfo hints;
+	struct addrinfo * pres = NULL, * pa = NULL;
+	merlin_sock_t s = MERLIN_INVALID_SOCKET;
+	close();
+	if (0 != merlin_socket_startup()) {
+		return 1; // no socket library
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (0 != getaddrinfo(str_host.c_str(), str_port.c_str(), &hints, &pres)) {
+		return 2; // unknown host or port
+	}
+	for (pa = pres; pa != NULL; pa = pa->ai_next) { // try all addresses of the host
+		s = socket(pa->ai_family, pa->ai_socktype, pa->ai_protocol);
+		if (s == MERLIN_INVALID_SOCKET) continue;
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&nbuf, sizeof(nbuf)); // absorb bursts while frames are processed
+		if (0 == ::connect(s, pa->ai_addr, (int)pa->ai_addrlen)) break;
+		merlin_close_socket(s);
+		s = MERLIN_INVALID_SOCKET;
+	}
+	freeaddrinfo(pres);
+	if (s == MERLIN_INVALID_SOCKET) {
+		return 3; // connection failed
+	}
+	nsock = (__int64)s;
+	return nerr;
+}
+
+int merlin_socket::accept(int nport)
+{
+	int nopt = 1;
+	struct sockaddr_in addr;
+	merlin_sock_t sl = MERLIN_INVALID_SOCKET, s = MERLIN_INVALID_SOCKET;
+	close();
+	if (0 != merlin_socket_startup()) {
+		return 1; // no socket library
+	}
+	sl = socket(AF_INET, SOCK_STREAM, 0);
+	if (sl == MERLIN_INVALID_SOCKET) {
+		return 2;
+	}
+	setsockopt(sl, SOL_SOCKET, SO_REUSEADDR, (const char*)&nopt, sizeof(nopt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((unsigned short)nport);
+	if (0 != bind(sl, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(sl, 1)) {
+		merlin_close_socket(sl);
+		return 3; // port not available
+	}
+	s = ::accept(sl, NULL, NULL);
+	merlin_close_socket(sl); // serve a single client
+	if (s == MERLIN_INVALID_SOCKET) {
+		return 4;
+	}
+	nsock = (__int64)s;
+	return 0;
+}
+
+void merlin_socket::close(void)
+{
+	if (nsock >= 0) {
+		merlin_close_socket((merlin_sock_t)nsock);
+	}
+	nsock = -1;
+}
+
+bool merlin_socket::is_open(void) const
+{
+	return (nsock >= 0);
+}
+
+int merlin_socket::receive(char * pdata, size_t nbytes)
+{
+	size_t ndone = 0;
+	int nrcv = 0;
+	if (nsock < 0) {
+		return 2; // not connected
+	}
+	while (ndone < nbytes) {
+		nrcv = (int)recv((merlin_sock_t)nsock, pdata + ndone, (int)std::min(nbytes - ndone, MERLIN_STREAM_CHUNK_MAX), 0);
+		if (nrcv == 0) {
+			return 1; // closed by the other side
+		}
+		if (nrcv < 0) {
+#ifndef _WIN32
+			if (errno == EINTR) continue;
+#endif
+			return 2; // connection failure
+		}
+		ndone += (size_t)nrcv;
+	}
+	return 0;
+}
+
+int merlin_socket::receive_prefix(size_t & nlen)
+{
+	int nerr = 0;
+	char cbuf[MERLIN_STREAM_PREFIX_BYTES + 1];
+	nlen = 0;
+	nerr = receive(cbuf, MERLIN_STREAM_PREFIX_BYTES);
+	if (nerr != 0) {
+		return nerr;
+	}
+	cbuf[MERLIN_STREAM_PREFIX_BYTES] = '\0';
+	if (0 != strncmp(cbuf, "MPX,", 4) || cbuf[MERLIN_STREAM_PREFIX_BYTES - 1] != ',') {
+		return 3; // not a message prefix
+	}
+	nlen = (size_t)strtoull(cbuf + 4, NULL, 10);
+	if (nlen < 1) {
+		return 3;
+	}
+	nlen--; // the length includes the comma after the number
+	return 0;
+}
+
+int merlin_socket::send(const char * pdata, size_t nbytes)
+{
+	size_t ndone = 0;
+	int nsnd = 0;
+	if (nsock < 0) {
+		return 2; // not connected
+	}
+	while (ndone < nbytes) {
+		nsnd = (int)::send((merlin_sock_t)nsock, pdata + ndone, (int)std::min(nbytes - ndone, MERLIN_STREAM_CHUNK_MAX), MSG_NOSIGNAL);
+		if (nsnd < 0) {
+#ifndef _WIN32
+			if (errno == EINTR) continue;
+#endif
+			return 1; // connection failure or closed by the client
+		}
+		ndone += (size_t)nsnd;
+	}
+	return 0;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// merlin_stream_input
+//
+// -----------------------------------------------------------------------------
+
+
+merlin_stream_input::merlin_stream_input()
+{
+	nhdr = 0;
+	nmsg = 0;
+	bend = false;
+	bconsumed = false;
+	npartmax = 0;
+	partbuf[0] = NULL;
+	partbuf[1] = NULL;
+	icur = 0;
+}
+
+merlin_stream_input::~merlin_stream_input()
+{
+	close();
+}
+
+int merlin_stream_input::open(std::string str_addr, merlin_hdr * phdr, merlin_frame_hdr * pfhdr)
+{
+	int nerr = 0;
+	size_t nlen = 0, ndata = 0;
+	std::vector<char> v_msg;
+	if (NULL == phdr || NULL == pfhdr) {
+		return 1; // missing parameters
+	}
+	close();
+	nerr = sock.connect(str_addr);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to connect to the data stream at " << str_addr << " (code " << nerr << ").\n";
+		return 2;
+	}
+	// acquisition header
+	nerr = sock.receive_prefix(nlen);
+	if (nerr == 0) {
+		v_msg.resize(nlen + 1, 0);
+		nerr = sock.receive(v_msg.data(), nlen);
+	}
+	if (nerr != 0 || nlen < 4 || 0 != strncmp(v_msg.data(), "HDR,", 4)) {
+		std::cerr << "Error: expecting the acquisition header at the begin of the data stream.\n";
+		nerr = 3;
+		goto _cancel_point;
+	}
+	*phdr = merlin_hdr();
+	merlin_parse_header(v_msg.data(), nlen, phdr);
+	// first frame, other messages are skipped
+	do {
+		nerr = sock.receive_prefix(nlen);
+		if (nerr == 0) {
+			v_pending.resize(nlen);
+			nerr = sock.receive(v_pending.data(), nlen);
+		}
+	} while (nerr == 0 && 0 != merlin_parse_frame_header(v_pending.data(), nlen, pfhdr, true));
+	if (nerr != 0) {
+		std::cerr << "Error: failed to receive the first frame of the data stream (code " << nerr << ").\n";
+		nerr = 4;
+		goto _cancel_point;
+	}
+	nhdr = (size_t)pfhdr->n_size;
+	ndata = ((size_t)pfhdr->n_columns * pfhdr->n_rows * pfhdr->n_bpi >> 3);
+	if (nlen < nhdr + ndata) {
+		std::cerr << "Error: frame message of the data stream is shorter than its frame (" << nlen << " < " << nhdr + ndata << " bytes).\n";
+		nerr = 5;
+		goto _cancel_point;
+	}
+	nmsg = nlen;
+	npartmax = std::max((size_t)1, MERLIN_STREAM_PART_BYTES / nmsg);
+	phdr->n_files = 0;
+	phdr->n_fhdr_bytes = nhdr;
+	phdr->n_data_bytes = ndata;
+_cancel_point:
+	if (nerr != 0) {
+		close();
+	}
+	return nerr;
+}
+
+void merlin_stream_input::close(void)
+{
+	int i = 0;
+	sock.close();
+	for (i = 0; i < 2; i++) {
+		if (NULL != partbuf[i]) free(partbuf[i]);
+		partbuf[i] = NULL;
+		v_part_idx[i].clear();
+	}
+	v_pending.clear();
+	nhdr = 0;
+	nmsg = 0;
+	npartmax = 0;
+	bend = false;
+	bconsumed = false;
+	icur = 0;
+}
+
+bool merlin_stream_input::is_open(void) const
+{
+	return (nmsg > 0);
+}
+
+bool merlin_stream_input::at_end(void) const
+{
+	return bend;
+}
+
+bool merlin_stream_input::is_consumed(void) const
+{
+	return bconsumed;
+}
+
+void merlin_stream_input::set_consumed(void)
+{
+	bconsumed = true;
+	sock.close(); // the rest of the stream is not used
+}
+
+int merlin_stream_input::receive_part(int ipart, const __int64 * pidx, size_t nidx, size_t & nused, __int64 ncolumns)
+{
+	int nerr = 0;
+	size_t nlen = 0, nskip = 0;
+	char * pslot = NULL;
+	std::vector<char> v_skip;
+	merlin_frame_hdr fhdr;
+	nused = 0;
+	if (ipart < 0 || ipart > 1 || nmsg == 0) {
+		return 1; // invalid part or stream not open
+	}
+	std::vector<__int64> & v_idx = v_part_idx[ipart];
+	v_idx.clear();
+	if (NULL == partbuf[ipart]) {
+		partbuf[ipart] = (char*)malloc(npartmax * nmsg);
+		if (NULL == partbuf[ipart]) {
+			return 100; // buffer allocation failed
+		}
+	}
+	while (!bend && nused < nidx && v_idx.size() < npartmax) {
+		pslot = partbuf[ipart] + v_idx.size() * nmsg; // next free slot
+		if (v_pending.size() > 0) { // frame received ahead
+			memcpy(pslot, v_pending.data(), nmsg);
+			v_pending.clear();
+		}
+		else {
+			nerr = sock.receive_prefix(nlen);
+			if (nerr == 0 && nlen != nmsg) { // not a frame of the acquisition, skip the message
+				v_skip.resize(std::min(nlen, MERLIN_STREAM_CHUNK_MAX));
+				while (nerr == 0 && nlen > 0) {
+					nskip = std::min(nlen, v_skip.size());
+					nerr = sock.receive(v_skip.data(), nskip);
+					nlen -= nskip;
+				}
+				if (nerr == 0) continue;
+			}
+			if (nerr == 0) {
+				nerr = sock.receive(pslot, nmsg);
+			}
+			if (nerr == 1) { // stream closed by the server
+				bend = true;
+				nerr = 0;
+				break;
+			}
+			if (nerr != 0) {
+				std::cerr << "Error: failed to receive frames from the data stream (code " << nerr << ").\n";
+				return 2;
+			}
+		}
+		if (0 != merlin_parse_frame_header(pslot, nhdr, &fhdr, false)) {
+			continue; // not a frame header, drop the message
+		}
+		while (nused < nidx && pidx[nused] < fhdr.i_seq) { // frames missing in the stream
+			nused++;
+		}
+		if (nused == nidx) {
+			break; // frame after the requested frames
+		}
+		if (pidx[nused] != fhdr.i_seq) {
+			continue; // frame not requested, the slot is used again
+		}
+		v_idx.push_back(fhdr.i_seq);
+		nused++;
+		if (ncolumns > 0 && nused < nidx && pidx[nused] / ncolumns != fhdr.i_seq / ncolumns) {
+			break; // end of a scan row
+		}
+	}
+	if (bend) { // requested frames never received
+		nused = nidx;
+	}
+	return 0;
+}
+
+const std::vector<__int64> & merlin_stream_input::get_part_frames(int ipart) const
+{
+	return v_part_idx[ipart & 1];
+}
+
+void merlin_stream_input::set_current_part(int ipart)
+{
+	icur = (ipart & 1);
+}
+
+const char * merlin_stream_input::get_frame_data(__int64 idx) const
+{
+	const std::vector<__int64> & v_idx = v_part_idx[icur];
+	std::vector<__int64>::const_iterator it = std::lower_bound(v_idx.begin(), v_idx.end(), idx);
+	if (it == v_idx.end() || *it != idx || NULL == partbuf[icur]) {
+		return NULL; // not in the current part
+	}
+	return partbuf[icur] + (size_t)(it - v_idx.begin()) * nmsg + nhdr;
+}
+
+
+// -----------------------------------------------------------------------------
+//
+// replay server
+//
+// -----------------------------------------------------------------------------
+
+
+int merlin_serve_stream(merlin_params * pprm, int nport)
+{
+	int nerr = 0;
+	int ifile = -1, ncfile = -1;
+	__int64 idx = 0;
+	size_t nmsg = 0, nhdrfile = 0;
+	double dt = 0.;
+	char * msgbuf = NULL;
+	std::streampos fpos;
+	std::ifstream fin;
+	std::string str_file;
+	merlin_socket sock;
+	std::chrono::steady_clock::time_point t0;
+	if (NULL == pprm) {
+		return 1; // missing parameters
+	}
+	nmsg = pprm->hdr.n_fhdr_bytes + pprm->hdr.n_data_bytes;
+	if (nmsg == 0 || pprm->hdr.n_frames <= 0) {
+		std::cerr << "Error: no frames to serve.\n";
+		return 2;
+	}
+	// acquisition header from the header file
+	str_file = pprm->str_file_input + ".hdr";
+	fin.open(str_file, std::ios::binary | std::ios::ate);
+	if (!fin.is_open()) {
+		std::cerr << "Error: failed to open header file " << str_file << ".\n";
+		return 3;
+	}
+	nhdrfile = (size_t)fin.tellg();
+	msgbuf = (char*)malloc(MERLIN_STREAM_PREFIX_BYTES + std::max(nmsg, nhdrfile));
+	if (NULL == msgbuf) {
+		nerr = 100;
+		goto _cancel_point;
+	}
+	fin.seekg(0);
+	fin.read(msgbuf + MERLIN_STREAM_PREFIX_BYTES, nhdrfile);
+	fin.close();
+	merlin_stream_prefix(msgbuf, nhdrfile);
+	if (pprm->btalk) {
+		std::cout << "- serving " << pprm->hdr.n_frames << " frames on 127.0.0.1:" << nport << ", waiting for a client ...\n";
+	}
+	nerr = sock.accept(nport);
+	if (nerr != 0) {
+		std::cerr << "Error: failed to accept a client on port " << nport << " (code " << nerr << ").\n";
+		nerr = 4;
+		goto _cancel_point;
+	}
+	t0 = std::chrono::steady_clock::now();
+	nerr = sock.send(msgbuf, MERLIN_STREAM_PREFIX_BYTES + nhdrfile);
+	// frames in acquisition order, each frame header with its data
+	merlin_stream_prefix(msgbuf, nmsg);
+	for (idx = 0; idx < pprm->hdr.n_frames && nerr == 0; idx++) {
+		if (0 != pprm->get_frame_filepos(idx, ifile, fpos)) {
+			nerr = 11;
+			break;
+		}
+		if (ifile != ncfile) {
+			if (fin.is_open()) fin.close();
+			str_file = pprm->str_file_input + std::to_string(ifile + 1) + ".mib";
+			fin.open(str_file, std::ios::binary);
+			if (!fin.is_open()) {
+				std::cerr << "Error: failed to open data file " << str_file << ".\n";
+				nerr = 12;
+				break;
+			}
+			ncfile = ifile;
+		}
+		fin.seekg(fpos - (std::streamoff)pprm->hdr.n_fhdr_bytes);
+		fin.read(msgbuf + MERLIN_STREAM_PREFIX_BYTES, nmsg);
+		if (fin.fail()) {
+			std::cerr << "Error: failed to read frame # " << idx << " from file " << str_file << ".\n";
+			nerr = 13;
+			break;
+		}
+		nerr = sock.send(msgbuf, MERLIN_STREAM_PREFIX_BYTES + nmsg);
+	}
+	if (nerr == 1) {
+		std::cerr << "Warning: the client closed the connection after " << idx << " frames.\n";
+		nerr = 0;
+	}
+	dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (nerr == 0 && pprm->btalk) {
+		std::cout << "- served " << idx << " frames in " << dt << " s (" << (dt > 0. ? (double)idx * nmsg / 1048576. / dt : 0.) << " MB/s).\n";
+	}
+_cancel_point:
+	if (fin.is_open()) fin.close();
+	sock.close();
+	if (msgbuf) free(msgbuf);
+	return nerr;
+}
@@ -0,0 +1,166 @@
+// file : "merlin_stream.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the Merlin TCP data stream input and replay server used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+
+#pragma once
+#include "merlin_hdr.h"
+#include <string>
+#include <vector>
+
+constexpr int MERLIN_STREAM_PORT = 6342; // default data port of the Merlin readout
+constexpr size_t MERLIN_STREAM_PREFIX_BYTES = 15; // size of the message prefix "MPX,<10 digit length>,"
+constexpr size_t MERLIN_STREAM_PART_BYTES = 0x4000000; // max. size of a part of frames received at once
+
+class merlin_params;
+
+// TCP connection carrying Merlin data messages. Each message starts with
+// the prefix "MPX,<length>," where <length> is a 10 digit decimal
+// number counting the bytes after the number, including the comma.
+// The message content is the acquisition header ("HDR,...") or a frame
+// header followed by the frame data as stored in the data files.
+class merlin_socket
+{
+public:
+	// constructor
+	merlin_socket();
+	// destructor
+	~merlin_socket();
+	// no copies, the object owns the connection
+	merlin_socket(const merlin_socket &) = delete;
+	merlin_socket & operator=(const merlin_socket &) = delete;
+
+protected:
+	__int64 nsock; // socket of the connection (-1: closed)
+
+	// member functions
+public:
+	// connects to a server at str_addr = "<host>[:<port>]"
+	// - return value = error code (0: success)
+	int connect(std::string str_addr);
+
+	// waits for a client connecting to port nport of the loopback
+	// interface (127.0.0.1) and takes the connection
+	// - return value = error code (0: success)
+	int accept(int nport);
+
+	// closes the connection
+	void close(void);
+
+	// returns true if connected
+	bool is_open(void) const;
+
+	// receives nbytes to pdata
+	// - return value = error code (0: success, 1: connection closed
+	//   by the other side, 2: connection failure)
+	int receive(char * pdata, size_t nbytes);
+
+	// receives the prefix of the next message
+	// - output nlen = number of content bytes of the message
+	// - return value = error code (0: success, 1: connection closed,
+	//   2: connection failure, 3: invalid message prefix)
+	int receive_prefix(size_t & nlen);
+
+	// sends nbytes from pdata
+	// - return value = error code (0: success)
+	int send(const char * pdata, size_t nbytes);
+};
+
+// writes the message prefix for nlen content bytes to pdata
+// (MERLIN_STREAM_PREFIX_BYTES characters, not terminated)
+void merlin_stream_prefix(char * pdata, size_t nlen);
+
+// Receives the frames of an acquisition from a Merlin data stream.
+// The acquisition header and the first frame are received when the
+// stream is opened. Frames are then received in parts, into one of
+// two part buffers, so that one part is received while the frames of
+// the other part are processed. Frames which are not requested are
+// received and dropped, since the stream passes only once.
+class merlin_stream_input
+{
+public:
+	// constructor
+	merlin_stream_input();
+	// destructor
+	~merlin_stream_input();
+
+protected:
+	merlin_socket sock; // data connection
+	size_t nhdr; // size of a frame header in bytes
+	size_t nmsg; // size of a frame message (frame header and data) in bytes
+	std::vector<char> v_pending; // frame message received ahead of the parts
+	bool bend; // flags the end of the stream
+	bool bconsumed; // flags that the frames were used by a pass of operations
+	size_t npartmax; // max. number of frames per part
+	char * partbuf[2]; // part buffers, frame messages at distances nmsg
+	std::vector<__int64> v_part_idx[2]; // frame indices of the parts, ascending
+	int icur; // part accessed by get_frame_data
+
+	// member functions
+public:
+	// connects to the stream at str_addr = "<host>[:<port>]" and
+	// receives the acquisition header and the first frame
+	// - output phdr = acquisition header with frame sizes set
+	// - output pfhdr = header of the first frame
+	// - return value = error code (0: success)
+	int open(std::string str_addr, merlin_hdr * phdr, merlin_frame_hdr * pfhdr);
+
+	// closes the stream and frees the part buffers
+	void close(void);
+
+	// returns true if the stream is open
+	bool is_open(void) const;
+
+	// returns true if the stream ended
+	bool at_end(void) const;
+
+	// returns true if the frames were used by a pass of operations
+	bool is_consumed(void) const;
+
+	// flags that the frames were used by a pass of operations
+	void set_consumed(void);
+
+	// receives the frames pidx[0 ... nidx-1] (ascending frame indices)
+	// into part ipart, the part ends when full, at the end of a scan
+	// row of ncolumns frames, or at the end of the stream
+	// - output nused = number of frame indices handled, frames missing
+	//   in the stream are not in the part (see get_part_frames)
+	// - return value = error code (0: success)
+	int receive_part(int ipart, const __int64 * pidx, size_t nidx, size_t & nused, __int64 ncolumns);
+
+	// returns the frame indices of part ipart
+	const std::vector<__int64> & get_part_frames(int ipart) const;
+
+	// selects the part accessed by get_frame_data
+	void set_current_part(int ipart);
+
+	// returns the raw data of frame idx in the current part, NULL if
+	// the frame is not in the part, safe to call concurrently
+	const char * get_frame_data(__int64 idx) const;
+};
+
+// serves the frames of the data files of *pprm as a Merlin data stream
+// to one client connecting to port nport of the loopback interface
+// - return value = error code (0: success)
+int merlin_serve_stream(merlin_params * pprm, int nport);
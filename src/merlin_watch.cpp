@@ -0,0 +1,114 @@
+// file : "merlin_watch.cpp"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Implementation of the watch of growing data files.
+//  Used by the program Merlinio.
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+
+#include "pch.h"
+#include "merlin_watch.h"
+#include <thread>
+#include <chrono>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+merlin_file_watch::merlin_file_watch()
+{
+	nfd = -1;
+	nwd = -1;
+}
+
+merlin_file_watch::~merlin_file_watch()
+{
+	close();
+}
+
+#ifdef __linux__
+
+int merlin_file_watch::open(std::string str_file_input)
+{
+	size_t isep = str_file_input.find_last_of('/');
+	std::string str_dir = (isep == std::string::npos ? "." : str_file_input.substr(0, isep + 1));
+	close();
+	nfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (nfd < 0) {
+		nfd = -1;
+		return 1; // no inotify, polling
+	}
+	nwd = inotify_add_watch(nfd, str_dir.c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (nwd < 0) {
+		close();
+		return 1; // folder cannot be watched, polling
+	}
+	return 0;
+}
+
+void merlin_file_watch::close(void)
+{
+	if (nfd >= 0) {
+		::close(nfd); // also removes the watch
+	}
+	nfd = -1;
+	nwd = -1;
+}
+
+void merlin_file_watch::wait(int nms)
+{
+	char buf[4096]; // event buffer, events are only counted as a change
+	struct pollfd pfd;
+	if (nfd < 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(nms));
+		return;
+	}
+	pfd.fd = nfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, nms) > 0) {
+		while (read(nfd, buf, sizeof(buf)) > 0) {} // drain all pending events
+	}
+}
+
+#else // polling
+
+int merlin_file_watch::open(std::string str_file_input)
+{
+	close();
+	return 1; // polling only
+}
+
+void merlin_file_watch::close(void)
+{
+	nfd = -1;
+	nwd = -1;
+}
+
+void merlin_file_watch::wait(int nms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(nms));
+}
+
+#endif // __linux__
@@ -0,0 +1,63 @@
+// file : "merlin_watch.h"
+// author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+//         ju.barthel@fz-juelich.de
+//
+// Declares the watch of growing data files used by merlinio
+//
+/* -----------------------------------------------------------------------
+
+This file is part of Merlinio.
+
+	Merlinio is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Merlinio is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+
+----------------------------------------------------------------------- */
+
+
+#pragma once
+#include <string>
+
+constexpr int MERLIN_WATCH_POLL_MS = 200; // max. time between checks of the data files in milliseconds
+
+// Waits for changes of the data files of a running acquisition. On
+// Linux, the folder of the data files is watched with inotify, so that
+// waiting ends as soon as a file is created or written. Waiting also
+// ends after the given time, so that files on network shares, which do
+// not report changes, and other systems are polled.
+class merlin_file_watch
+{
+public:
+	// constructor
+	merlin_file_watch();
+	// destructor
+	~merlin_file_watch();
+	// no copies, the object owns the watch
+	merlin_file_watch(const merlin_file_watch &) = delete;
+	merlin_file_watch & operator=(const merlin_file_watch &) = delete;
+
+protected:
+	int nfd; // inotify file descriptor (-1: polling)
+	int nwd; // watch descriptor of the folder
+
+	// member functions
+public:
+	// starts watching the folder of files named str_file_input...
+	// - return value = error code (0: success, 1: polling only)
+	int open(std::string str_file_input);
+
+	// stops watching
+	void close(void);
+
+	// waits for a change of the watched files, at most nms milliseconds
+	void wait(int nms = MERLIN_WATCH_POLL_MS);
+};
@@ -29,11 +29,19 @@ This file is part of Merlinio.
 
 #include "pch.h"
 #include "merlin_prm.h"
+#include "merlin_reader.h"
+#include "merlin_ops.h"
+#include "merlin_decode.h"
+#include "merlin_watch.h"
+#include "merlin_stream.h"
+#include <chrono>
 #include <algorithm>
 #include <cctype>
 
 
 merlin_params prm;
+merlin_radial_profile rad_profile; // profiles of the last radial_profile or polar_profile operation
+merlin_detector_matrix det_matrix; // virtual detectors of the last set_detectors command
 
 
 // -----------------------------------------------------------------------------
@@ -67,6 +75,40 @@ int parseoptions(int argc, char* argv[])
 					prm.bscanframeheaders = true; // force careful frame header scan
 					continue;
 				}
+				if (cmd == "/nommap" || cmd == "/nomemorymap") {
+					prm.bmemorymap = false; // read frame data with file streams
+					continue;
+				}
+				if (cmd == "/direct" || cmd == "/directio") {
+					prm.bdirect = true; // read frame data with O_DIRECT and io_uring
+					prm.bmemorymap = false; // O_DIRECT reads bypass the memory map
+					continue;
+				}
+				if (cmd == "/shard" || cmd == "/shardfiles") {
+					prm.bshard = true; // process each data file with its own group of workers
+					continue;
+				}
+				if (cmd == "/live") {
+					prm.blive = true; // process data files while the acquisition writes them
+					prm.bmemorymap = false; // growing files are read with file streams
+					continue;
+				}
+				if (cmd == "/dropbehind") {
+					prm.bdropbehind = true; // release consumed frame data from the page cache
+					continue;
+				}
+				if (cmd == "/noidx" || cmd == "/noframeindex") {
+					prm.bframeindex = false; // always scan the data files, no index file
+					continue;
+				}
+				if (cmd == "/fuse" || cmd == "/fuseoperations") {
+					prm.bfuse = true; // run consecutive operations in a single pass
+					continue;
+				}
+				if (cmd == "/nosimd") {
+					merlin_decode_set_level(MERLIN_DECODE_SCALAR); // decode frame data with scalar code
+					continue;
+				}
 
 				if (cmd == "-dbgl") { // leveled debug switch + level
 					iarg++;
@@ -80,6 +122,98 @@ int parseoptions(int argc, char* argv[])
 					continue;
 				}
 
+				if (cmd == "-pf" || cmd == "-prefetch") { // number of frames read ahead
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a number of frames after option -prefetch (-pf).\n";
+						return 1;
+					}
+					prm.nprefetch = atoi(argv[iarg]);
+					if (prm.nprefetch < 0) prm.nprefetch = 0;
+					continue;
+				}
+
+				if (cmd == "-qd" || cmd == "-queuedepth") { // number of direct read requests in flight
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a number of requests after option -queuedepth (-qd).\n";
+						return 1;
+					}
+					prm.nqdepth = atoi(argv[iarg]);
+					if (prm.nqdepth < 1) prm.nqdepth = 1;
+					continue;
+				}
+
+				if (cmd == "-hw" || cmd == "-hotwindow") { // MB of consumed data kept in the page cache
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a size in MB after option -hotwindow (-hw).\n";
+						return 1;
+					}
+					prm.nhotwindow = (size_t)(std::max(0., atof(argv[iarg])) * 1048576.);
+					prm.bdropbehind = true; // the hot window is kept by dropping older data
+					continue;
+				}
+
+				if (cmd == "-tm" || cmd == "-tilememory") { // MB of accumulation buffers of average_tiles
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a size in MB after option -tilememory (-tm).\n";
+						return 1;
+					}
+					prm.ntilememory = (size_t)(std::max(0., atof(argv[iarg])) * 1048576.);
+					continue;
+				}
+
+				if (cmd == "-lt" || cmd == "-livetimeout") { // seconds without new frames ending live processing
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a number of seconds after option -livetimeout (-lt).\n";
+						return 1;
+					}
+					prm.nlivetimeout = atoi(argv[iarg]);
+					if (prm.nlivetimeout < 1) prm.nlivetimeout = 1;
+					continue;
+				}
+
+				if (cmd == "-stream") { // address of a Merlin data stream replacing the data files
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting an address <host>[:<port>] after option -stream.\n";
+						return 1;
+					}
+					prm.str_stream = argv[iarg];
+					prm.bfuse = true; // the stream passes only once
+					prm.bmemorymap = false; // stream frames are not in mapped files
+					continue;
+				}
+
+				if (cmd == "-serve") { // port serving the data files as Merlin data stream
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a port number after option -serve.\n";
+						return 1;
+					}
+					prm.nserveport = atoi(argv[iarg]);
+					if (prm.nserveport < 1 || prm.nserveport > 65535) {
+						std::cerr << "Error: invalid port number after option -serve.\n";
+						return 1;
+					}
+					prm.bmemorymap = false; // frames are read with file streams
+					continue;
+				}
+
+				if (cmd == "-nt" || cmd == "-threads") { // number of processing threads
+					iarg++;
+					if (iarg >= argc) {
+						std::cerr << "Error: expecting a number of threads after option -threads (-nt).\n";
+						return 1;
+					}
+					prm.nthreads = atoi(argv[iarg]);
+					if (prm.nthreads < 0) prm.nthreads = 0;
+					continue;
+				}
+
 				if (cmd == "-o" || cmd =="-output") { // modified output name + name
 					iarg++;
 					if (iarg >= argc) {
@@ -108,197 +242,6 @@ int parseoptions(int argc, char* argv[])
 }
 
 
-// -----------------------------------------------------------------------------
-//
-// DATA I/O
-//
-// -----------------------------------------------------------------------------
-
-
-int write_data(char* buf, size_t nbytes, std::string str_file)
-{
-	int nerr = 0;
-	std::ofstream fout;
-	fout.open(str_file, std::ios::trunc | std::ios::binary);
-	if (fout.is_open()) {
-		fout.write(buf, nbytes);
-		if (fout.fail()) {
-			std::cerr << "Error: failed to write data to file " << str_file << ".\n";
-			nerr = 2;
-		}
-		fout.close();
-	}
-	else {
-		std::cerr << "Error: failed to open output file " << str_file << ".\n";
-		nerr = 1;
-	}
-	return nerr;
-}
-
-
-// -----------------------------------------------------------------------------
-//
-// DATA processing functions
-//
-// -----------------------------------------------------------------------------
-
-
-
-int prepare_annular_detector(size_t nlen, double * detbuf, int * dethash, size_t * nhash, merlin_frame_hdr * pfhdr)
-{
-	size_t i = 0, j = 0;
-	double qm = 0., qx = 0., qy = 0.;
-	merlin_pix p;
-	merlin_pos q;
-	bool bhash = false;
-	if (nlen == 0) {
-		return 1; // invalid parameter 1
-	}
-	if (NULL == detbuf) {
-		return 2; // missing parameter 2
-	}
-	if (NULL == pfhdr) {
-		return 5; // missing parameter 5
-	}
-
-	if (dethash != NULL && nhash != NULL) {
-		*nhash = 0;
-		bhash = true;
-	}
-	for (i = 0; i < nlen; i++) { // loop through array
-		if (0 != prm.get_frame_pixel((int)i, p.x, p.y)) {
-			return 10; // failed to get scan position
-		}
-		if (0 != prm.get_calib_pos(p, &q)) {
-			return 20; // failed to get calibrated position
-		}
-		// hard mask // replace by detector transfer function later
-		qx = q.x - prm.offset_annular.x;
-		qy = q.y - prm.offset_annular.y;
-		qm = sqrt(qx*qx + qy*qy);
-		if (qm >= prm.range_annular.min && qm < prm.range_annular.max) {
-			detbuf[i] = 1.;
-			if (bhash) {
-				j = *nhash;
-				dethash[j] = (int)i;
-				*nhash = j + 1;
-			}
-		}
-		else {
-			detbuf[i] = 0.;
-		}
-	}
-	return 0;
-}
-
-int prepare_frame_coordinates(size_t nlen, double * x, double * y, merlin_frame_hdr * pfhdr)
-{
-	size_t i = 0, j = 0;
-	double qm = 0.;
-	merlin_pix p;
-	merlin_pos q;
-	if (nlen == 0) {
-		return 1; // invalid parameter 1
-	}
-	if (NULL == x) {
-		return 2; // missing parameter 2
-	}
-	if (NULL == y) {
-		return 3; // missing parameter 3
-	}
-	if (NULL == pfhdr) {
-		return 4; // missing parameter 4
-	}
-	for (i = 0; i < nlen; i++) { // loop through array
-		if (0 != prm.get_frame_pixel((int)i, p.x, p.y)) {
-			return 10; // failed to get scan position
-		}
-		if (0 != prm.get_calib_pos(p, &q)) {
-			return 20; // failed to get calibrated position
-		}
-		// store positions
-		x[i] = q.x;
-		y[i] = q.y;
-	}
-	return 0;
-}
-
-int sum_annular_range(size_t nlen, double * buf, double * detbuf, int * dethash, size_t nhash, double * res)
-{
-	double lres = 0.0;
-	size_t i = 0, j=0;
-	if (NULL == buf) {
-		return 2; // invalid input pointer, parameter 2
-	}
-	if (NULL == detbuf) {
-		return 3; // invalid input pointer, parameter 3
-	}
-	if (NULL == res) {
-		return 6; // invalid input pointer, parameter 6
-	}
-	*res = 0.;
-	if (nlen > 0) {
-		if (dethash != NULL && nhash > 0) { // hash-based summation
-			for (i = 0; i < nhash; i++) {
-				j = (size_t)dethash[i];
-				lres += buf[j] * detbuf[j];
-			}
-		}
-		else { // standard summation
-			for (i = 0; i < nlen; i++) {
-				lres += buf[i] * detbuf[i];
-			}
-		}
-		*res = lres;
-	}
-	return 0;
-}
-
-int com_annular_range(size_t nlen, double * buf, double * detbuf, double * x, double * y, int * dethash, size_t nhash, double ref0, double * resx, double * resy)
-{
-	double lresx = 0.0;
-	double lresy = 0.0;
-	size_t i = 0, j = 0;
-	if (NULL == buf) {
-		return 2; // invalid input pointer, parameter 2
-	}
-	if (NULL == detbuf) {
-		return 3; // invalid input pointer, parameter 3
-	}
-	if (NULL == x) {
-		return 4; // invalid input pointer, parameter 4
-	}
-	if (NULL == y) {
-		return 5; // invalid input pointer, parameter 5
-	}
-	if (NULL == resx) {
-		return 9; // invalid input pointer, parameter 9
-	}
-	if (NULL == resy) {
-		return 10; // invalid input pointer, parameter 10
-	}
-	*resx = 0.;
-	*resy = 0.;
-	if (nlen > 0 && ref0 > 0.) {
-		if (dethash != NULL && nhash > 0) { // hash-based summation
-			for (i = 0; i < nhash; i++) {
-				j = (size_t)dethash[i];
-				lresx += (x[j] * buf[j] * detbuf[j]);
-				lresy += (y[j] * buf[j] * detbuf[j]);
-			}
-		}
-		else { // standard summation
-			for (i = 0; i < nlen; i++) {
-				lresx += (x[i] * buf[i] * detbuf[i]);
-				lresy += (y[i] * buf[i] * detbuf[i]);
-			}
-		}
-		*resx = lresx / ref0;
-		*resy = lresy / ref0;
-	}
-	return 0;
-}
-
 // -----------------------------------------------------------------------------
 //
 // SET control parameter functions
@@ -318,94 +261,70 @@ int com_annular_range(size_t nlen, double * buf, double * detbuf, double * x, do
 int run_extract_frames()
 {
 	int nerr = 0;
-	int i_frm = 0; // frame index
-	size_t scan_pix = (size_t)prm.hdr.n_columns * prm.hdr.n_rows; // number of scan items
-	char* datbuf = NULL;
-	merlin_pix scan_pos;
-	std::string str_file; // file name
-	std::ifstream fin; // input stream
+	__int64 i_frm = 0; // frame index
+	const char* datbuf = NULL;
+	merlin_frame_reader reader; // frame data input
+	std::vector<merlin_frame_item> v_items; // frames in the scan roi
 	std::ofstream fout; // output stream
-	std::streampos fpos; // file position
-	int ncfidx = -1;
-	int fidx = -1; // file index
-	int file_frm = -1; // frame index in file
 	int prog_pct = 0;
 	int prog_pct_old = 0;
+	size_t i = 0, n_items = 0; // frame item index and count
+	size_t irun = 0; // end of the current run of consecutive frames
 	size_t nres = 0; // number of result items
+	if (prm.stream.is_open()) {
+		std::cerr << "Error: extract_frames is not supported with a data stream input.\n";
+		return 2;
+	}
 	fout.open(prm.str_file_output, std::ios::binary | std::ios::trunc); // open output file for writing binary data
 	if (!fout.is_open()) {
 		std::cerr << "Error: failed to open output file " << prm.str_file_output << " for writing data.\n";
 		return 1;
 	}
 	if (prm.hdr.n_data_bytes > 0 && prm.hdr.n_frames > 0) {
-		datbuf = (char*)calloc(prm.hdr.n_data_bytes, sizeof(char));
+		nerr = reader.init(&prm);
+		if (nerr != 0) {
+			std::cerr << "Error: failed to initialize the frame reader (code " << nerr << ").\n";
+			nerr = 102;
+			goto _cancel_point; // stop working
+		}
+		nerr = prm.get_scan_roi_frames(v_items);
+		if (nerr != 0) {
+			std::cerr << "Error: failed to determine frames in the scan roi (code " << nerr << ").\n";
+			nerr = 100;
+			goto _cancel_point; // stop working
+		}
+		n_items = v_items.size();
 		if (prm.btalk) {
 			std::cout << "- extracting frames in current scan roi ...\n";
 			std::cout << "  0 %\r";
 		}
-		for (i_frm = 0; i_frm < prm.hdr.n_frames; i_frm++) {
-			nerr = prm.get_scan_pixel((int)i_frm, scan_pos.x, scan_pos.y);
-			if (nerr != 0) { // integration failed
-				std::cerr << "Error: failed to determine scan position for frame # " << i_frm << " (code " << nerr << ").\n";
-				nerr = 100;
+		for (i = 0; i < n_items; i++) {
+			i_frm = v_items[i].idx;
+			if (i >= irun) { // frames which can be read together
+				irun = i + merlin_frame_run(v_items, i, n_items);
+			}
+			nerr = reader.get_frame_raw(i_frm, &datbuf, irun - i); // get raw frame data
+			if (nerr != 0) { // reading failed
+				std::cerr << "Error: failed reading data of frame # " << i_frm << " (code " << nerr << ").\n";
+				nerr = 103;
 				goto _cancel_point; // stop working
 			}
-			if (prm.in_scan_roi(scan_pos, prm.scan_rect_roi)) {
-				nerr = prm.get_frame_filepos(i_frm, fidx, fpos);
-				if (nerr != 0) { // couldn't determine file index
-					std::cerr << "Error: failed to determine file index and datat offset for frame # " << i_frm << std::endl;
-					nerr = 101;
-					goto _cancel_point; // stop working
-				}
-				if (fidx != ncfidx && fidx >= 0) { // not the right file is open
-					if (ncfidx >= 0 && fin.is_open()) { // close the wrong file
-						fin.close();
-					}
-					str_file = prm.str_file_input + std::to_string(fidx + 1) + ".mib"; // file name construction
-					fin.open(str_file, std::ios::binary); // open the right file
-					if (fin.is_open()) { // successfully opened
-						ncfidx = fidx; // update current file index
-					}
-					else { // failure opening file
-						std::cerr << "Error: failed to open input file: " << str_file << " for reading data.\n";
-						nerr = 102;
-						goto _cancel_point; // stop working
-					}
-				}
-				fin.seekg(fpos);
-				if (!fin.fail()) {
-					fin.read(datbuf, prm.hdr.n_data_bytes); // read from input file
-					if (fin.fail()) {
-						std::cerr << "Error: failed reading data from input file: " << str_file << std::endl;
-						nerr = 103;
-						goto _cancel_point; // stop working
-					}
-					fout.write(datbuf, prm.hdr.n_data_bytes); // append to output file
-					if (fout.fail()) {
-						std::cerr << "Error: failed writing data to output file: " << prm.str_file_output << std::endl;
-						nerr = 104;
-						goto _cancel_point; // stop working
-					}
-					nres++; // increment result numbers
-				}
-				else {
-					std::cerr << "Error: failed to position file pointer to frame # " << i_frm << ".\n";
-					nerr = 106;
-					goto _cancel_point; // stop working
-				}
-			} // if in roi
+			fout.write(datbuf, prm.hdr.n_data_bytes); // append to output file
+			if (fout.fail()) {
+				std::cerr << "Error: failed writing data to output file: " << prm.str_file_output << std::endl;
+				nerr = 104;
+				goto _cancel_point; // stop working
+			}
+			nres++; // increment result numbers
 			// 
-			prog_pct = (int)(100. * (double)i_frm / (double)prm.hdr.n_frames); // progress in percent
+			prog_pct = (int)(100. * (double)(i + 1) / (double)n_items); // progress in percent
 			if (prm.btalk && prog_pct > prog_pct_old) { // progress step ...
 				std::cout << "  " << prog_pct << " %\r";
 				prog_pct_old = prog_pct;
 			}
 		} // frame loop
 	_cancel_point:
-		if (datbuf) free(datbuf);
-		if (fin.is_open()) {
-			fin.close();
-		}
+		reader.close();
 		if (fout.is_open()) {
 			fout.close();
 			if (prm.btalk) {
@@ -438,483 +357,64 @@ int run_extract_frames()
 
 
 
-int run_average_frames()
+// runs operation *pop on the frames of the current scan roi or adds it
+// to the list of pending operations in fused execution mode
+int run_operation(merlin_operation * pop, std::vector<merlin_operation*> & v_ops_pending)
 {
 	int nerr = 0;
-	size_t i_frm = 0; // frame index
-	size_t i_pix = 0; // pixel index
-	size_t frm_pix = (size_t)prm.hdr_frm.n_columns * prm.hdr_frm.n_rows; // number of frame items
-	size_t scan_pix = (size_t)prm.hdr.n_columns * prm.hdr.n_rows; // number of scan items
-	double dtmp = 0.;
-	double * datbuf = NULL; // pre-processed data buffer
-	double * resbuf = NULL; // result buffer
-	double * devbuf = NULL; // deviation buffer
-	merlin_pix scan_pos; // scan position index
-	std::string str_file; // file name
-	std::ifstream fin; // input stream
-	std::ofstream fout; // output stream
-	std::streampos fpos; // file position
-	int ncfidx = -1;
-	int fidx = -1; // file index
-	int file_frm = -1; // frame index in file
-	int prog_pct = 0;
-	int prog_pct_old = 0;
-	size_t nres = 0; // number of result items
-	if (frm_pix > 0 && prm.hdr.n_frames > 0) {
-		datbuf = (double*)calloc(frm_pix, sizeof(double));
-		resbuf = (double*)calloc(frm_pix, sizeof(double));
-		devbuf = (double*)calloc(frm_pix, sizeof(double));
+	std::vector<merlin_operation*> v_ops;
+	nerr = pop->init(&prm); // snapshot of the current parameters
+	if (nerr != 0) {
+		delete pop;
+		return nerr;
+	}
+	if (prm.bfuse && !prm.binteractive) { // defer to the next single pass
+		v_ops_pending.push_back(pop);
 		if (prm.btalk) {
-			std::cout << "- averaging frames in current scan roi ...\n";
-			std::cout << "  0 %\r";
+			std::cout << "- " << pop->get_command() << " added to the next pass over the data (" << v_ops_pending.size() << " operations).\n";
 		}
-		for (i_frm = 0; i_frm < prm.hdr.n_frames; i_frm++) { // loop over all frames
-			if (0 == prm.get_scan_pixel((int)i_frm, scan_pos.x, scan_pos.y)) { // got a scan position for frame
-				if (prm.in_scan_roi(scan_pos, prm.scan_rect_roi)) { // scan position is in ROI
-					nerr = prm.get_frame_filepos((int)i_frm, fidx, fpos); // get the file index and position
-					if (nerr != 0) {
-						std::cerr << "Error: failed to determine file index and position for frame : " << i_frm << ".\n";
-						nerr = 103;
-						goto _cancel_point; // stop working
-					}
-					if (fidx != ncfidx && fidx >= 0) { // not the right file is open
-						if (ncfidx >= 0 && fin.is_open()) { // close the wrong file
-							fin.close();
-						}
-						str_file = prm.str_file_input + std::to_string(fidx + 1) + ".mib"; // file name construction
-						fin.open(str_file, std::ios::binary); // open the right file
-						if (fin.is_open()) { // successfully opened
-							ncfidx = fidx; // update current file index
-						}
-						else { // failure opening file
-							std::cerr << "Error: failed to open file: " << str_file << " for reading data.\n";
-							nerr = 102;
-							goto _cancel_point; // stop working
-						}
-					}
-					if (fidx < 0) { // couldn't determine file index
-						std::cerr << "Error: failed to determine file index for frame # " << i_frm << std::endl;
-						nerr = 101;
-						goto _cancel_point; // stop working
-					}
-					nerr = merlin_read_data(datbuf, fpos, &fin, &prm.hdr, &prm.hdr_frm, prm.swapbytes);
-					if (nerr != 0) { // integration failed
-						std::cerr << "Error: failed loading data of frame # " << i_frm << " (code " << nerr << ").\n";
-						nerr = 106;
-						goto _cancel_point; // stop working
-					}
-					// integrate to result buffer
-					for (i_pix = 0; i_pix < frm_pix; i_pix++) {
-						dtmp = datbuf[i_pix];
-						resbuf[i_pix] += dtmp; // accumulate values
-						devbuf[i_pix] += (dtmp*dtmp); // accumulate squares
-					}
-					nres++; // increment result numbers
-				}
-			}
-			// 
-			prog_pct = (int)(100. * (double)i_frm / (double)prm.hdr.n_frames); // progress in percent
-			if (prm.btalk && prog_pct > prog_pct_old) { // progress step ...
-				std::cout << "  " << prog_pct << " %\r";
-				prog_pct_old = prog_pct;
-			}
-		} // frame loop
-		if (nres > 0) { // normalize result buffer (otherwise we have 0 in the result)
-			// check for required update of the defect correction list
-			if (prm.is_defect_list_modified()) prm.update_defect_correction_list();
-			//
-			nerr = prm.gain_correction(resbuf); // apply gain correction if present
-			if (nerr != 0) { // gain correction failed
-				std::cerr << "Error: gain correction failed on accumulated data (code " << nerr << ").\n";
-				nerr = 110;
-				goto _cancel_point; // stop working
-			}
-			nerr = prm.defect_correction(resbuf); // apply defect pixel correction if present
-			if (nerr != 0) { // defect correction failed
-				std::cerr << "Error: defect correction failed on accumulated data (code " << nerr << ").\n";
-				nerr = 111;
-				goto _cancel_point; // stop working
-			}
-			nerr = prm.gain_correction(devbuf); // apply gain correction twice of the square accumulation
-			nerr = prm.gain_correction(devbuf); // ...
-			if (prm.ndebug > 0 && prm.btalk) {
-				std::cout << "- rescaling output to average of " << nres << " frames.\n";
-			}
-			double sca = 1. / (double)nres;
-			for (i_pix = 0; i_pix < frm_pix; i_pix++) {
-				resbuf[i_pix] *= sca; // calculate mean
-				dtmp = devbuf[i_pix] * sca;
-				devbuf[i_pix] = sqrt(dtmp - resbuf[i_pix] * resbuf[i_pix]); // calculate std. deviation
-			}
-			nerr = prm.defect_correction(devbuf); // apply defect pixel correction on the devation image
-		}
-		else {
-			std::cerr << "Error: averaging over zero frames.\n";
-			nerr = 110;
-		}
-	_cancel_point:
-		if (fin.is_open()) fin.close();
-		if (datbuf) free(datbuf);
-		if (nerr == 0) { // write the result to files
-			str_file = prm.str_file_output + "_avg.dat";
-			if (0 == write_data((char*)resbuf, sizeof(double)*frm_pix, str_file)) {
-				if (prm.btalk) {
-					std::cout << "- written average frame to file " << str_file << ".\n";
-					std::cout << "  data type: floating point, 64 bit\n";
-					std::cout << "  sampling: " << prm.hdr_frm.n_columns << " x " << prm.hdr_frm.n_rows << " scan points\n";
-				}
-			}
-			else {
-				nerr = 200;
-			}
-			str_file = prm.str_file_output + "_sdev.dat";
-			if (0 == write_data((char*)devbuf, sizeof(double)*frm_pix, str_file)) {
-				if (prm.btalk) {
-					std::cout << "- written standard deviation frame to file " << str_file << ".\n";
-					std::cout << "  data type: floating point, 64 bit\n";
-					std::cout << "  sampling: " << prm.hdr_frm.n_columns << " x " << prm.hdr_frm.n_rows << " scan points\n";
-				}
-			}
-			else {
-				nerr = 210;
-			}
-		}
-		if (resbuf) free(resbuf);
-		if (devbuf) free(devbuf);
+		return 0;
 	}
+	v_ops.push_back(pop);
+	nerr = merlin_run_operations(&prm, v_ops);
+	if (nerr == 120) nerr = 0; // stopped early with a warning, results of the frames processed are written
+	delete pop;
 	return nerr;
 }
 
-
-
-int run_integrate_annular_range()
+// runs all pending operations in a single pass over the frames
+int run_pending_operations(std::vector<merlin_operation*> & v_ops_pending)
 {
 	int nerr = 0;
-	int i_frm = 0; // frame index
-	size_t frm_pix = (size_t)prm.hdr_frm.n_columns * prm.hdr_frm.n_rows; // number of frame items
-	size_t scan_pix = (size_t)prm.hdr.n_columns * prm.hdr.n_rows; // number of scan items
-	int * dethash = NULL; // detector function hash
-	double * datbuf = NULL; // pre-processed data buffer
-	double * detbuf = NULL; // detector function buffer
-	double * resbuf = NULL; // result buffer
-	merlin_pix scan_pos; // scan position index
-	std::string str_file; // file name
-	std::ifstream fin; // input stream
-	std::streampos fpos; // file position
-	int ncfidx = -1;
-	int fidx = -1; // file index
-	int file_frm = -1; // frame index in file
-	int prog_pct = 0;
-	int prog_pct_old = 0;
-	size_t nhash = 0; // number of hashed pixels
-	size_t nres = 0; // number of result items
-	if (frm_pix > 0 && prm.hdr.n_frames > 0 && prm.range_annular.max > prm.range_annular.min) {
-		dethash = (int*)calloc(frm_pix, sizeof(int));
-		datbuf = (double*)calloc(frm_pix, sizeof(double));
-		detbuf = (double*)calloc(frm_pix, sizeof(double));
-		resbuf = (double*)calloc(scan_pix, sizeof(double));
-		nerr = prepare_annular_detector(frm_pix, detbuf, dethash, &nhash, &prm.hdr_frm);
-		if (nerr != 0) {
-			std::cerr << "Error: failed to prepare annular detector.\n";
-			nerr = 10;
-			goto _cancel_point;
-		}
-		// check for required update of the defect correction list
-		if (prm.is_defect_list_modified()) prm.update_defect_correction_list();
-		//
-		if (prm.btalk) {
-			std::cout << "- integration over annular range in current scan roi ...\n";
-			std::cout << "  0 %\r";
-		}
-		for (i_frm = 0; i_frm < prm.hdr.n_frames; i_frm++) {
-			nerr = prm.get_scan_pixel((int)i_frm, scan_pos.x, scan_pos.y);
-			if (nerr != 0) { // integration failed
-				std::cerr << "Error: failed to determine scan position for frame # " << i_frm << " (code " << nerr << ").\n";
-				nerr = 100;
-				goto _cancel_point; // stop working
-			}
-			if (prm.in_scan_roi(scan_pos, prm.scan_rect_roi)) {
-				nerr = prm.get_frame_filepos(i_frm, fidx, fpos);
-				if (nerr != 0) { // couldn't determine file index
-					std::cerr << "Error: failed to determine file index and datat offset for frame # " << i_frm << std::endl;
-					nerr = 101;
-					goto _cancel_point; // stop working
-				}
-				if (fidx != ncfidx && fidx >= 0) { // not the right file is open
-					if (ncfidx >= 0 && fin.is_open()) { // close the wrong file
-						fin.close();
-					}
-					str_file = prm.str_file_input + std::to_string(fidx + 1) + ".mib"; // file name construction
-					fin.open(str_file, std::ios::binary); // open the right file
-					if (fin.is_open()) { // successfully opened
-						ncfidx = fidx; // update current file index
-					}
-					else { // failure opening file
-						std::cerr << "Error: failed to open file: " << str_file << " for reading data.\n";
-						nerr = 102;
-						goto _cancel_point; // stop working
-					}
-				}
-				nerr = merlin_read_data(datbuf, fpos, &fin, &prm.hdr, &prm.hdr_frm, prm.swapbytes);
-				if (nerr != 0) { // integration failed
-					std::cerr << "Error: failed loading data of frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 106;
-					goto _cancel_point; // stop working
-				}
-				nerr = prm.gain_correction(datbuf); // apply gain correction if present
-				if (nerr != 0) { // gain correction failed
-					std::cerr << "Error: gain correction failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 110;
-					goto _cancel_point; // stop working
-				}
-				nerr = prm.defect_correction(datbuf); // apply defect pixel correction if present
-				if (nerr != 0) { // defect correction failed
-					std::cerr << "Error: defect correction failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 111;
-					goto _cancel_point; // stop working
-				}
-				nerr = sum_annular_range(frm_pix, datbuf, detbuf, dethash, nhash, &resbuf[nres]);
-				if (nerr != 0) { // integration failed
-					std::cerr << "Error: detector readout failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 112;
-					goto _cancel_point; // stop working
-				}
-				nres++; // increment result numbers
-			} // if in roi
-			// 
-			prog_pct = (int)(100. * (double)i_frm / (double)prm.hdr.n_frames); // progress in percent
-			if (prm.btalk && prog_pct > prog_pct_old) { // progress step ...
-				std::cout << "  " << prog_pct << " %\r";
-				prog_pct_old = prog_pct;
-			}
-		} // frame loop
-	_cancel_point:
-		if (fin.is_open()) fin.close();
-		if (prm.ndebug > 0) {
-			if (0 == write_data((char*)detbuf, sizeof(double)*frm_pix, prm.str_file_output + ".det")) {
-				std::cout << "- written detector function to file " << prm.str_file_output + ".det" << ".\n";
-			}
-		}
-		if (dethash) free(dethash);
-		if (detbuf) free(detbuf);
-		if (datbuf) free(datbuf);
-		if (nerr == 0 && nres == 0) {
-			if (prm.btalk) {
-				std::cout << "No results calculated, output skipped.\n";
-			}
-		}
-		if (nerr == 0 && nres > 0 && resbuf) { // write the result to file
-			if (0 == write_data((char*)resbuf, sizeof(double)*nres, prm.str_file_output)) {
-				if (prm.btalk) {
-					std::cout << "- written integrated annular range data to file " << prm.str_file_output << ".\n";
-					std::cout << "  data type: floating point, 64 bit\n";
-					std::cout << "  scan sampling: " << 1 + prm.scan_rect_roi.x1 - prm.scan_rect_roi.x0 << " x " << 1 + prm.scan_rect_roi.y1 - prm.scan_rect_roi.y0 << " scan points\n";
-				}
-			}
-			else {
-				nerr = 200;
-			}
-		}
-		if (resbuf) free(resbuf);
+	size_t iop = 0;
+	if (v_ops_pending.size() == 0) {
+		return 0;
 	}
-	else {
-		if (frm_pix == 0) {
-			std::cerr << "Error: insuffient number of frame pixels.\n";
-			nerr = 1;
-		}
-		if (prm.hdr.n_frames <= 0) {
-			std::cerr << "Error: insuffient number of frames.\n";
-			nerr = 2;
-		}
-		if (prm.range_annular.max <= prm.range_annular.min) {
-			std::cerr << "Error: invalid annular range (" << prm.range_annular.min << "," << prm.range_annular.max << ").\n";
-			nerr = 3;
-		}
+	nerr = merlin_run_operations(&prm, v_ops_pending);
+	if (nerr == 120) nerr = 0; // stopped early with a warning, results of the frames processed are written
+	for (iop = 0; iop < v_ops_pending.size(); iop++) {
+		delete v_ops_pending[iop];
 	}
+	v_ops_pending.clear();
 	return nerr;
 }
 
-
-int run_center_of_mass()
+// returns true for commands that do not interrupt the collection of
+// operations in fused execution mode, operations keep a snapshot of
+// the parameters changed by these commands
+bool is_fusable_command(const std::string & scmd)
 {
-	int nerr = 0;
-	int i_frm = 0; // frame index
-	size_t frm_pix = (size_t)prm.hdr_frm.n_columns * prm.hdr_frm.n_rows; // number of frame items
-	size_t scan_pix = (size_t)prm.hdr.n_columns * prm.hdr.n_rows; // number of scan items
-	int * dethash = NULL; // detector function hash
-	double * datbuf = NULL; // pre-processed data buffer
-	double * detbuf = NULL; // detector function buffer
-	double * resbuf00 = NULL; // result buffer - integral
-	double * resbuf10 = NULL; // result buffer - com.x
-	double * resbuf11 = NULL; // result buffer - com.y
-	double * xbuf = NULL; // x-coordinates of the data frame
-	double * ybuf = NULL; // y-coordinates of the data frame
-	merlin_pix scan_pos; // scan position index
-	std::string str_file; // file name
-	std::string str_file_out; // file names for output
-	std::ifstream fin; // input stream
-	std::streampos fpos; // file position
-	int ncfidx = -1;
-	int fidx = -1; // file index
-	int file_frm = -1; // frame index in file
-	int prog_pct = 0;
-	int prog_pct_old = 0;
-	size_t nhash = 0; // number of hashed pixels
-	size_t nres = 0; // number of result items
-	if (frm_pix > 0 && prm.hdr.n_frames > 0 && prm.range_annular.max > prm.range_annular.min) {
-		dethash = (int*)calloc(frm_pix, sizeof(int));
-		datbuf = (double*)calloc(frm_pix, sizeof(double));
-		detbuf = (double*)calloc(frm_pix, sizeof(double));
-		xbuf = (double*)calloc(frm_pix, sizeof(double));
-		ybuf = (double*)calloc(frm_pix, sizeof(double));
-		resbuf00 = (double*)calloc(scan_pix, sizeof(double));
-		resbuf10 = (double*)calloc(scan_pix, sizeof(double));
-		resbuf11 = (double*)calloc(scan_pix, sizeof(double));
-		nerr = prepare_annular_detector(frm_pix, detbuf, dethash, &nhash, &prm.hdr_frm);
-		if (nerr != 0) {
-			std::cerr << "Error: failed to prepare annular detector.\n";
-			goto _cancel_point;
-		}
-		nerr = prepare_frame_coordinates(frm_pix, xbuf, ybuf, &prm.hdr_frm);
-		if (nerr != 0) {
-			std::cerr << "Error: failed to prepare frame coordinates.\n";
-			goto _cancel_point;
-		}
-		// check for required update of the defect correction list
-		if (prm.is_defect_list_modified()) prm.update_defect_correction_list();
-		//
-		if (prm.btalk) {
-			std::cout << "- integration over annular range in current scan roi ...\n";
-			std::cout << "  0 %\r";
-		}
-		for (i_frm = 0; i_frm < prm.hdr.n_frames; i_frm++) {
-			nerr = prm.get_scan_pixel((int)i_frm, scan_pos.x, scan_pos.y);
-			if (nerr != 0) { // integration failed
-				std::cerr << "Error: failed to determine scan position for frame # " << i_frm << " (code " << nerr << ").\n";
-				nerr = 100;
-				goto _cancel_point; // stop working
-			}
-			if (prm.in_scan_roi(scan_pos, prm.scan_rect_roi)) {
-				nerr = prm.get_frame_filepos(i_frm, fidx, fpos);
-				if (nerr != 0) { // couldn't determine file index
-					std::cerr << "Error: failed to determine file index and datat offset for frame # " << i_frm << std::endl;
-					nerr = 101;
-					goto _cancel_point; // stop working
-				}
-				if (fidx != ncfidx && fidx >= 0) { // not the right file is open
-					if (ncfidx >= 0 && fin.is_open()) { // close the wrong file
-						fin.close();
-					}
-					str_file = prm.str_file_input + std::to_string(fidx + 1) + ".mib"; // file name construction
-					fin.open(str_file, std::ios::binary); // open the right file
-					if (fin.is_open()) { // successfully opened
-						ncfidx = fidx; // update current file index
-					}
-					else { // failure opening file
-						std::cerr << "Error: failed to open file: " << str_file << " for reading data.\n";
-						nerr = 102;
-						goto _cancel_point; // stop working
-					}
-				}
-				nerr = merlin_read_data(datbuf, fpos, &fin, &prm.hdr, &prm.hdr_frm, prm.swapbytes);
-				if (nerr != 0) { // integration failed
-					std::cerr << "Error: failed loading data of frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 106;
-					goto _cancel_point; // stop working
-				}
-				nerr = prm.gain_correction(datbuf); // apply gain correction if present
-				if (nerr != 0) { // gain correction failed
-					std::cerr << "Error: gain correction failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 110;
-					goto _cancel_point; // stop working
-				}
-				nerr = prm.defect_correction(datbuf); // apply defect pixel correction if present
-				if (nerr != 0) { // defect correction failed
-					std::cerr << "Error: defect correction failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 111;
-					goto _cancel_point; // stop working
-				}
-				nerr = sum_annular_range(frm_pix, datbuf, detbuf, dethash, nhash, &resbuf00[nres]);
-				if (nerr != 0) { // integration failed
-					std::cerr << "Error: detector readout failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 112;
-					goto _cancel_point; // stop working
-				}
-				nerr = com_annular_range(frm_pix, datbuf, detbuf, xbuf, ybuf, dethash, nhash, resbuf00[nres], &resbuf10[nres], &resbuf11[nres]);
-				if (nerr != 0) { // integration failed
-					std::cerr << "Error: detector readout failed for frame # " << i_frm << " (code " << nerr << ").\n";
-					nerr = 112;
-					goto _cancel_point; // stop working
-				}
-				nres++; // increment result numbers
-			} // if in roi
-			// 
-			prog_pct = (int)(100. * (double)i_frm / (double)prm.hdr.n_frames); // progress in percent
-			if (prm.btalk && prog_pct > prog_pct_old) { // progress step ...
-				std::cout << "  " << prog_pct << " %\r";
-				prog_pct_old = prog_pct;
-			}
-		} // frame loop
-	_cancel_point:
-		if (fin.is_open()) fin.close();
-		if (prm.ndebug > 0) {
-			if (0 == write_data((char*)detbuf, sizeof(double)*frm_pix, prm.str_file_output + ".det")) {
-				std::cout << "- written detector function to file " << prm.str_file_output + ".det" << ".\n";
-			}
-		}
-		if (dethash) free(dethash);
-		if (detbuf) free(detbuf);
-		if (datbuf) free(datbuf);
-		if (xbuf) free(xbuf);
-		if (ybuf) free(ybuf);
-		if (nerr == 0 && nres == 0) {
-			if (prm.btalk) {
-				std::cout << "No results calculated, output skipped.\n";
-			}
-		}
-		if (nerr == 0 && nres > 0 && resbuf00 && resbuf10 && resbuf11) { // write the results to files
-			// - reference integrals 0-0
-			str_file_out = prm.str_file_output + "_0-0.dat";
-			if (0 == write_data((char*)resbuf00, sizeof(double)*nres, str_file_out)) {
-				if (prm.btalk) {
-					std::cout << "- written reference integrals to file " << str_file_out << ".\n";
-					std::cout << "  data type: floating point, 64 bit\n";
-					std::cout << "  scan sampling: " << 1 + prm.scan_rect_roi.x1 - prm.scan_rect_roi.x0 << " x " << 1 + prm.scan_rect_roi.y1 - prm.scan_rect_roi.y0 << " scan points\n";
-				}
-			}
-			else {
-				nerr = 200;
-			}
-			// - center-of-mass x 1-0
-			str_file_out = prm.str_file_output + "_1-0.dat";
-			if (0 == write_data((char*)resbuf10, sizeof(double)*nres, str_file_out)) {
-				if (prm.btalk) {
-					std::cout << "- written center-of-mass x to file " << str_file_out << ".\n";
-					std::cout << "  data type: floating point, 64 bit\n";
-					std::cout << "  scan sampling: " << 1 + prm.scan_rect_roi.x1 - prm.scan_rect_roi.x0 << " x " << 1 + prm.scan_rect_roi.y1 - prm.scan_rect_roi.y0 << " scan points\n";
-				}
-			}
-			else {
-				nerr = 210;
-			}
-			// - center-of-mass x 1-1
-			str_file_out = prm.str_file_output + "_1-1.dat";
-			if (0 == write_data((char*)resbuf11, sizeof(double)*nres, str_file_out)) {
-				if (prm.btalk) {
-					std::cout << "- written center-of-mass y to file " << str_file_out << ".\n";
-					std::cout << "  data type: floating point, 64 bit\n";
-					std::cout << "  scan sampling: " << 1 + prm.scan_rect_roi.x1 - prm.scan_rect_roi.x0 << " x " << 1 + prm.scan_rect_roi.y1 - prm.scan_rect_roi.y0 << " scan points\n";
-				}
-			}
-			else {
-				nerr = 220;
-			}
-		}
-		if (resbuf00) free(resbuf00);
-		if (resbuf10) free(resbuf10);
-		if (resbuf11) free(resbuf11);
-	}
-	return nerr;
+	return (scmd.size() == 0 ||
+		scmd == "set_origin" || scmd == "set_sampling" ||
+		scmd == "set_annular_range" || scmd == "set_annular_offset" ||
+		scmd == "set_output_file" || scmd == "set_radial_bins" ||
+		scmd == "set_polar_sectors" || scmd == "set_detectors" ||
+		scmd == "unset_detectors" || scmd == "integrate_detectors" ||
+		scmd == "set_scan_tiles" || scmd == "set_scan_tile_list" ||
+		scmd == "average_tiles" ||
+		scmd == "average_frames" || scmd == "integrate_annular_range" ||
+		scmd == "center_of_mass" || scmd == "radial_profile" ||
+		scmd == "polar_profile");
 }
 
 
@@ -1070,6 +570,7 @@ int run_ctrl(std::string file_ctrl)
 	std::string scmd, sprm;
 	std::ifstream fcin;
 	std::ofstream fcout;
+	std::vector<merlin_operation*> v_ops_pending; // operations collected for a single pass
 	
 	// handle control file I/O depending on interactive mode
 	if (prm.binteractive) {
@@ -1103,6 +604,25 @@ int run_ctrl(std::string file_ctrl)
 		// transform command to lower case for easier identification
 		std::transform(scmd.begin(), scmd.end(), scmd.begin(), ::tolower);
 
+		// run collected operations before commands changing the scan roi,
+		// the corrections, or the output of operations
+		if (v_ops_pending.size() > 0 && !is_fusable_command(scmd)) {
+			nerr = run_pending_operations(v_ops_pending);
+			if (nerr != 0) {
+				std::cerr << "Error while processing fused operations (code: " << nerr << ")\n";
+			}
+		}
+
+		// radial profiles are calculated from corrected frames and become
+		// invalid with changes of the corrections or of the scan mask
+		if (scmd == "set_defect_mask" || scmd == "set_defect_list" ||
+			scmd == "set_defect_pixel" || scmd == "unset_defect_pixel" ||
+			scmd == "unset_defect_list" || scmd == "set_gain_correction" ||
+			scmd == "unset_gain_correction" || scmd == "set_scan_mask" ||
+			scmd == "unset_scan_mask") {
+			rad_profile.clear();
+		}
+
 		// identify command and react
 		//
 		// - set commands
@@ -1112,6 +632,17 @@ int run_ctrl(std::string file_ctrl)
 			bprocessed = true;
 		}
 
+		if (scmd == "set_scan_mask") {
+			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
+			if (nerr == 0) nerr = prm.load_scan_mask(sprm);
+			bprocessed = true;
+		}
+
+		if (scmd == "unset_scan_mask") {
+			nerr = prm.unset_scan_mask();
+			bprocessed = true;
+		}
+
 		if (scmd == "set_origin") {
 			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
 			if (nerr == 0) nerr = prm.set_origin(sprm);
@@ -1136,6 +667,50 @@ int run_ctrl(std::string file_ctrl)
 			bprocessed = true;
 		}
 
+		if (scmd == "set_radial_bins") {
+			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
+			if (nerr == 0) nerr = prm.set_radial_bins(sprm);
+			bprocessed = true;
+		}
+
+		if (scmd == "set_polar_sectors") {
+			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
+			if (nerr == 0) nerr = prm.set_polar_sectors(sprm);
+			bprocessed = true;
+		}
+
+		if (scmd == "set_scan_tiles") {
+			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
+			if (nerr == 0) nerr = prm.set_scan_tiles(sprm);
+			bprocessed = true;
+		}
+
+		if (scmd == "set_scan_tile_list") {
+			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
+			if (nerr == 0) nerr = prm.load_scan_tile_list(sprm);
+			bprocessed = true;
+		}
+
+		if (scmd == "set_detectors") {
+			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
+			if (nerr == 0) {
+				det_matrix.clear((size_t)prm.hdr_frm.n_columns * prm.hdr_frm.n_rows);
+				nerr = det_matrix.load_list(&prm, sprm);
+				if (nerr != 0) {
+					det_matrix.clear();
+				}
+				else if (prm.btalk) {
+					std::cout << "- " << det_matrix.get_num_detectors() << " virtual detectors with " << det_matrix.get_num_weights() << " pixel weights set.\n";
+				}
+			}
+			bprocessed = true;
+		}
+
+		if (scmd == "unset_detectors") {
+			det_matrix.clear();
+			bprocessed = true;
+		}
+
 		if (scmd == "set_output_file") {
 			nerr = ctrl_getline(icmd, scmd, &sprm); // get parameter input
 			if (nerr == 0) prm.str_file_output = sprm;
@@ -1200,17 +775,47 @@ int run_ctrl(std::string file_ctrl)
 		}
 
 		if (scmd == "average_frames") {
-			nerr = run_average_frames();
+			nerr = run_operation(new merlin_op_average, v_ops_pending);
+			bprocessed = true;
+		}
+
+		if (scmd == "average_tiles") {
+			nerr = run_operation(new merlin_op_tiles, v_ops_pending);
 			bprocessed = true;
 		}
 
 		if (scmd == "integrate_annular_range") {
-			nerr = run_integrate_annular_range();
+			if (v_ops_pending.size() == 0 && 0 == merlin_integrate_radial_profile(&prm, &rad_profile)) {
+				nerr = 0; // answered from the radial profiles
+			}
+			else {
+				nerr = run_operation(new merlin_op_annular, v_ops_pending);
+			}
 			bprocessed = true;
 		}
 
 		if (scmd == "center_of_mass") {
-			nerr = run_center_of_mass();
+			nerr = run_operation(new merlin_op_com, v_ops_pending);
+			bprocessed = true;
+		}
+
+		if (scmd == "radial_profile") {
+			nerr = run_operation(new merlin_op_radial(&rad_profile), v_ops_pending);
+			bprocessed = true;
+		}
+
+		if (scmd == "polar_profile") {
+			nerr = run_operation(new merlin_op_radial(&rad_profile, true), v_ops_pending);
+			bprocessed = true;
+		}
+
+		if (scmd == "polar_segments") {
+			nerr = merlin_polar_segments(&prm, &rad_profile);
+			bprocessed = true;
+		}
+
+		if (scmd == "integrate_detectors") {
+			nerr = run_operation(new merlin_op_detectors(&det_matrix), v_ops_pending);
 			bprocessed = true;
 		}
 
@@ -1231,6 +836,13 @@ int run_ctrl(std::string file_ctrl)
 
 	}
 
+	if (v_ops_pending.size() > 0) { // control input ended without exit
+		nerr = run_pending_operations(v_ops_pending);
+		if (nerr != 0) {
+			std::cerr << "Error while processing fused operations (code: " << nerr << ")\n";
+		}
+	}
+
 	if (prm.binteractive) {
 		std::cout << "Do you want to store the commands to a new control file? <1> Yes. <2> No. ";
 		std::cin >> scmd;
@@ -1274,6 +886,38 @@ int control_interface(void)
 }
 
 
+// waits until a running acquisition has written the header file and the
+// first frame header of the first data file (live mode)
+int wait_live_start(void)
+{
+	int ierr = 0;
+	bool bready = false;
+	std::ifstream fin;
+	merlin_frame_hdr fhdr;
+	merlin_file_stamp stamp;
+	merlin_file_watch watch;
+	std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+	watch.open(prm.str_file_input);
+	while (!bready) {
+		if (0 == merlin_get_file_stamp(prm.str_file_input + ".hdr", stamp) && stamp.n_size > 0) {
+			fin.open(prm.str_file_input + "1.mib");
+			if (fin.is_open()) {
+				ierr = merlin_read_frame_header(&fin, &fhdr);
+				bready = (ierr == 0);
+				fin.close();
+			}
+		}
+		if (bready) break;
+		if (std::chrono::steady_clock::now() - t_start > std::chrono::seconds(prm.nlivetimeout)) {
+			std::cerr << "Error: no acquisition started within " << prm.nlivetimeout << " s.\n";
+			return 1;
+		}
+		watch.wait();
+	}
+	return 0;
+}
+
+
 
 // -----------------------------------------------------------------------------
 //
@@ -1295,6 +939,10 @@ int main(int argc, char* argv[])
 		std::cerr << "Error while parsing call options (code " << nerr << ").\n";
 		return 1;
 	}
+	if (prm.bdirect && !merlin_direct_reader::is_available()) {
+		std::cerr << "Warning: direct reading is not supported by this build, using file streams.\n";
+		prm.bdirect = false;
+	}
 		
 	if (prm.btalk) {
 		std::cout << "Running program MERLINIO\n";
@@ -1309,6 +957,17 @@ int main(int argc, char* argv[])
 			std::cout << "- running in debug mode (level " << prm.ndebug << ")\n";
 			std::cout << "- control file: " << prm.str_file_ctrl << std::endl;
 			if (prm.bscanframeheaders) std::cout << "- scanning frame headers.\n";
+			std::cout << "- prefetch depth: " << prm.nprefetch << " frames\n";
+			if (prm.bdirect) std::cout << "- direct reading with " << prm.nqdepth << " requests in flight per thread.\n";
+			if (prm.bdropbehind) std::cout << "- dropping consumed frame data behind a hot window of " << prm.nhotwindow / 1048576 << " MB.\n";
+			if (prm.bshard) std::cout << "- sharded execution, one group of workers per data file.\n";
+			if (prm.blive) std::cout << "- live processing of a running acquisition, timeout " << prm.nlivetimeout << " s.\n";
+			if (prm.bfuse) std::cout << "- fused execution of consecutive operations.\n";
+			if (prm.str_stream.size() > 0) std::cout << "- data stream input from " << prm.str_stream << "\n";
+			if (prm.nserveport > 0) std::cout << "- serving the data files as data stream on port " << prm.nserveport << "\n";
+			std::cout << "- frame decoding: " << merlin_decode_level_name(merlin_decode_get_level()) << "\n";
+			if (prm.nthreads > 0) std::cout << "- processing threads: " << prm.nthreads << "\n";
+			else std::cout << "- processing threads: " << std::thread::hardware_concurrency() << " (all)\n";
 		}
 		std::cout << "- input files: " << prm.str_file_input << std::endl;
 		std::cout << "- output files: " << prm.str_file_output << std::endl;
@@ -1320,16 +979,62 @@ int main(int argc, char* argv[])
 		}
 	}
 	
-	nerr = prm.read_header();
-	if (0 < nerr) {
-		std::cerr << "Error while reading the header file (code " << nerr << ").\n";
-		return 2;
+	if (prm.str_stream.size() > 0) { // frames from a data stream, no data files
+		if (prm.blive || prm.nserveport > 0) {
+			std::cerr << "Error: option -stream cannot be combined with /live or -serve.\n";
+			return 1;
+		}
+		nerr = prm.open_stream();
+		if (0 < nerr) {
+			std::cerr << "Error while opening the data stream (code " << nerr << ").\n";
+			return 2;
+		}
+		if (prm.hdr.n_frames <= 0) {
+			std::cerr << "Error: the data stream input requires the number of frames in the acquisition header.\n";
+			return 3;
+		}
 	}
+	else {
+		if (prm.blive) {
+			if (prm.btalk) {
+				std::cout << "\nWaiting for the acquisition to write " << prm.str_file_input << "1.mib ...\n";
+			}
+			nerr = wait_live_start();
+			if (0 < nerr) {
+				return 2;
+			}
+		}
 
-	nerr = prm.read_frame_headers();
-	if (0 < nerr) {
-		std::cerr << "Error while reading the data files (code " << nerr << ").\n";
-		return 3;
+		nerr = prm.read_header();
+		if (0 < nerr) {
+			std::cerr << "Error while reading the header file (code " << nerr << ").\n";
+			return 2;
+		}
+
+		nerr = prm.read_frame_headers();
+		if (0 < nerr) {
+			std::cerr << "Error while reading the data files (code " << nerr << ").\n";
+			return 3;
+		}
+		if (prm.blive && prm.hdr.n_frames <= 0) {
+			std::cerr << "Error: live processing requires the number of frames in the header file.\n";
+			return 3;
+		}
+
+		if (prm.nserveport > 0) { // replay the data files, no operations
+			nerr = merlin_serve_stream(&prm, prm.nserveport);
+			if (0 < nerr) {
+				std::cerr << "Error while serving the data stream (code " << nerr << ").\n";
+				return 5;
+			}
+			if (prm.btalk) {
+				std::cout << "\n";
+				std::cout << "Done.\n";
+			}
+			return 0;
+		}
+
+		prm.map_data_files(); // falls back to file streams on failure
 	}
 
 	// preset scan roi again, now that we know the frame size
@@ -27,4 +27,17 @@ This file is part of Merlinio.
 
 // TODO: add headers that you want to pre-compile here
 
+#ifndef _MSC_VER
+// builds with other compilers (see CMakeLists.txt), provide the MSVC
+// sized integer types and the headers implied by the MSVC build
+#define __int8 char
+#define __int16 short
+#define __int32 int
+#define __int64 long long
+#include <sys/stat.h>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#endif // _MSC_VER
+
 #endif //PCH_H
@@ -0,0 +1,169 @@
+# file : "large_dataset.py"
+# author: J. Barthel, Forschungszentrum Juelich GmbH, Juelich, Germany
+#         ju.barthel@fz-juelich.de
+#
+# Large dataset check of Merlinio: writes a sparse Merlin dataset of
+# more than 2^31 frames in a data file far beyond 4 GB, runs the
+# control file large_dataset_ctrl.txt on a scan roi at the end of the
+# scan and compares the results to the known values.
+#
+#   python3 large_dataset.py <merlinio> <work dir>
+#
+# Only the first frame and the frames of the roi are written, all other
+# frames are holes of the sparse file. Returns 0 on success, 1 on wrong
+# results, and 77 (skipped) where sparse files are not supported.
+#
+# -----------------------------------------------------------------------
+#
+# This file is part of Merlinio.
+#
+#	Merlinio is free software: you can redistribute it and/or modify
+#	it under the terms of the GNU General Public License as published by
+#	the Free Software Foundation, either version 3 of the License, or
+#	(at your option) any later version.
+#
+#	Merlinio is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU General Public License for more details.
+#
+#	You should have received a copy of the GNU General Public License
+#	along with Merlinio.  If not, see <http://www.gnu.org/licenses/>.
+#
+# -----------------------------------------------------------------------
+
+import math
+import os
+import shutil
+import struct
+import subprocess
+import sys
+
+SCAN_COLUMNS = 50000 # frames per scan row
+SCAN_ROWS = 43000 # scan rows, 2.15e9 frames > 2^31
+ROI = (49995, 42996, 49999, 42999) # scan roi x0, y0, x1, y1 of the control file
+FRAME_SIZE = 16 # frame pixels per row and column
+HEADER_SIZE = 384 # frame header bytes
+FRAME_BYTES = HEADER_SIZE + FRAME_SIZE * FRAME_SIZE * 2 # 16-bit data
+INT_MAX = 2**31 - 1
+SKIPPED = 77
+
+
+def roi_value(x, y):
+	# base value of the frame at scan position x, y of the roi
+	return 1 + (x - ROI[0]) + 8 * (y - ROI[1])
+
+
+def pixel_offset(i):
+	# pattern added to the base value of all frames at frame pixel i
+	return i % 5
+
+
+def frame_bytes(idx, value):
+	# header and big-endian data of frame idx with base value
+	hdr = "MQ1,%06d,%05d,01,%04d,%04d,U16,   1x1,01,2021-05-08 12:00:00.000000,0.001000,0,0,0,1.0E+1,0,0,0,0,0,0,0,3RX,0,0,0" % (idx + 1, HEADER_SIZE, FRAME_SIZE, FRAME_SIZE)
+	data = [value + pixel_offset(i) for i in range(FRAME_SIZE * FRAME_SIZE)]
+	return hdr.ljust(HEADER_SIZE).encode() + struct.pack(">%dH" % len(data), *data)
+
+
+def write_dataset(base):
+	# writes the header file and the sparse data file, returns False
+	# if the data file is not sparse
+	n_frames = SCAN_COLUMNS * SCAN_ROWS
+	with open(base + ".hdr", "w") as f:
+		f.write("HDR,\t\n")
+		f.write("Time and Date Stamp (yr, mnth, day, hr, min, s):\t2021/05/08 12:00:00\n")
+		f.write("Chip ID:\tW1,W2,W3,W4\n")
+		f.write("Frames in Acquisition (Number):\t%d\n" % n_frames)
+		f.write("Frames per Trigger (Number):\t%d\n" % SCAN_COLUMNS)
+		f.write("End\t\n")
+	with open(base + "1.mib", "wb") as f:
+		f.truncate(n_frames * FRAME_BYTES) # holes for all frames
+		f.write(frame_bytes(0, 0))
+		for y in range(ROI[1], ROI[3] + 1):
+			for x in range(ROI[0], ROI[2] + 1):
+				idx = y * SCAN_COLUMNS + x
+				f.seek(idx * FRAME_BYTES)
+				f.write(frame_bytes(idx, roi_value(x, y)))
+	st = os.stat(base + "1.mib")
+	return hasattr(st, "st_blocks") and st.st_blocks * 512 < 2**30
+
+
+def check(work, name, expected, errors):
+	# compares the values of output file name to expected with a
+	# relative tolerance
+	if not os.path.exists(os.path.join(work, name)):
+		errors.append("%s: missing output file" % name)
+		return
+	with open(os.path.join(work, name), "rb") as f:
+		data = f.read()
+	values = struct.unpack("<%dd" % (len(data) // 8), data[:len(data) // 8 * 8])
+	if len(values) != len(expected):
+		errors.append("%s: %d values instead of %d" % (name, len(values), len(expected)))
+		return
+	for i, (v, e) in enumerate(zip(values, expected)):
+		if abs(v - e) > 1.e-9 * max(1., abs(e)):
+			errors.append("%s[%d] = %.10g instead of %.10g" % (name, i, v, e))
+			return
+
+
+def run_check(merlinio, work, ctrl, args):
+	# runs the control file and checks the results
+	errors = []
+	npix = FRAME_SIZE * FRAME_SIZE
+	v = [roi_value(x, y) for y in range(ROI[1], ROI[3] + 1) for x in range(ROI[0], ROI[2] + 1)]
+	mean = sum(v) / len(v)
+	sdev = math.sqrt(sum((a - mean)**2 for a in v) / len(v))
+	poff = sum(pixel_offset(i) for i in range(npix))
+	for name in ("large_bf.dat", "large_avg.dat", "large_sdev.dat"):
+		if os.path.exists(os.path.join(work, name)):
+			os.remove(os.path.join(work, name))
+	res = subprocess.run([merlinio, "ds", "-c", ctrl] + args, cwd=work, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+	if res.returncode != 0:
+		return ["merlinio %s failed with exit code %d:\n%s" % (" ".join(args), res.returncode, res.stdout)]
+	# annular integral over the whole frame of each roi position
+	check(work, "large_bf.dat", [a * npix + poff for a in v], errors)
+	# average and standard deviation of the roi frames
+	check(work, "large_avg.dat", [mean + pixel_offset(i) for i in range(npix)], errors)
+	check(work, "large_sdev.dat", [sdev] * npix, errors)
+	return errors
+
+
+def main():
+	if len(sys.argv) < 3:
+		print("usage: python3 large_dataset.py <merlinio> <work dir>")
+		return 2
+	merlinio = os.path.abspath(sys.argv[1])
+	work = os.path.abspath(sys.argv[2])
+	ctrl = os.path.join(os.path.dirname(os.path.abspath(__file__)), "large_dataset_ctrl.txt")
+	# the roi must address frames beyond 2^31 in the data file beyond 4 GB
+	if ROI[1] * SCAN_COLUMNS + ROI[0] <= INT_MAX or ROI[1] * SCAN_COLUMNS * FRAME_BYTES < 2**32:
+		print("Error: the scan roi does not test large frame indices.")
+		return 2
+	if os.path.isdir(work):
+		shutil.rmtree(work)
+	os.makedirs(work)
+	base = os.path.join(work, "ds")
+	try:
+		bsparse = write_dataset(base)
+	except (OSError, OverflowError) as e:
+		bsparse = False
+		print("Failed to write the sparse data file: %s" % e)
+	if not bsparse:
+		shutil.rmtree(work, ignore_errors=True)
+		print("Skipped: sparse files are not supported in %s." % work)
+		return SKIPPED
+	print("- written %d frames (%.1f GB) to %s, roi frames from # %d" % (SCAN_COLUMNS * SCAN_ROWS, SCAN_COLUMNS * SCAN_ROWS * FRAME_BYTES / 2**30, base + "1.mib", ROI[1] * SCAN_COLUMNS + ROI[0]))
+	nerr = 0
+	for args in ([], ["/nommap"]): # memory-mapped and stream reading
+		errors = run_check(merlinio, work, ctrl, args)
+		print("- %s: %s" % (" ".join(["merlinio"] + args), "ok" if len(errors) == 0 else "failed"))
+		for e in errors:
+			print("  " + e)
+		nerr += len(errors)
+	shutil.rmtree(work, ignore_errors=True)
+	return 0 if nerr == 0 else 1
+
+
+if __name__ == "__main__":
+	sys.exit(main())